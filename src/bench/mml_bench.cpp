@@ -0,0 +1,107 @@
+/*! \file src/bench/mml_bench.cpp
+ *  \brief MML parser benchmark
+ *
+ *  Parses MML files repeated a number of times and prints the parser
+ *  throughput in characters per second. Build with `make RELEASE=1 bench`
+ *  for meaningful numbers.
+ *
+ *  The repeated file is written to a temporary file and parsed with
+ *  Input::open_file(), using the number of threads set with `-j`.
+ */
+#include "../song.h"
+#include "../input.h"
+#include "../mml_input.h"
+#include "../parallel.h"
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+//! Parse the file and return the best time in seconds.
+static double parse_time(const std::string& filename, int passes)
+{
+	double best = 0;
+	for(int i = 0; i < passes; i++)
+	{
+		Song song;
+		MML_Input input(&song);
+		auto start = std::chrono::steady_clock::now();
+		input.open_file(filename);
+		std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+		if(i == 0 || time.count() < best)
+			best = time.count();
+	}
+	return best;
+}
+
+int main(int argc, char* argv[])
+{
+	int repeat = 100;
+	int passes = 5;
+	int arg = 1;
+	while(arg + 1 < argc && argv[arg][0] == '-')
+	{
+		if(!std::strcmp(argv[arg], "-r"))
+			repeat = std::atoi(argv[arg + 1]);
+		else if(!std::strcmp(argv[arg], "-j"))
+			set_thread_count(std::atoi(argv[arg + 1]));
+		else
+			break;
+		arg += 2;
+	}
+	if(arg >= argc)
+	{
+		std::cout << "Usage: " << argv[0] << " [-r <repeat count>] [-j <threads>] <input_file.mml> ...\n";
+		return -1;
+	}
+	const char* temp_filename = "mml_bench.tmp";
+
+	unsigned long total_chars = 0;
+	double total_time = 0;
+	for(; arg < argc; arg++)
+	{
+		std::ifstream file(argv[arg]);
+		if(!file)
+		{
+			std::cerr << argv[arg] << ": failed to open file\n";
+			return -1;
+		}
+		std::vector<std::string> input_lines;
+		for(std::string str; std::getline(file, str);)
+			input_lines.push_back(str);
+
+		std::ofstream temp_file(temp_filename, std::ios::binary);
+		unsigned long chars = 0;
+		for(int i = 0; i < repeat; i++)
+		{
+			for(auto& str : input_lines)
+			{
+				temp_file << str << "\n";
+				chars += str.size() + 1;
+			}
+		}
+		temp_file.close();
+
+		try
+		{
+			double time = parse_time(temp_filename, passes);
+			std::remove(temp_filename);
+			std::printf("%-30s %10lu chars %8.2f ms %8.2f Mchars/s\n",
+					argv[arg], chars, time * 1000, chars / time / 1e6);
+			total_chars += chars;
+			total_time += time;
+		}
+		catch(InputError& error)
+		{
+			std::remove(temp_filename);
+			std::cerr << error.what() << "\n";
+			return -1;
+		}
+	}
+	std::printf("%-30s %10lu chars %8.2f ms %8.2f Mchars/s\n",
+			"total", total_chars, total_time * 1000, total_chars / total_time / 1e6);
+	return 0;
+}
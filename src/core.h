@@ -23,6 +23,24 @@ class Player;
 class Driver;
 class Platform;
 
+//! Compact reference to a position in an input file.
+/*!
+ *  The file is an index to the input file table (see
+ *  InputRef::add_file()). A file index of 0 means that there is no
+ *  reference.
+ */
+struct Input_Position
+{
+	unsigned int file;
+	unsigned int line;
+	unsigned int column;
+
+	bool operator==(const Input_Position& other) const
+	{
+		return file == other.file && line == other.line && column == other.column;
+	}
+};
+
 typedef std::vector<std::string> Tag;
 typedef std::map<std::string,Tag> Tag_Map;
 typedef std::map<uint16_t,Track> Track_Map;
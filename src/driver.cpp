@@ -10,7 +10,10 @@ Driver::Driver(unsigned int rate, VGM_Interface* vgm)
 	: vgm(vgm)
 	, delta(0)
 	, rate(rate)
+	, shadow_vgm(vgm)
+	, dropped_writes()
 {
+	reset_shadow_registers();
 }
 
 unsigned int Driver::get_rate()
@@ -18,18 +21,96 @@ unsigned int Driver::get_rate()
 	return rate;
 }
 
+//! Get the number of redundant register writes that were not sent.
+const Driver::Write_Counter& Driver::get_dropped_writes() const
+{
+	return dropped_writes;
+}
+
+//! Get the total number of redundant register writes that were not sent.
+uint32_t Driver::get_dropped_write_count() const
+{
+	uint32_t count = 0;
+	for(auto&& i : dropped_writes)
+		count += i.second;
+	return count;
+}
+
+//! Write a VGM command. This bypasses the shadow registers.
 void Driver::write(uint8_t command, uint16_t port, uint16_t reg, uint16_t data)
 {
 	if(vgm)
 		vgm->write(command, port, reg, data);
 }
 
+//! Set the loop point.
+/*!
+ *  The shadow registers are reset, since the register state when
+ *  the song loops back may be different from the state at the loop
+ *  point.
+ */
 void Driver::set_loop()
 {
+	reset_shadow_registers();
 	if(vgm)
 		vgm->set_loop();
 }
 
+//! Set the VGM interface. Set to nullptr to disable logging.
+/*!
+ *  The shadow registers are kept while logging is disabled, so that
+ *  logging can be resumed with the same interface.
+ */
+void Driver::set_vgm_interface(VGM_Interface* vgm)
+{
+	this->vgm = vgm;
+	if(vgm && vgm != shadow_vgm)
+	{
+		shadow_vgm = vgm;
+		reset_shadow_registers();
+	}
+}
+
+//! Forget the register values, so that the next write to each register is always sent.
+void Driver::reset_shadow_registers()
+{
+	for(auto&& port : ym2612_shadow)
+		for(auto&& reg : port)
+			reg = -1;
+	for(auto&& latch : ym2612_fnum_latch)
+		latch = -1;
+	for(auto&& reg : sn76489_shadow)
+		reg = -1;
+}
+
+//! Check if writes to a YM2612 register can be dropped if the value is unchanged.
+/*!
+ *  Key on (0x28) and timer control (0x24-0x27) writes have side effects
+ *  and are always sent. The frequency registers (0xa0-0xaf) are handled
+ *  separately by ym2612_w().
+ */
+bool Driver::ym2612_is_shadowed(uint8_t reg)
+{
+	return reg == 0x22 || reg == 0x2a || reg == 0x2b || (reg >= 0x30 && reg < 0xa0) || reg >= 0xb0;
+}
+
+//! Write a YM2612 register, unless it already has the same value.
+void Driver::ym2612_write(uint8_t port, uint8_t reg, uint8_t data)
+{
+	if(vgm && ym2612_is_shadowed(reg))
+	{
+		if(ym2612_shadow[port][reg] == data)
+			return drop_write(0x52 + port, reg);
+		ym2612_shadow[port][reg] = data;
+	}
+	write(0x52, port, reg, data);
+}
+
+void Driver::drop_write(uint8_t command, uint8_t reg)
+{
+	dropped_writes[{command, reg}]++;
+}
+
 void Driver::ym2612_w(uint8_t port, uint8_t reg, uint8_t ch, uint8_t op, uint16_t data)
 {
 	if(reg == 0x28)
@@ -37,14 +118,14 @@ void Driver::ym2612_w(uint8_t port, uint8_t reg, uint8_t ch, uint8_t op, uint16_
 		data <<= 4;
 		data += ch | (port << 2);
 		DEBUG_FM("opn-keyon port %d reg %02x data %02x (ch %d op %d)\n", port, reg, data, ch, op);
-		write(0x52, 0, reg, data);
+		ym2612_write(0, reg, data);
 	}
 	else if(reg >= 0x30 && reg < 0xa0)
 	{
 		reg += op*4;
 		reg += ch;
 		DEBUG_FM("opn-param port %d reg %02x data %02x (ch %d op %d)\n", port, reg, data, ch, op);
-		write(0x52, port, reg, data);
+		ym2612_write(port, reg, data);
 	}
 	else if(reg >= 0xa0 && reg < 0xb0) // ch3 operator freq
 	{
@@ -59,19 +140,41 @@ void Driver::ym2612_w(uint8_t port, uint8_t reg, uint8_t ch, uint8_t op, uint16_
 		else if(reg >= 0xa8 && op == 3)
 			reg = 0xa2;
 		DEBUG_FM("opn-fnum  port %d reg %02x data %04x (ch %d op %d)\n", port, reg, data, ch, op);
-		write(0x52, port, reg+4, data>>8);
-		write(0x52, port, reg, data&0xff);
+		uint8_t msb = data >> 8, lsb = data & 0xff;
+		if(!vgm)
+		{
+			write(0x52, port, reg+4, msb);
+			write(0x52, port, reg, lsb);
+			return;
+		}
+		// The MSB is latched and only written to the channel together
+		// with the LSB, so the LSB must be written after every MSB write.
+		// The latch is shared between the channels.
+		int16_t& latch = ym2612_fnum_latch[(reg & 0x08) >> 3];
+		if(ym2612_shadow[port][reg] == lsb && ym2612_shadow[port][reg+4] == msb)
+		{
+			drop_write(0x52 + port, reg+4);
+			drop_write(0x52 + port, reg);
+			return;
+		}
+		if(latch == msb && ym2612_shadow[port][reg+4] == msb)
+			drop_write(0x52 + port, reg+4);
+		else
+			write(0x52, port, reg+4, msb);
+		write(0x52, port, reg, lsb);
+		latch = ym2612_shadow[port][reg+4] = msb;
+		ym2612_shadow[port][reg] = lsb;
 	}
 	else if(reg >= 0xb0)
 	{
 		reg += ch;
 		DEBUG_FM("opn-param port %d reg %02x data %02x (ch %d op %d)\n", port, reg, data, ch, op);
-		write(0x52, port, reg, data);
+		ym2612_write(port, reg, data);
 	}
 	else
 	{
 		DEBUG_FM("opn-param port %d reg %02x data %02x\n", port, reg, data);
-		write(0x52, 0, reg, data); // port0 only
+		ym2612_write(0, reg, data); // port0 only
 	}
 }
 
@@ -84,6 +187,26 @@ void Driver::sn76489_w(uint8_t reg, uint8_t ch, uint16_t data)
 		cmd1 = (data & 0x0f) | (ch << 5) | 0x80;
 		cmd2 = data >> 4;
 		DEBUG_PSG("psg %02x,%02x (ch %d freq %04x)\n", cmd1, cmd2, ch, data);
+		// noise register writes reset the LFSR, so they are always sent
+		if(vgm && ch < 3)
+		{
+			int16_t& shadow = sn76489_shadow[ch*2];
+			if(shadow == data)
+			{
+				drop_write(0x50, cmd1 & 0xf0);
+				drop_write(0x50, cmd1 & 0xf0);
+				return;
+			}
+			// the latch byte alone only sets the lower 4 bits
+			bool msb_changed = shadow < 0 || ((shadow ^ data) & 0x3f0);
+			shadow = data;
+			write(0x50, 0, 0, cmd1);
+			if(msb_changed)
+				write(0x50, 0, 0, cmd2);
+			else
+				drop_write(0x50, cmd1 & 0xf0);
+			return;
+		}
 		// don't send second byte if noise
 		write(0x50, 0, 0, cmd1);
 		if(ch < 3)
@@ -93,6 +216,12 @@ void Driver::sn76489_w(uint8_t reg, uint8_t ch, uint16_t data)
 	{
 		cmd1 = (data & 0x0f) | (ch << 5) | 0x90;
 		DEBUG_PSG("psg %02x (ch %d vol %04x)\n", cmd1, ch,  data);
+		if(vgm)
+		{
+			if(sn76489_shadow[ch*2+1] == (data & 0x0f))
+				return drop_write(0x50, cmd1 & 0xf0);
+			sn76489_shadow[ch*2+1] = data & 0x0f;
+		}
 		write(0x50, 0, 0, cmd1);
 	}
 }
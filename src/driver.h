@@ -8,6 +8,7 @@
 #ifndef DRIVER_H
 #define DRIVER_H
 #include "core.h"
+#include <map>
 
 //! Sound driver base class.
 /*!
@@ -21,6 +22,14 @@
 class Driver
 {
 	public:
+		//! Maps a VGM command and register to a counter.
+		/*!
+		 *  The key is the VGM command (0x52/0x53 for YM2612 port 0/1,
+		 *  0x50 for SN76489) and the register. For SN76489, the register
+		 *  is the latch byte with the data bits masked (0x80-0xf0).
+		 */
+		typedef std::map<std::pair<uint8_t,uint8_t>, uint32_t> Write_Counter;
+
 		Driver(unsigned int rate, VGM_Interface* vgm);
 
 		// TODO: split into load_song() and play_song()?
@@ -42,20 +51,38 @@ class Driver
 		virtual int get_loop_count() = 0;
 
 		unsigned int get_rate();
+		const Write_Counter& get_dropped_writes() const;
+		uint32_t get_dropped_write_count() const;
 
 	protected:
 		// VGM low-level
 		void write(uint8_t command, uint16_t port, uint16_t reg, uint16_t data);
 		void set_loop();
+		void set_vgm_interface(VGM_Interface* vgm);
+		void reset_shadow_registers();
 
 		// VGM write helpers
 		void ym2612_w(uint8_t port, uint8_t reg, uint8_t ch, uint8_t op, uint16_t data);
 		void sn76489_w(uint8_t reg, uint8_t ch, uint16_t data);
 
 	private:
+		static bool ym2612_is_shadowed(uint8_t reg);
+		void ym2612_write(uint8_t port, uint8_t reg, uint8_t data);
+		void drop_write(uint8_t command, uint8_t reg);
+
 		VGM_Interface* vgm;
 		double delta;
 		unsigned int rate;
+
+		//! The interface that the shadow registers are valid for.
+		VGM_Interface* shadow_vgm;
+		//! Last written value of each register, or -1 if not known.
+		int16_t ym2612_shadow[2][256];
+		//! Last written value of the frequency MSB latches (A4-A6 and AC-AE).
+		int16_t ym2612_fnum_latch[2];
+		//! Last written PSG frequency (even) and attenuation (odd) per channel.
+		int16_t sn76489_shadow[8];
+		Write_Counter dropped_writes;
 };
 
 #endif
@@ -0,0 +1,121 @@
+#include "sn76489.h"
+
+//! Channel output level, in 2dB steps.
+const int16_t SN76489::volume_table[16] = {
+	2048, 1627, 1292, 1026, 815, 648, 514, 409,
+	325, 258, 205, 163, 129, 103, 82, 0
+};
+
+//! Constructs a SN76489.
+/*!
+ *  \param clock Chip clock in Hz.
+ *  \param rate Output sample rate in Hz.
+ */
+SN76489::SN76489(uint32_t clock, uint32_t rate)
+	: clock(clock)
+	, rate(rate)
+{
+	reset();
+}
+
+//! Reset the chip state.
+void SN76489::reset()
+{
+	tick_counter = 0;
+	latch = 0;
+	for(int ch=0; ch<4; ch++)
+	{
+		period[ch] = 0;
+		counter[ch] = 0;
+		volume[ch] = 15;
+		output[ch] = 0;
+	}
+	noise_mode = 0;
+	lfsr = 0x8000;
+}
+
+//! Set the chip clock and the output sample rate.
+void SN76489::set_clock(uint32_t new_clock, uint32_t new_rate)
+{
+	clock = new_clock;
+	rate = new_rate;
+	tick_counter = 0;
+}
+
+//! Write to the chip.
+void SN76489::write(uint8_t data)
+{
+	if(data & 0x80)
+		latch = (data >> 4) & 7;
+	int ch = latch >> 1;
+	if(latch & 1)
+	{
+		volume[ch] = data & 15;
+	}
+	else if(ch == 3)
+	{
+		noise_mode = data & 7;
+		lfsr = 0x8000;
+	}
+	else if(data & 0x80)
+	{
+		period[ch] = (period[ch] & 0x3f0) | (data & 15);
+	}
+	else
+	{
+		period[ch] = (period[ch] & 15) | ((data & 0x3f) << 4);
+	}
+}
+
+//! Clock the chip once (clock / 16).
+inline void SN76489::tick()
+{
+	for(int ch=0; ch<3; ch++)
+	{
+		if(period[ch] <= 1)
+		{
+			// Constant output, used for sample playback
+			output[ch] = 1;
+		}
+		else if(--counter[ch] == 0 || counter[ch] > period[ch])
+		{
+			counter[ch] = period[ch];
+			output[ch] ^= 1;
+		}
+	}
+
+	uint16_t noise_period = (noise_mode & 3) == 3 ? period[2] : 0x10 << (noise_mode & 3);
+	if(--counter[3] == 0 || counter[3] > noise_period)
+	{
+		counter[3] = noise_period ? noise_period : 1;
+		output[3] ^= 1;
+		if(output[3])
+		{
+			// white noise taps bits 0 and 3, periodic noise just loops bit 0
+			uint16_t feedback = (noise_mode & 4) ? (lfsr ^ (lfsr >> 3)) & 1 : lfsr & 1;
+			lfsr = (lfsr >> 1) | (feedback << 15);
+		}
+	}
+}
+
+//! Render one output sample.
+/*!
+ *  \return Sum of the channel outputs, each in the range +/- 2048.
+ */
+int32_t SN76489::update()
+{
+	int32_t sum = 0;
+	int32_t count = 0;
+	tick_counter += clock;
+	while(tick_counter >= rate * 16)
+	{
+		tick_counter -= rate * 16;
+		tick();
+		int32_t noise = (lfsr & 1) ? volume_table[volume[3]] : -volume_table[volume[3]];
+		for(int ch=0; ch<3; ch++)
+			sum += output[ch] ? volume_table[volume[ch]] : -volume_table[volume[ch]];
+		sum += noise;
+		count++;
+	}
+	return count ? sum / count : 0;
+}
@@ -0,0 +1,42 @@
+/*! \file emu/sn76489.h
+ *  \brief SN76489 (SEGA PSG) emulator.
+ */
+#ifndef EMU_SN76489_H
+#define EMU_SN76489_H
+#include <stdint.h>
+
+//! SN76489 (SEGA PSG) sound chip emulator.
+/*!
+ *  The chip is clocked at clock / 16. Output samples are generated at
+ *  an arbitrary sample rate by averaging the chip output over each
+ *  sample period.
+ */
+class SN76489
+{
+	public:
+		SN76489(uint32_t clock = 3579545, uint32_t rate = 44100);
+
+		void reset();
+		void set_clock(uint32_t clock, uint32_t rate);
+		void write(uint8_t data);
+		int32_t update();
+
+	private:
+		static const int16_t volume_table[16];
+
+		void tick();
+
+		uint32_t clock;
+		uint32_t rate;
+		uint32_t tick_counter;
+
+		uint8_t latch;
+		uint16_t period[4];
+		uint16_t counter[4];
+		uint8_t volume[4];
+		uint8_t output[4];
+		uint8_t noise_mode;
+		uint16_t lfsr;
+};
+
+#endif
@@ -0,0 +1,555 @@
+#include <cmath>
+#include <algorithm>
+#include "ym2612.h"
+
+uint16_t YM2612::logsin_table[256];
+uint16_t YM2612::exp_table[256];
+int32_t YM2612::pm_table[8][32];
+
+//! Detune, in phase increment units, indexed by DT and key code.
+const uint8_t YM2612::detune_table[4][32] = {
+	{
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+	},
+	{
+		0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2,
+		2, 3, 3, 3, 4, 4, 4, 5, 5, 6, 6, 7, 8, 8, 8, 8
+	},
+	{
+		1, 1, 1, 1, 2, 2, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5,
+		5, 6, 6, 7, 8, 8, 9,10,11,12,13,14,16,16,16,16
+	},
+	{
+		2, 2, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5, 5, 6, 6, 7,
+		8, 8, 9,10,11,12,13,14,16,17,19,20,22,22,22,22
+	},
+};
+
+//! Envelope increments for each step of the envelope counter.
+const uint8_t YM2612::eg_inc_table[19][8] = {
+	{0,1, 0,1, 0,1, 0,1}, // rates 0-11
+	{0,1, 0,1, 1,1, 0,1},
+	{0,1, 1,1, 0,1, 1,1},
+	{0,1, 1,1, 1,1, 1,1},
+	{1,1, 1,1, 1,1, 1,1}, // rate 12
+	{1,1, 1,2, 1,1, 1,2},
+	{1,2, 1,2, 1,2, 1,2},
+	{1,2, 2,2, 1,2, 2,2},
+	{2,2, 2,2, 2,2, 2,2}, // rate 13
+	{2,2, 2,4, 2,2, 2,4},
+	{2,4, 2,4, 2,4, 2,4},
+	{2,4, 4,4, 2,4, 4,4},
+	{4,4, 4,4, 4,4, 4,4}, // rate 14
+	{4,4, 4,8, 4,4, 4,8},
+	{4,8, 4,8, 4,8, 4,8},
+	{4,8, 8,8, 4,8, 8,8},
+	{8,8, 8,8, 8,8, 8,8}, // rate 15
+	{16,16, 16,16, 16,16, 16,16},
+	{0,0, 0,0, 0,0, 0,0}, // rates 0-1 (no change)
+};
+
+//! Number of samples per LFO step.
+const uint8_t YM2612::lfo_period_table[8] = {
+	108, 77, 71, 67, 62, 44, 8, 5
+};
+
+//! Initialize the operator and LFO tables.
+bool YM2612::init_tables()
+{
+	const double pi = std::acos(-1.0);
+	for(int i=0; i<256; i++)
+	{
+		// quarter of a sine wave, as -log2(sin) in 1/256 steps
+		double sine = std::sin((2*i + 1) * pi / 1024.0);
+		logsin_table[i] = std::lround(-std::log2(sine) * 256.0);
+		exp_table[i] = std::lround(4095.0 * std::pow(2.0, -i / 256.0));
+	}
+	// PM depth in cents
+	static const double pm_depth[8] = {0, 3.4, 6.7, 10, 14, 20, 40, 80};
+	for(int depth=0; depth<8; depth++)
+	{
+		for(int step=0; step<32; step++)
+		{
+			double cents = pm_depth[depth] * std::sin(step * pi / 16.0);
+			pm_table[depth][step] = std::lround((std::pow(2.0, cents / 1200.0) - 1.0) * 65536.0);
+		}
+	}
+	return true;
+}
+
+//! Constructs a YM2612.
+YM2612::YM2612()
+{
+	// Static initialization is thread safe, so that chips can be
+	// created from multiple threads.
+	static const bool tables_initialized = init_tables();
+	(void)tables_initialized;
+
+	reset();
+}
+
+//! Reset the chip state.
+void YM2612::reset()
+{
+	lfo_enable = 0;
+	lfo_frequency = 0;
+	lfo_counter = 0;
+	lfo_timer = 0;
+	lfo_am = 0;
+	ch3_mode = 0;
+	dac_enable = 0;
+	dac_data = 0;
+	fnum_latch = 0;
+	ch3_fnum_latch = 0;
+	eg_timer = 0;
+	eg_counter = 0;
+	for(int i=0; i<3; i++)
+	{
+		ch3_fnum[i] = 0;
+		ch3_block[i] = 0;
+	}
+	for(int ch=0; ch<CHANNELS; ch++)
+	{
+		fnum[ch] = 0;
+		block[ch] = 0;
+		feedback[ch] = 0;
+		algorithm[ch] = 0;
+		ams[ch] = 0;
+		pms[ch] = 0;
+		pan_l[ch] = -1;
+		pan_r[ch] = -1;
+		fb_output[ch][0] = 0;
+		fb_output[ch][1] = 0;
+	}
+	for(int op=0; op<OPERATORS; op++)
+	{
+		phase[op] = 0;
+		phase_inc[op] = 0;
+		envelope[op] = 0x3ff;
+		attenuation[op] = 0x3ff;
+		state[op] = RELEASE;
+		key[op] = 0;
+		detune[op] = 0;
+		multiple[op] = 0;
+		total_level[op] = 0;
+		key_scale[op] = 0;
+		ksr[op] = 0;
+		attack_rate[op] = 0;
+		decay_rate[op] = 0;
+		sustain_rate[op] = 0;
+		release_rate[op] = 0;
+		sustain_level[op] = 0;
+		am_mask[op] = 0;
+	}
+}
+
+//! Write a register.
+void YM2612::write(uint8_t port, uint8_t reg, uint8_t data)
+{
+	port &= 1;
+	if(reg < 0x30)
+	{
+		if(port)
+			return;
+		switch(reg)
+		{
+			case 0x22: // LFO
+				lfo_enable = data & 8;
+				lfo_frequency = data & 7;
+				if(!lfo_enable)
+				{
+					lfo_counter = 0;
+					lfo_timer = 0;
+					lfo_am = 0;
+				}
+				break;
+			case 0x27: // channel 3 mode
+				if((data & 0xc0) != ch3_mode)
+				{
+					ch3_mode = data & 0xc0;
+					update_frequency(2);
+				}
+				break;
+			case 0x28: // key on
+			{
+				static const uint8_t slot_mask[4] = {0x10, 0x40, 0x20, 0x80};
+				int ch = data & 3;
+				if(ch == 3)
+					break;
+				if(data & 4)
+					ch += 3;
+				for(int slot=0; slot<4; slot++)
+				{
+					if(data & slot_mask[slot])
+						key_on(ch*4 + slot);
+					else
+						key_off(ch*4 + slot);
+				}
+				break;
+			}
+			case 0x2a: // DAC data
+				dac_data = (data - 0x80) << 6;
+				break;
+			case 0x2b: // DAC enable
+				dac_enable = data & 0x80;
+				break;
+			default:
+				break;
+		}
+		return;
+	}
+
+	int ch = reg & 3;
+	if(ch == 3)
+		return;
+	if(reg < 0xa0)
+		write_operator((ch + port*3)*4 + ((reg >> 2) & 3), reg & 0xf0, data);
+	else if(reg >= 0xa8 && reg < 0xb0)
+	{
+		// channel 3 operator frequencies
+		if(port)
+			return;
+		if(reg & 4)
+		{
+			ch3_fnum_latch = data;
+		}
+		else
+		{
+			ch3_fnum[ch] = ((ch3_fnum_latch & 7) << 8) | data;
+			ch3_block[ch] = (ch3_fnum_latch >> 3) & 7;
+			update_frequency(2);
+		}
+	}
+	else
+		write_channel(ch + port*3, reg & 0xfc, data);
+}
+
+void YM2612::write_channel(uint8_t ch, uint8_t reg, uint8_t data)
+{
+	switch(reg)
+	{
+		case 0xa0:
+			fnum[ch] = ((fnum_latch & 7) << 8) | data;
+			block[ch] = (fnum_latch >> 3) & 7;
+			update_frequency(ch);
+			break;
+		case 0xa4:
+			fnum_latch = data;
+			break;
+		case 0xb0:
+			feedback[ch] = (data >> 3) & 7;
+			algorithm[ch] = data & 7;
+			break;
+		case 0xb4:
+			pan_l[ch] = (data & 0x80) ? -1 : 0;
+			pan_r[ch] = (data & 0x40) ? -1 : 0;
+			ams[ch] = (data >> 4) & 3;
+			pms[ch] = data & 7;
+			break;
+		default:
+			break;
+	}
+}
+
+void YM2612::write_operator(int op, uint8_t reg, uint8_t data)
+{
+	switch(reg)
+	{
+		case 0x30:
+			detune[op] = (data >> 4) & 7;
+			multiple[op] = data & 15;
+			update_frequency(op / 4);
+			break;
+		case 0x40:
+			total_level[op] = (data & 0x7f) << 3;
+			break;
+		case 0x50:
+			key_scale[op] = data >> 6;
+			attack_rate[op] = data & 31;
+			update_frequency(op / 4);
+			break;
+		case 0x60:
+			am_mask[op] = (data & 0x80) ? 0xff : 0;
+			decay_rate[op] = data & 31;
+			break;
+		case 0x70:
+			sustain_rate[op] = data & 31;
+			break;
+		case 0x80:
+			sustain_level[op] = ((data >> 4) == 15) ? 0x3e0 : (data >> 4) << 5;
+			release_rate[op] = data & 15;
+			break;
+		default: // SSG-EG is not supported
+			break;
+	}
+}
+
+void YM2612::key_on(int op)
+{
+	if(key[op])
+		return;
+	key[op] = 1;
+	phase[op] = 0;
+	int rate = attack_rate[op] ? std::min(63, attack_rate[op]*2 + ksr[op]) : 0;
+	if(rate >= 62)
+	{
+		envelope[op] = 0;
+		state[op] = sustain_level[op] ? DECAY : SUSTAIN;
+	}
+	else
+	{
+		state[op] = ATTACK;
+	}
+}
+
+void YM2612::key_off(int op)
+{
+	if(!key[op])
+		return;
+	key[op] = 0;
+	state[op] = RELEASE;
+}
+
+//! Calculate the phase increment and key scaling of the operators of a channel.
+void YM2612::update_frequency(int ch)
+{
+	// In channel 3 special mode, S1, S3 and S2 use the frequency
+	// from 0xA9, 0xA8 and 0xAA respectively.
+	static const int ch3_slot[3] = {1, 0, 2};
+	for(int slot=0; slot<4; slot++)
+	{
+		int op = ch*4 + slot;
+		uint32_t fn = fnum[ch];
+		uint32_t blk = block[ch];
+		if(ch == 2 && ch3_mode && slot < 3)
+		{
+			fn = ch3_fnum[ch3_slot[slot]];
+			blk = ch3_block[ch3_slot[slot]];
+		}
+		uint32_t f11 = (fn >> 10) & 1;
+		uint32_t f10 = (fn >> 9) & 1;
+		uint32_t f9 = (fn >> 8) & 1;
+		uint32_t f8 = (fn >> 7) & 1;
+		uint32_t n3 = (f11 & (f10 | f9 | f8)) | ((f11 ^ 1) & f10 & f9 & f8);
+		uint32_t kc = (blk << 2) | (f11 << 1) | n3;
+		ksr[op] = kc >> (3 - key_scale[op]);
+
+		int32_t inc = (fn << blk) >> 1;
+		int32_t dt = detune_table[detune[op] & 3][kc];
+		inc += (detune[op] & 4) ? -dt : dt;
+		inc &= 0x1ffff;
+		if(multiple[op])
+			phase_inc[op] = (inc * multiple[op]) & 0xfffff;
+		else
+			phase_inc[op] = inc >> 1;
+	}
+}
+
+void YM2612::update_lfo()
+{
+	if(!lfo_enable)
+		return;
+	if(++lfo_timer < lfo_period_table[lfo_frequency])
+		return;
+	lfo_timer = 0;
+	lfo_counter = (lfo_counter + 1) & 127;
+	if(lfo_counter < 64)
+		lfo_am = (lfo_counter ^ 63) << 1;
+	else
+		lfo_am = (lfo_counter & 63) << 1;
+}
+
+//! Update the envelope generator of all operators.
+void YM2612::update_envelope()
+{
+	eg_counter++;
+	for(int op=0; op<OPERATORS; op++)
+	{
+		int rate;
+		switch(state[op])
+		{
+			case ATTACK:
+				rate = attack_rate[op] ? attack_rate[op]*2 + ksr[op] : 0;
+				break;
+			case DECAY:
+				rate = decay_rate[op] ? decay_rate[op]*2 + ksr[op] : 0;
+				break;
+			case SUSTAIN:
+				rate = sustain_rate[op] ? sustain_rate[op]*2 + ksr[op] : 0;
+				break;
+			default:
+				rate = release_rate[op]*4 + 2 + ksr[op];
+				break;
+		}
+		rate = std::min(rate, 63);
+
+		int shift = (rate < 48) ? 11 - (rate >> 2) : 0;
+		if(eg_counter & ((1 << shift) - 1))
+			continue;
+
+		int select;
+		if(rate < 2)
+			select = 18;
+		else if(rate < 48)
+			select = rate & 3;
+		else if(rate < 60)
+			select = rate - 44;
+		else
+			select = 16;
+
+		int inc = eg_inc_table[select][(eg_counter >> shift) & 7];
+		if(!inc)
+			continue;
+
+		int env = envelope[op];
+		if(state[op] == ATTACK)
+		{
+			env += (~env * inc) >> 4;
+			if(env <= 0)
+			{
+				env = 0;
+				state[op] = sustain_level[op] ? DECAY : SUSTAIN;
+			}
+		}
+		else
+		{
+			env += inc;
+			if(state[op] == DECAY && env >= sustain_level[op])
+				state[op] = SUSTAIN;
+			if(env > 0x3ff)
+				env = 0x3ff;
+		}
+		envelope[op] = env;
+	}
+}
+
+//! Calculate the output of an operator.
+/*!
+ *  \param modulation Phase modulation, in units of 1/1024 of a period.
+ *  \return 14-bit signed output.
+ */
+inline int32_t YM2612::operator_output(int op, int32_t modulation) const
+{
+	uint32_t p = ((phase[op] >> 10) + modulation) & 0x3ff;
+	uint32_t quarter = (p & 0x100) ? (p & 0xff) ^ 0xff : p & 0xff;
+	uint32_t level = logsin_table[quarter] + (attenuation[op] << 2);
+	if(level >= (13 << 8))
+		return 0;
+	int32_t output = (exp_table[level & 0xff] << 1) >> (level >> 8);
+	return (p & 0x200) ? -output : output;
+}
+
+//! Calculate the output of a channel.
+/*!
+ *  The operators are in register order, so op+1 is S3 and op+2 is S2.
+ *  A modulating operator output is halved, which gives a modulation
+ *  range of +/- 4 periods.
+ */
+int32_t YM2612::update_channel(int ch)
+{
+	int op = ch*4;
+	int32_t fb = 0;
+	if(feedback[ch])
+		fb = (fb_output[ch][0] + fb_output[ch][1]) >> (10 - feedback[ch]);
+	int32_t s1 = operator_output(op, fb);
+	fb_output[ch][0] = fb_output[ch][1];
+	fb_output[ch][1] = s1;
+
+	int32_t s2, s3, output;
+	switch(algorithm[ch])
+	{
+		default:
+		case 0:
+			s2 = operator_output(op+2, s1 >> 1);
+			s3 = operator_output(op+1, s2 >> 1);
+			output = operator_output(op+3, s3 >> 1);
+			break;
+		case 1:
+			s2 = operator_output(op+2, 0);
+			s3 = operator_output(op+1, (s1 + s2) >> 1);
+			output = operator_output(op+3, s3 >> 1);
+			break;
+		case 2:
+			s2 = operator_output(op+2, 0);
+			s3 = operator_output(op+1, s2 >> 1);
+			output = operator_output(op+3, (s1 + s3) >> 1);
+			break;
+		case 3:
+			s2 = operator_output(op+2, s1 >> 1);
+			s3 = operator_output(op+1, 0);
+			output = operator_output(op+3, (s2 + s3) >> 1);
+			break;
+		case 4:
+			s3 = operator_output(op+1, 0);
+			output = operator_output(op+2, s1 >> 1)
+				+ operator_output(op+3, s3 >> 1);
+			break;
+		case 5:
+			output = operator_output(op+2, s1 >> 1)
+				+ operator_output(op+1, s1 >> 1)
+				+ operator_output(op+3, s1 >> 1);
+			break;
+		case 6:
+			output = operator_output(op+2, s1 >> 1)
+				+ operator_output(op+1, 0)
+				+ operator_output(op+3, 0);
+			break;
+		case 7:
+			output = s1
+				+ operator_output(op+2, 0)
+				+ operator_output(op+1, 0)
+				+ operator_output(op+3, 0);
+			break;
+	}
+	return std::min(8191, std::max(-8192, output));
+}
+
+//! Render one sample at the native sample rate (clock / 144).
+/*!
+ *  \param output Left and right output. Each channel has a range of
+ *         +/- 8192.
+ */
+void YM2612::update(int32_t* output)
+{
+	static const uint8_t am_shift[4] = {8, 3, 1, 0};
+
+	update_lfo();
+	if(++eg_timer == 3)
+	{
+		eg_timer = 0;
+		update_envelope();
+	}
+
+	uint8_t am[CHANNELS];
+	int32_t pm[CHANNELS];
+	for(int ch=0; ch<CHANNELS; ch++)
+	{
+		am[ch] = lfo_am >> am_shift[ams[ch]];
+		pm[ch] = lfo_enable ? pm_table[pms[ch]][lfo_counter >> 2] : 0;
+	}
+	for(int op=0; op<OPERATORS; op++)
+	{
+		uint32_t att = envelope[op] + total_level[op] + (am[op >> 2] & am_mask[op]);
+		attenuation[op] = std::min<uint32_t>(att, 0x3ff);
+	}
+
+	int32_t left = 0, right = 0;
+	for(int ch=0; ch<CHANNELS; ch++)
+	{
+		int32_t out = update_channel(ch);
+		if(ch == 5 && dac_enable)
+			out = dac_data;
+		left += out & pan_l[ch];
+		right += out & pan_r[ch];
+	}
+	output[0] = left;
+	output[1] = right;
+
+	for(int op=0; op<OPERATORS; op++)
+	{
+		int32_t inc = phase_inc[op];
+		inc += ((int64_t)inc * pm[op >> 2]) >> 16;
+		phase[op] = (phase[op] + inc) & 0xfffff;
+	}
+}
@@ -0,0 +1,106 @@
+/*! \file emu/ym2612.h
+ *  \brief YM2612 (OPN2) emulator.
+ */
+#ifndef EMU_YM2612_H
+#define EMU_YM2612_H
+#include <stdint.h>
+
+//! YM2612 (OPN2) FM sound chip emulator.
+/*!
+ *  The chip is emulated at its native sample rate (clock / 144). The
+ *  operator state is kept in arrays indexed by `channel * 4 + slot`,
+ *  where the slots are in register order (S1, S3, S2, S4), so that
+ *  the phase and envelope updates are done in simple loops over all
+ *  24 operators.
+ *
+ *  Timers, the status register, CSM mode and SSG-EG are not emulated.
+ *  The LFO phase modulation is approximated by scaling the phase
+ *  increment instead of the F-number.
+ */
+class YM2612
+{
+	public:
+		YM2612();
+
+		void reset();
+		void write(uint8_t port, uint8_t reg, uint8_t data);
+		void update(int32_t* output);
+
+	private:
+		static const int CHANNELS = 6;
+		static const int OPERATORS = CHANNELS * 4;
+
+		enum Envelope_State
+		{
+			ATTACK,
+			DECAY,
+			SUSTAIN,
+			RELEASE
+		};
+
+		static bool init_tables();
+		static uint16_t logsin_table[256];
+		static uint16_t exp_table[256];
+		static int32_t pm_table[8][32];
+		static const uint8_t detune_table[4][32];
+		static const uint8_t eg_inc_table[19][8];
+		static const uint8_t lfo_period_table[8];
+
+		void write_channel(uint8_t ch, uint8_t reg, uint8_t data);
+		void write_operator(int op, uint8_t reg, uint8_t data);
+		void key_on(int op);
+		void key_off(int op);
+		void update_frequency(int ch);
+		void update_lfo();
+		void update_envelope();
+		int32_t update_channel(int ch);
+		int32_t operator_output(int op, int32_t modulation) const;
+
+		// Global state
+		uint8_t lfo_enable;
+		uint8_t lfo_frequency;
+		uint8_t lfo_counter;
+		uint8_t lfo_timer;
+		uint8_t lfo_am;
+		uint8_t ch3_mode;
+		uint8_t dac_enable;
+		int32_t dac_data;
+		uint8_t fnum_latch;
+		uint8_t ch3_fnum_latch;
+		uint16_t ch3_fnum[3];
+		uint8_t ch3_block[3];
+		uint8_t eg_timer;
+		uint32_t eg_counter;
+
+		// Channel state
+		uint16_t fnum[CHANNELS];
+		uint8_t block[CHANNELS];
+		uint8_t feedback[CHANNELS];
+		uint8_t algorithm[CHANNELS];
+		uint8_t ams[CHANNELS];
+		uint8_t pms[CHANNELS];
+		int32_t pan_l[CHANNELS];
+		int32_t pan_r[CHANNELS];
+		int32_t fb_output[CHANNELS][2];
+
+		// Operator state
+		uint32_t phase[OPERATORS];
+		uint32_t phase_inc[OPERATORS];
+		uint16_t envelope[OPERATORS];
+		uint16_t attenuation[OPERATORS];
+		uint8_t state[OPERATORS];
+		uint8_t key[OPERATORS];
+		uint8_t detune[OPERATORS];
+		uint8_t multiple[OPERATORS];
+		uint16_t total_level[OPERATORS];
+		uint8_t key_scale[OPERATORS];
+		uint8_t ksr[OPERATORS];
+		uint8_t attack_rate[OPERATORS];
+		uint8_t decay_rate[OPERATORS];
+		uint8_t sustain_rate[OPERATORS];
+		uint8_t release_rate[OPERATORS];
+		uint16_t sustain_level[OPERATORS];
+		uint8_t am_mask[OPERATORS];
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include <cstdio>
 #include <iostream>
 #include <stdexcept>
+#include <mutex>
 
 //! Creates an InputError exception.
 /*!
@@ -32,34 +33,165 @@ const char* InputError::what()
 
 //=============================================================================
 
+namespace
+{
+	//! Input file table entry.
+	struct Input_File
+	{
+		std::string filename;
+		//! File contents, if available.
+		std::shared_ptr<const std::string> data;
+		//! Start offset of each line in the file contents.
+		std::vector<unsigned long> line_offsets;
+		//! Line contents set by InputRef::set_line_contents().
+		std::map<unsigned int, std::string> lines;
+	};
+
+	std::mutex file_table_mutex;
+	//! Entries are never removed, so pointers to them stay valid.
+	std::vector<std::unique_ptr<Input_File>> file_table;
+	//! Entries for references that only have a filename.
+	std::map<std::string, unsigned int> filename_index;
+
+	const Input_File* get_file(unsigned int file)
+	{
+		std::lock_guard<std::mutex> lock(file_table_mutex);
+		if(file == 0 || file > file_table.size())
+			return nullptr;
+		return file_table[file - 1].get();
+	}
+
+	//! Get a shared entry for references without line contents.
+	unsigned int get_filename_entry(const std::string& filename)
+	{
+		std::lock_guard<std::mutex> lock(file_table_mutex);
+		unsigned int& index = filename_index[filename];
+		if(!index)
+		{
+			file_table.emplace_back(new Input_File{filename, nullptr, {}, {}});
+			index = file_table.size();
+		}
+		return index;
+	}
+}
+
 //! Creates an InputRef.
+/*!
+ *  If the line contents are not empty, a new entry is added to the
+ *  input file table to hold them. Otherwise references with the same
+ *  filename share an entry.
+ */
 InputRef::InputRef(const std::string &fn, const std::string &ln, int lno, int col)
-	: filename(fn), line_contents(ln), line(lno), column(col)
+	: position{ln.size() ? add_file(fn) : get_filename_entry(fn), (unsigned int)lno, (unsigned int)col}
+{
+	if(ln.size())
+		set_line_contents(position.file, lno, ln);
+}
+
+//! Creates an InputRef from a position.
+InputRef::InputRef(const Input_Position& position)
+	: position(position)
 {
 }
 
 //! Return the file name
 const std::string& InputRef::get_filename() const
 {
-	return filename;
+	static const std::string empty = "";
+	const Input_File* file = get_file(position.file);
+	return file ? file->filename : empty;
 }
 
 //! Return the line number
 const unsigned int& InputRef::get_line() const
 {
-	return line;
+	return position.line;
 }
 
 //! Return the column number
 const unsigned int& InputRef::get_column() const
 {
-	return column;
+	return position.column;
 }
 
 //! Return the contents of the line.
-const std::string& InputRef::get_line_contents() const
+/*!
+ *  If the line contents were not set with set_line_contents(), the
+ *  line is read from the file contents.
+ */
+std::string InputRef::get_line_contents() const
+{
+	std::shared_ptr<const std::string> data;
+	unsigned long pos, end;
+	{
+		std::lock_guard<std::mutex> lock(file_table_mutex);
+		if(position.file == 0 || position.file > file_table.size())
+			return "";
+		const Input_File& file = *file_table[position.file - 1];
+		auto it = file.lines.find(position.line);
+		if(it != file.lines.end())
+			return it->second;
+		if(!file.data || position.line >= file.line_offsets.size())
+			return "";
+		data = file.data;
+		pos = file.line_offsets[position.line];
+		if(position.line + 1 < file.line_offsets.size())
+			end = file.line_offsets[position.line + 1] - 1;
+		else
+			end = data->size();
+	}
+	if(end > pos && (*data)[end - 1] == '\r')
+		end--;
+	return data->substr(pos, end - pos);
+}
+
+//! Return the compact position.
+const Input_Position& InputRef::get_position() const
+{
+	return position;
+}
+
+//! Add a file to the input file table.
+/*!
+ *  Each call adds a new entry, so that inputs with the same name
+ *  (such as lines that were not read from a file) do not share
+ *  line contents.
+ *
+ *  \param filename Name of the file.
+ *  \param data File contents, if available.
+ *  \return File index, used in Input_Position.
+ */
+unsigned int InputRef::add_file(const std::string& filename, std::shared_ptr<const std::string> data)
+{
+	std::unique_ptr<Input_File> file(new Input_File{filename, data, {}, {}});
+	if(data)
+	{
+		// Index the lines once, so that line contents can be looked up quickly
+		unsigned long pos = 0;
+		while(pos < data->size())
+		{
+			file->line_offsets.push_back(pos);
+			pos = data->find('\n', pos);
+			if(pos == std::string::npos)
+				break;
+			pos++;
+		}
+	}
+	std::lock_guard<std::mutex> lock(file_table_mutex);
+	file_table.push_back(std::move(file));
+	return file_table.size();
+}
+
+//! Set the line contents for a file in the input file table.
+/*!
+ *  This is used when the input is not read from a file. The contents
+ *  replace those from the file data.
+ */
+void InputRef::set_line_contents(unsigned int file, unsigned int line, const std::string& contents)
 {
-	return line_contents;
+	std::lock_guard<std::mutex> lock(file_table_mutex);
+	if(file && file <= file_table.size())
+		file_table[file - 1]->lines[line] = contents;
 }
 
 //! Print a formatted InputRef.
@@ -132,22 +264,32 @@ void Input::parse_error(const char* msg)
  */
 void Input::parse_warning(const char* msg)
 {
-	std::cerr << *get_reference() << ": " << msg << "\n";
-	std::cerr << get_reference()->get_line_contents() << std::endl;
+	print_warning(*get_reference(), msg);
+}
+
+//! Print a parse warning.
+void Input::print_warning(const InputRef& ref, const char* msg)
+{
+	std::cerr << ref << ": " << msg << "\n";
+	std::cerr << ref.get_line_contents() << std::endl;
 }
 
 //=============================================================================
 
 //! Creates a Line_Buffer
 Line_Buffer::Line_Buffer(std::string line, unsigned int column)
-	: column(column)
+	: line_start(0)
+	, line_length(line.size())
+	, column(column)
 {
-	buffer = std::make_shared<std::string>(line);
+	buffer = std::make_shared<const std::string>(line);
 }
 
 //! Duplicates a Line_Buffer
 Line_Buffer::Line_Buffer(const class Line_Buffer& original)
 	: buffer(original.buffer)
+	, line_start(original.line_start)
+	, line_length(original.line_length)
 	, column(original.column)
 {
 }
@@ -166,12 +308,12 @@ Line_Buffer::~Line_Buffer()
  */
 int Line_Buffer::get()
 {
-	if(column >= buffer->size())
+	if(column >= line_length)
 	{
 		column++;
 		return 0;
 	}
-	return (*buffer)[column++];
+	return (*buffer)[line_start + column++];
 }
 
 //! Get the next non-blank character from the buffer.
@@ -195,6 +337,23 @@ int Line_Buffer::get_token()
  *  \exception std::invalid_argument if no number could be read.
  */
 int Line_Buffer::get_num()
+{
+	int value;
+	if(!try_get_num(value))
+		throw std::invalid_argument("expected number");
+	return value;
+}
+
+//! Get a number from the buffer, if there is one.
+/*!
+ *  This works like get_num(), but returns false instead of throwing
+ *  an exception if no number could be read. Use this when the number
+ *  is optional.
+ *
+ *  \param[out] value The number that was read.
+ *  \retval true if a number was read.
+ */
+bool Line_Buffer::try_get_num(int& value)
 {
 	int base = 10;
 	int c = get_token();
@@ -202,30 +361,38 @@ int Line_Buffer::get_num()
 		base = 16;
 	else
 		unget(c);
-	if(column == buffer->size())
-		throw std::invalid_argument("expected number");
-	const char* ptr = buffer->c_str() + column;
+	if(column >= line_length)
+		return false;
+	const char* ptr = buffer->c_str() + line_start + column;
 	const char* endptr = ptr;
-	int ret = strtol(ptr, (char**)&endptr, base);
+	// strtol would skip the line break
+	if(std::isspace((unsigned char)*ptr))
+		return false;
+	// Fast check, as most optional numbers are missing
+	if(!std::isxdigit((unsigned char)*ptr) && *ptr != '-' && *ptr != '+')
+		return false;
+	value = strtol(ptr, (char**)&endptr, base);
 	if(ptr == endptr)
-		throw std::invalid_argument("expected number");
+		return false;
 	column += endptr - ptr;
-	return ret;
+	return true;
 }
 
 //! Return a substring starting from the current position.
 std::string Line_Buffer::get_line()
 {
-	return std::string(*buffer, column);
+	if(column > line_length)
+		throw std::out_of_range("column out of range");
+	return buffer->substr(line_start + column, line_length - column);
 }
 
 //! Put back the character to the buffer, decrementing the buffer position.
 /*!
  *  The buffer position is decremented by this call.
  *
- *  \param c character to put back. If this is 0, no character will be put
- *           back and the buffer contents are unchanged. Effectively doing
- *           the same as a seek(tell-1);
+ *  \param c character to put back. This must be the character returned
+ *           by the previous get(), as the buffer contents are never
+ *           modified. Effectively doing the same as a seek(tell-1);
  *
  *  \exception std::out_of_range If the buffer position is already at 0.
  */
@@ -233,12 +400,7 @@ void Line_Buffer::unget(int c)
 {
 	if(column == 0)
 		throw std::out_of_range("unget too many");
-	if(c == 0)
-	{
-		column--;
-		return;
-	}
-	(*buffer)[--column] = c;
+	column--;
 }
 
 //! Get current buffer position.
@@ -256,16 +418,33 @@ void Line_Buffer::seek(unsigned long pos)
 //! Set the contents of the buffer and reset the position.
 void Line_Buffer::set_buffer(std::string line, unsigned int new_column)
 {
-	buffer = std::make_shared<std::string>(line);
-	if(new_column >= 0)
-		column = new_column;
+	line_start = 0;
+	line_length = line.size();
+	buffer = std::make_shared<const std::string>(std::move(line));
+	column = new_column;
+}
+
+//! Set the current line to a part of a shared buffer.
+/*!
+ *  The data is not copied.
+ *
+ *  \param data Buffer containing the line.
+ *  \param start Position of the line in the buffer.
+ *  \param length Length of the line.
+ */
+void Line_Buffer::set_buffer(std::shared_ptr<const std::string> data, unsigned long start, unsigned long length, unsigned int new_column)
+{
+	buffer = data;
+	line_start = start;
+	line_length = length;
+	column = new_column;
 }
 
 //=============================================================================
 
 //! Creates a Line_Input.
 Line_Input::Line_Input(Song* song)
-	: Input(song), Line_Buffer("", 0), line(0)
+	: Input(song), Line_Buffer("", 0), line(0), file_id(0), has_file_data(false)
 {
 }
 
@@ -274,24 +453,84 @@ Line_Input::~Line_Input()
 }
 
 //! Open file and parse lines.
+/*!
+ *  The whole file is read into a single buffer, which is shared by
+ *  the parser and the input file table.
+ */
 void Line_Input::parse_file()
 {
-	std::ifstream inputfile = std::ifstream(get_filename());
-	buffer = std::make_shared<std::string>("");
+	std::ifstream inputfile = std::ifstream(get_filename(), std::ios::binary);
+	set_buffer("");
 	if(!inputfile)
 		parse_error("failed to open file");
+	inputfile.seekg(0, std::ios::end);
+	std::streamoff size = inputfile.tellg();
+	if(size < 0)
+		parse_error("failed to read file");
+	auto data = std::make_shared<std::string>();
+	data->resize(size);
+	inputfile.seekg(0, std::ios::beg);
+	inputfile.read(&(*data)[0], data->size());
+	data->resize(inputfile.gcount());
+
+	std::shared_ptr<const std::string> file_data = data;
+	set_file_data(file_data);
+	unsigned long pos = 0;
 	line = 0;
-	for(std::string str; std::getline(inputfile, str);)
+	while(pos < file_data->size())
 	{
-		read_line(str);
+		unsigned long end = file_data->find('\n', pos);
+		if(end == std::string::npos)
+			end = file_data->size();
+		unsigned long length = end - pos;
+		if(length && (*file_data)[end - 1] == '\r')
+			length--;
+		set_buffer(file_data, pos, length);
+		parse_line();
+		pos = end + 1;
 		line++;
 	}
 }
 
+//! Get an InputRef to the current position.
+/*!
+ *  The current line is also stored in the input file table, in case
+ *  it was not read from the file data.
+ */
 std::shared_ptr<InputRef> Line_Input::get_reference()
 {
-	InputRef r = InputRef(get_filename(), *buffer, line, column);
-	return std::make_shared<InputRef>(r);
+	if(!has_file_data)
+		InputRef::set_line_contents(get_file_id(), line, buffer->substr(line_start, line_length));
+	return std::make_shared<InputRef>(get_position());
+}
+
+//! Get the current position.
+/*!
+ *  This is cheaper than get_reference() and is used to set the
+ *  Track references.
+ */
+Input_Position Line_Input::get_position()
+{
+	return {get_file_id(), line, column};
+}
+
+//! Get the input file table index for the current file.
+unsigned int Line_Input::get_file_id()
+{
+	if(!file_id)
+		file_id = InputRef::add_file(get_filename());
+	return file_id;
+}
+
+//! Set the contents of the input file.
+/*!
+ *  The data is added to the input file table, so that line contents
+ *  can be retrieved from references.
+ */
+void Line_Input::set_file_data(std::shared_ptr<const std::string> data)
+{
+	file_id = InputRef::add_file(get_filename(), data);
+	has_file_data = true;
 }
 
 //! Read a single input line and parse it.
@@ -300,9 +539,23 @@ std::shared_ptr<InputRef> Line_Input::get_reference()
  */
 void Line_Input::read_line(const std::string& input_line, int line_number)
 {
-	if (line_number >= 0)
-		line = line_number;
-	column = 0;
-	buffer = std::make_shared<std::string>(input_line);
+	set_line(input_line, (line_number >= 0) ? line_number : line);
 	parse_line();
 }
+
+//! Set the current line without parsing it.
+void Line_Input::set_line(const std::string& input_line, unsigned int line_number, unsigned int new_column)
+{
+	line = line_number;
+	set_buffer(input_line, new_column);
+	if(!has_file_data)
+		InputRef::set_line_contents(get_file_id(), line, input_line);
+}
+
+//! Set the current line to a part of the file data without parsing it.
+void Line_Input::set_line(std::shared_ptr<const std::string> data, unsigned long start, unsigned long length,
+		unsigned int line_number, unsigned int new_column)
+{
+	line = line_number;
+	set_buffer(data, start, length, new_column);
+}
@@ -37,6 +37,9 @@ class InputError : public std::exception
  *  The reference includes the filename, and if applicable, line and
  *  column numbers as well as the contents of the line.
  *
+ *  Only the Input_Position is stored. The filename and line contents
+ *  are looked up from the input file table when requested.
+ *
  *  \todo this class could also be abstracted or extended to
  *        better support tracker file formats.
  */
@@ -44,17 +47,19 @@ class InputRef
 {
 	public:
 		InputRef(const std::string& filename = "", const std::string& line = "", int line_no = 0, int column = 0);
+		InputRef(const Input_Position& position);
 
 		const std::string& get_filename() const;
 		const unsigned int& get_line() const;
 		const unsigned int& get_column() const;
-		const std::string& get_line_contents() const;
+		std::string get_line_contents() const;
+		const Input_Position& get_position() const;
+
+		static unsigned int add_file(const std::string& filename, std::shared_ptr<const std::string> data = nullptr);
+		static void set_line_contents(unsigned int file, unsigned int line, const std::string& contents);
 
 	private:
-		std::string filename;
-		std::string line_contents;
-		unsigned int line;
-		unsigned int column;
+		Input_Position position;
 };
 
 std::ostream& operator<<(std::ostream& os, const class InputRef& ref);
@@ -83,7 +88,8 @@ class Input
 		virtual std::shared_ptr<InputRef> get_reference();
 
 		void parse_error(const char* msg);
-		void parse_warning(const char* msg);
+		virtual void parse_warning(const char* msg);
+		static void print_warning(const InputRef& ref, const char* msg);
 		void include_file(const std::string filename);
 
 		//! Used by derived classes to open and parse a file.
@@ -110,14 +116,18 @@ class Line_Buffer
 		int get();
 		int get_token();
 		int get_num();
+		bool try_get_num(int& value);
 		std::string get_line();
 		void unget(int c = 0);
 		unsigned long tell();
 		void seek(unsigned long pos);
 
 	protected:
-		std::shared_ptr<std::string> buffer; // current line used by get/unget functions, etc.
+		std::shared_ptr<const std::string> buffer; // data used by get/unget functions, etc.
+		unsigned long line_start; // position of the current line in the buffer
+		unsigned long line_length; // length of the current line
 		void set_buffer(std::string line, unsigned int new_column = 0);
+		void set_buffer(std::shared_ptr<const std::string> data, unsigned long start, unsigned long length, unsigned int new_column = 0);
 
 		unsigned int column;
 };
@@ -146,14 +156,22 @@ class Line_Input: public Input, protected Line_Buffer
 
 	protected:
 		std::shared_ptr<InputRef> get_reference();
+		Input_Position get_position();
+		void set_line(const std::string& input_line, unsigned int line_number, unsigned int new_column = 0);
+		void set_line(std::shared_ptr<const std::string> data, unsigned long start, unsigned long length,
+				unsigned int line_number, unsigned int new_column = 0);
+		void set_file_data(std::shared_ptr<const std::string> data);
+		void parse_file();
 
 		//! Used by derived classes to read the input lines.
 		virtual void parse_line() = 0;
 
 	private:
-		void parse_file();
+		unsigned int get_file_id();
 
 		unsigned int line;
+		unsigned int file_id;
+		bool has_file_data;
 };
 
 #endif
@@ -1,36 +1,41 @@
 #include <iostream>
+#include <algorithm>
+#include <set>
 #include <cctype>
 #include <stdexcept>
+#include <exception>
+#include <typeinfo>
 #include "mml_input.h"
 #include "song.h"
 #include "track.h"
 #include "stringf.h"
+#include "parallel.h"
 
 unsigned int MML_Input::read_duration()
 {
 	int duration = 0, dot;
-	try
+	bool found;
+	int c = get();
+	if(c == ':')
 	{
-		int c = get();
-		if(c == ':')
-		{
-			duration = get_num();
-		}
-		else
+		found = try_get_num(duration);
+	}
+	else
+	{
+		unget(c);
+		int div;
+		found = try_get_num(div);
+		if(found)
 		{
-			unget(c);
-			int div = get_num();
 			if(div < 1)
 				parse_error("illegal duration");
 			duration = track->get_measure_len() / div;
 		}
-		if(duration < 0)
-			parse_error("illegal duration");
 	}
-	catch(std::invalid_argument&)
-	{
+	if(!found)
 		duration = track->get_duration();
-	}
+	else if(duration < 0)
+		parse_error("illegal duration");
 	dot = duration>>1;
 	while(1)
 	{
@@ -50,14 +55,10 @@ unsigned int MML_Input::read_duration()
 
 int MML_Input::read_parameter(int default_parameter)
 {
-	try
-	{
-		return get_num();
-	}
-	catch(std::invalid_argument&)
-	{
-		return default_parameter;
-	}
+	int value;
+	if(try_get_num(value))
+		return value;
+	return default_parameter;
 }
 
 int MML_Input::expect_parameter()
@@ -104,29 +105,8 @@ int MML_Input::read_note(int c)
 	return val + sig;
 }
 
-//! Platform-exclusive messages ('<key> <value> ...')
-void MML_Input::platform_exclusive()
-{
-	std::string str = "";
-	char c = get();
-	while(c && c != '\'')
-	{
-		str.push_back(c);
-		c = get();
-	}
-	if(c != '\'')
-		parse_error("unterminated platform-exclusive message");
-	int16_t param = get_song().register_platform_command(-1, str);
-	track->add_event(Event::PLATFORM, param);
-}
-
-void MML_Input::mml_slur()
-{
-	if(track->add_slur())
-		parse_warning("slur may not affect articulation of previous note");
-}
-
-void MML_Input::mml_reverse_rest(int duration)
+//! Reverse rest with error messages.
+void MML_Input::reverse_rest(int duration)
 {
 	try
 	{
@@ -142,17 +122,142 @@ void MML_Input::mml_reverse_rest(int duration)
 	}
 }
 
-void MML_Input::mml_grace()
+//! combination command that allows for two Event::Type depending on
+//! if a sign prefix is found.
+void MML_Input::event_relative(Event::Type type, Event::Type subtype)
+{
+	int c = get_token();
+	if(c == '+' || c == '-')
+		type = subtype;
+	if(c != '+')
+		unget();
+	if(type == Event::INVALID)
+		parse_error("parameter must be relative (+ or - prefix)");
+	track->add_event(type, expect_parameter());
+}
+
+//! Event without parameters.
+void MML_Input::mml_event(int c, Event::Type type)
+{
+	track->add_event(type);
+}
+
+//! Event with a required parameter.
+void MML_Input::mml_event_param(int c, Event::Type type)
+{
+	track->add_event(type, expect_parameter());
+}
+
+//! Event with a required signed parameter.
+void MML_Input::mml_event_signed(int c, Event::Type type)
+{
+	track->add_event(type, expect_signed());
+}
+
+//! Note (`a` to `h`)
+void MML_Input::mml_note(int c, Event::Type type)
+{
+	c = read_note(c);
+	track->add_note(c, read_duration());
+}
+
+//! Rest (`r`)
+void MML_Input::mml_rest(int c, Event::Type type)
+{
+	track->add_rest(read_duration());
+}
+
+//! Tie (`^`)
+void MML_Input::mml_tie(int c, Event::Type type)
+{
+	track->add_tie(read_duration());
+}
+
+//! Slur (`&`)
+void MML_Input::mml_slur(int c, Event::Type type)
+{
+	if(track->add_slur())
+		parse_warning("slur may not affect articulation of previous note");
+}
+
+//! Set octave (`o`)
+void MML_Input::mml_octave(int c, Event::Type type)
+{
+	track->set_octave(expect_parameter() - 1);
+}
+
+//! Change octave (`<` and `>`)
+void MML_Input::mml_octave_change(int c, Event::Type type)
 {
-	int c = read_note(get_token());
+	track->change_octave((c == '<') ? -1 : 1);
+}
+
+//! Set default duration (`l`)
+void MML_Input::mml_length(int c, Event::Type type)
+{
+	track->set_duration(read_duration());
+}
+
+//! Set quantize (`Q`)
+void MML_Input::mml_quantize(int c, Event::Type type)
+{
+	track->set_quantize(expect_parameter());
+}
+
+//! Set early release (`q`)
+void MML_Input::mml_early_release(int c, Event::Type type)
+{
+	track->set_early_release(expect_parameter());
+}
+
+//! Reverse rest (`R`)
+void MML_Input::mml_reverse_rest(int c, Event::Type type)
+{
+	reverse_rest(read_duration());
+}
+
+//! Grace note (`~`)
+void MML_Input::mml_grace(int c, Event::Type type)
+{
+	c = read_note(get_token());
 	int duration = read_duration();
-	mml_reverse_rest(duration);
+	reverse_rest(duration);
 	track->add_note(c, duration);
 }
 
-void MML_Input::mml_transpose()
+//! Loop end (`]`)
+void MML_Input::mml_loop_end(int c, Event::Type type)
 {
-	int c = get_token();
+	track->add_event(Event::LOOP_END, read_parameter(2));
+}
+
+//! Platform-exclusive messages ('<key> <value> ...')
+void MML_Input::mml_platform_exclusive(int c, Event::Type type)
+{
+	std::string str = "";
+	c = get();
+	while(c && c != '\'')
+	{
+		str.push_back(c);
+		c = get();
+	}
+	if(c != '\'')
+		parse_error("unterminated platform-exclusive message");
+	if(platform_commands)
+	{
+		// Registered in order by parse_tracks()
+		platform_commands->push_back({get_position().line, track_offset, track_id, track->get_event_count(), str});
+		track->add_event(Event::PLATFORM, 0);
+		return;
+	}
+	int16_t param = get_song().register_platform_command(-1, str);
+	track->add_event(Event::PLATFORM, param);
+}
+
+//! Transpose and key signature (`_` and `k`)
+void MML_Input::mml_transpose(int c, Event::Type type)
+{
+	c = get_token();
 	if(c == '_')
 	{
 		track->add_event(Event::TRANSPOSE_REL, expect_signed());
@@ -184,127 +289,73 @@ void MML_Input::mml_transpose()
 	}
 }
 
-//! combination command that allows for two Event::Type depending on
-//! if a sign prefix is found.
-void MML_Input::event_relative(Event::Type type, Event::Type subtype)
+//! Relative volume (`(` and `)`)
+void MML_Input::mml_volume_change(int c, Event::Type type)
 {
-	int c = get_token();
-	if(c == '+' || c == '-')
-		type = subtype;
-	if(c != '+')
-		unget();
-	if(type == Event::INVALID)
-		parse_error("parameter must be relative (+ or - prefix)");
-	track->add_event(type, expect_parameter());
+	int param = read_parameter(1);
+	track->add_event(Event::VOL_REL, (c == '(') ? -param : param);
 }
 
-// Basic MML command parser. Commands defined here are the ones
-// unlikely to change in different MML dialects.
-bool MML_Input::mml_basic()
+//! Fine volume (`V`)
+void MML_Input::mml_volume_fine(int c, Event::Type type)
 {
-	int c = get_token();
-	if(c >= 'a' && c <= 'h')
-	{
-		c = read_note(c);
-		track->add_note(c, read_duration());
-	}
-	else if(c == 'r')
-		track->add_rest(read_duration());
-	else if(c == '^')
-		track->add_tie(read_duration());
-	else if(c == '&')
-		mml_slur();
-	else if(c == 'o')
-		track->set_octave(expect_parameter() - 1);
-	else if(c == '<')
-		track->change_octave(-1);
-	else if(c == '>')
-		track->change_octave(1);
-	else if(c == 'l')
-		track->set_duration(read_duration());
-	else if(c == 'Q')
-		track->set_quantize(expect_parameter());
-	else if(c == 'q')
-		track->set_early_release(expect_parameter());
-	else if(c == 'R')
-		mml_reverse_rest(read_duration());
-	else if(c == '~')
-		mml_grace();
-	else
-	{
-		unget(c);
-		return true;
-	}
-	return false;
+	event_relative(Event::VOL_FINE, Event::VOL_FINE_REL);
 }
 
-bool MML_Input::mml_control()
+//! Set drum mode (`D`)
+void MML_Input::mml_drum_mode(int c, Event::Type type)
 {
-	int c = get_token();
-	if(c == '[')
-		track->add_event(Event::LOOP_START);
-	else if(c == '/')
-		track->add_event(Event::LOOP_BREAK);
-	else if(c == ']')
-		track->add_event(Event::LOOP_END, read_parameter(2));
-	else if(c == 'L')
-		track->add_event(Event::SEGNO);
-	else if(c == '*')
-		track->add_event(Event::JUMP, expect_parameter());
-	else if(c == '\'')
-		platform_exclusive();
-	else
-	{
-		unget(c);
-		return true;
-	}
-	return false;
+	track->set_drum_mode(expect_parameter());
 }
 
-// Dialect specific MML commands
-bool MML_Input::mml_envelope()
+//! Build the default command table.
+constexpr MML_Input::Command_Table MML_Input::make_command_table()
 {
-	int c = get_token();
-	if(c == '@')
-		track->add_event(Event::INS, expect_parameter());
-	else if(c == '_')
-		mml_transpose();
-	else if(c == 'k') // TODO: ktype command to set compile-time transpose?
-		mml_transpose();
-	else if(c == 'K')
-		track->add_event(Event::DETUNE, expect_signed());
-	else if(c == 'v')
-		track->add_event(Event::VOL, expect_parameter());
-	else if(c == '(')
-		track->add_event(Event::VOL_REL, -read_parameter(1));
-	else if(c == ')')
-		track->add_event(Event::VOL_REL, read_parameter(1));
-	else if(c == 'V')
-		event_relative(Event::VOL_FINE, Event::VOL_FINE_REL);
-	else if(c == 'p')
-		track->add_event(Event::PAN, expect_signed());
-	else if(c == 'E')
-		track->add_event(Event::VOL_ENVELOPE, expect_parameter());
-	else if(c == 'M')
-		track->add_event(Event::PITCH_ENVELOPE, expect_parameter());
-	else if(c == 'P')
-		track->add_event(Event::PAN_ENVELOPE, expect_parameter());
-	else if(c == 'G')
-		track->add_event(Event::PORTAMENTO, expect_parameter());
-	else if(c == 'D')
-		track->set_drum_mode(expect_parameter());
-	else if(c == 't')
-		track->add_event(Event::TEMPO_BPM, expect_parameter());
-	else if(c == 'T')
-		track->add_event(Event::TEMPO, expect_parameter());
-	else
-	{
-		unget(c);
-		return true;
-	}
-	return false;
+	Command_Table table = {};
+	// Basic commands. These are unlikely to change in different MML dialects.
+	for(int c = 'a'; c <= 'h'; c++)
+		table.command[c] = {&MML_Input::mml_note, Event::NOTE};
+	table.command['r'] = {&MML_Input::mml_rest, Event::REST};
+	table.command['^'] = {&MML_Input::mml_tie, Event::TIE};
+	table.command['&'] = {&MML_Input::mml_slur, Event::SLUR};
+	table.command['o'] = {&MML_Input::mml_octave, Event::INVALID};
+	table.command['<'] = {&MML_Input::mml_octave_change, Event::INVALID};
+	table.command['>'] = {&MML_Input::mml_octave_change, Event::INVALID};
+	table.command['l'] = {&MML_Input::mml_length, Event::INVALID};
+	table.command['Q'] = {&MML_Input::mml_quantize, Event::INVALID};
+	table.command['q'] = {&MML_Input::mml_early_release, Event::INVALID};
+	table.command['R'] = {&MML_Input::mml_reverse_rest, Event::INVALID};
+	table.command['~'] = {&MML_Input::mml_grace, Event::NOTE};
+	// Loop control
+	table.command['['] = {&MML_Input::mml_event, Event::LOOP_START};
+	table.command['/'] = {&MML_Input::mml_event, Event::LOOP_BREAK};
+	table.command[']'] = {&MML_Input::mml_loop_end, Event::LOOP_END};
+	table.command['L'] = {&MML_Input::mml_event, Event::SEGNO};
+	table.command['*'] = {&MML_Input::mml_event_param, Event::JUMP};
+	table.command['\''] = {&MML_Input::mml_platform_exclusive, Event::PLATFORM};
+	// Dialect specific commands. Instrument, volume, envelope etc.
+	table.command['@'] = {&MML_Input::mml_event_param, Event::INS};
+	table.command['_'] = {&MML_Input::mml_transpose, Event::TRANSPOSE};
+	table.command['k'] = {&MML_Input::mml_transpose, Event::TRANSPOSE}; // TODO: ktype command to set compile-time transpose?
+	table.command['K'] = {&MML_Input::mml_event_signed, Event::DETUNE};
+	table.command['v'] = {&MML_Input::mml_event_param, Event::VOL};
+	table.command['('] = {&MML_Input::mml_volume_change, Event::VOL_REL};
+	table.command[')'] = {&MML_Input::mml_volume_change, Event::VOL_REL};
+	table.command['V'] = {&MML_Input::mml_volume_fine, Event::VOL_FINE};
+	table.command['p'] = {&MML_Input::mml_event_signed, Event::PAN};
+	table.command['E'] = {&MML_Input::mml_event_param, Event::VOL_ENVELOPE};
+	table.command['M'] = {&MML_Input::mml_event_param, Event::PITCH_ENVELOPE};
+	table.command['P'] = {&MML_Input::mml_event_param, Event::PAN_ENVELOPE};
+	table.command['G'] = {&MML_Input::mml_event_param, Event::PORTAMENTO};
+	table.command['D'] = {&MML_Input::mml_drum_mode, Event::INVALID};
+	table.command['t'] = {&MML_Input::mml_event_param, Event::TEMPO_BPM};
+	table.command['T'] = {&MML_Input::mml_event_param, Event::TEMPO};
+	return table;
 }
 
+//! Default MML command table.
+const MML_Input::Command_Table MML_Input::default_commands = MML_Input::make_command_table();
+
 void MML_Input::conditional_block_begin()
 {
 	int c;
@@ -335,9 +386,6 @@ void MML_Input::parse_mml_track()
 	int c;
 	while(1)
 	{
-		// could this be rewritten using a command map?
-		// it would be nice to at least split the MML commands
-		// into a few functions...
 		c = get_token();
 		if(c == '|') // Separator
 			continue;
@@ -353,35 +401,40 @@ void MML_Input::parse_mml_track()
 			return;
 		else
 		{
-			unget(c);
+			const Command& command = commands->command[(uint8_t)c];
 			// Set reference
-			track->set_reference(get_reference());
-			// Here i can read a list of command handlers and call them
-			// until one returns false
-			if(mml_basic() == false)
-				continue;
-			else if(mml_control() == false)
-				continue;
-			else if(mml_envelope() == false)
-				continue;
-			parse_error("unknown MML command");
+			unget(c);
+			track->set_reference(get_position());
+			if(!command.handler)
+				parse_error("unknown MML command");
+			get();
+			(this->*command.handler)(c, command.type);
 		}
 	}
 }
 
+//! Parse the MML for a track in the track list.
+/*!
+ *  \param offset Position in the track list.
+ */
+void MML_Input::parse_mml_track(unsigned int offset)
+{
+	track_id = track_list[offset];
+	track_offset = offset;
+	track = &get_song().make_track(track_id);
+	conditional_block = false;
+	parse_mml_track();
+	if(conditional_block)
+		parse_error("unterminated conditional block");
+}
+
 void MML_Input::parse_mml()
 {
 	unsigned long col = tell();
 	for(unsigned int i = 0; i < track_list.size(); i++)
 	{
 		seek(col);
-		track_id = track_list[i];
-		track_offset = i;
-		track = &get_song().make_track(track_id);
-		conditional_block = false;
-		parse_mml_track();
-		if(conditional_block)
-			parse_error("unterminated conditional block");
+		parse_mml_track(i);
 	}
 }
 
@@ -421,16 +474,31 @@ int MML_Input::get_track_id()
 }
 
 MML_Input::MML_Input(Song* song)
+	: MML_Input(song, default_commands)
+{
+	// Perhaps the initial state of mml_input should be track A.
+	// Or maybe it can be initialized by a previous MML_Input during
+	// an "include" command.
+}
+
+//! Create an MML_Input with a different command table.
+/*!
+ *  This is used by derived classes to support other MML dialects.
+ *  The table must not be destroyed before the MML_Input.
+ */
+MML_Input::MML_Input(Song* song, const Command_Table& commands)
 	: Line_Input(song),
+	track(nullptr),
+	commands(&commands),
 	track_id(0),
 	track_offset(0),
 	track_list(0),
 	last_cmd(nullptr),
-	conditional_block(0)
+	conditional_block(0),
+	scan(nullptr),
+	platform_commands(nullptr),
+	warnings(nullptr)
 {
-	// Perhaps the initial state of mml_input should be track A.
-	// Or maybe it can be initialized by a previous MML_Input during
-	// an "include" command.
 }
 
 MML_Input::~MML_Input()
@@ -460,6 +528,24 @@ MML_Input::Track_Position_Map MML_Input::get_track_map()
 
 void MML_Input::parse_line()
 {
+	if(parse_line_header().content)
+	{
+		if(scan && last_cmd == &MML_Input::parse_mml)
+			scan_mml();
+		else if(scan && last_cmd == &MML_Input::parse_tag)
+			scan_tag();
+		else
+			(this->*last_cmd)();
+	}
+}
+
+//! Read the track list or tag key at the start of the line.
+/*!
+ *  The position is set to the start of the data for last_cmd.
+ */
+MML_Input::Line_Info MML_Input::parse_line_header()
+{
+	Line_Info info = {nullptr, {}, "", false, false, 0};
 	int c = get_track_id();
 	if(c != -1)
 	{
@@ -487,11 +573,12 @@ void MML_Input::parse_line()
 			}
 			while (c != 0 && !std::isspace(c));
 			last_cmd = &MML_Input::parse_tag;
+			info.tag = true;
 		}
 		else if(c == ';')
 		{
 			// Comment
-			return;
+			return info;
 		}
 		else if(!std::isblank(c))
 		{
@@ -501,7 +588,7 @@ void MML_Input::parse_line()
 				parse_error("Expected track or tag identifier");
 			}
 			// At the end of the line, we can stop parsing
-			return;
+			return info;
 		}
 		unget(c);
 	}
@@ -512,14 +599,435 @@ void MML_Input::parse_line()
 		// Skip non blank characters
 		c = get_token();
 		unget(c);
-		if(c == 0)
-			return;
-		if(last_cmd != nullptr)
+		if(c != 0 && last_cmd != nullptr)
 		{
+			info.content = true;
+			info.column = tell();
+			if(last_cmd == &MML_Input::parse_tag)
+				info.tag = true;
+		}
+	}
+	return info;
+}
+
+
+//! Check if the track is in the track list.
+bool MML_Input::Line_Info::has_track(uint16_t id) const
+{
+	return last_cmd == &MML_Input::parse_mml
+		&& std::find(track_list.begin(), track_list.end(), id) != track_list.end();
+}
+
+//! Check if the parser state for the following lines is the same.
+bool MML_Input::Line_Info::same_state(const Line_Info& other) const
+{
+	if(last_cmd != other.last_cmd)
+		return false;
+	else if(last_cmd == &MML_Input::parse_mml)
+		return track_list == other.track_list;
+	else if(last_cmd == &MML_Input::parse_tag)
+		return tag_key == other.tag_key;
+	return true;
+}
+
+//! Restore the parser state from a Line_Info.
+/*!
+ *  \param info Parser state, or nullptr for the initial state.
+ */
+void MML_Input::set_line_info(const Line_Info* info)
+{
+	if(info)
+	{
+		last_cmd = info->last_cmd;
+		track_list = info->track_list;
+		tag_key = info->tag_key;
+	}
+	else
+	{
+		last_cmd = nullptr;
+		track_list.clear();
+		tag_key.clear();
+	}
+}
+
+//! Move input references after an edit.
+/*!
+ *  \param track Track to update.
+ *  \param first First line number to move.
+ *  \param delta Number of lines to move by.
+ */
+void MML_Input::shift_references(Track& track, unsigned long first, long delta)
+{
+	for(auto& ref : track.get_references())
+	{
+		if(ref.second.file && ref.second.line >= first)
+			ref.second.line += delta;
+	}
+}
+
+//! Set the file data used by input references to the current lines.
+void MML_Input::store_lines()
+{
+	auto data = std::make_shared<std::string>();
+	for(auto& str : lines)
+	{
+		data->append(str);
+		data->push_back('\n');
+	}
+	set_file_data(data);
+}
+
+//! Parse a document from a list of lines.
+/*!
+ *  The lines are kept so that the document can be edited later with
+ *  update_lines(). The tracks, tags and platform commands of the Song
+ *  are cleared first, so that a document can be parsed again after
+ *  update_lines() fails.
+ */
+void MML_Input::read_lines(const std::vector<std::string>& input_lines)
+{
+	get_song().clear();
+	set_line_info(nullptr);
+	lines = input_lines;
+	store_lines();
+	line_info.clear();
+	line_info.reserve(lines.size());
+	for(unsigned long i = 0; i < lines.size(); i++)
+	{
+		set_line(lines[i], i);
+		Line_Info info = parse_line_header();
+		if(info.content)
 			(this->*last_cmd)();
-			return;
+		info.last_cmd = last_cmd;
+		info.track_list = track_list;
+		info.tag_key = tag_key;
+		line_info.push_back(info);
+	}
+}
+
+//! Replace lines in a document read by read_lines().
+/*!
+ *  Only the tracks that have data in the changed lines are parsed
+ *  again. Input references in the other tracks are moved if the
+ *  number of lines changed.
+ *
+ *  If the change can't be applied incrementally, the document is not
+ *  modified and false is returned. In that case, the caller should
+ *  parse the edited document with read_lines(). This happens if tag
+ *  lines are changed, or if the affected tracks contain platform
+ *  exclusive messages.
+ *
+ *  \param first Index of the first line to replace.
+ *  \param count Number of lines to replace.
+ *  \param new_lines Replacement lines.
+ *  \return true if the song was updated.
+ *  \exception InputError if the edited lines have errors. The song
+ *             should then be parsed again with read_lines().
+ */
+bool MML_Input::update_lines(unsigned long first, unsigned long count, const std::vector<std::string>& new_lines)
+{
+	if(first > lines.size() || count > lines.size() - first)
+		throw std::out_of_range("update_lines: invalid line range");
+
+	long delta = (long)new_lines.size() - (long)count;
+	unsigned long new_size = lines.size() + delta;
+	auto new_line = [&](unsigned long i) -> const std::string&
+	{
+		if(i < first)
+			return lines[i];
+		else if(i - first < new_lines.size())
+			return new_lines[i - first];
+		return lines[i - delta];
+	};
+
+	// Read line headers until the parser state matches the old document.
+	const Line_Info initial = {nullptr, {}, "", false, false, 0};
+	auto old_state = [&](unsigned long i) -> const Line_Info&
+	{
+		return i ? line_info[i - 1] : initial;
+	};
+	std::vector<Line_Info> new_info;
+	set_line_info(&old_state(first));
+	for(unsigned long i = first; i < new_size; i++)
+	{
+		const Line_Info& state = new_info.empty() ? old_state(first) : new_info.back();
+		if(i >= first + new_lines.size() && state.same_state(old_state(i - delta)))
+			break;
+		set_line(new_line(i), i);
+		Line_Info info = parse_line_header();
+		info.last_cmd = last_cmd;
+		info.track_list = track_list;
+		info.tag_key = tag_key;
+		new_info.push_back(info);
+	}
+	unsigned long old_end = first + new_info.size() - delta;
+
+	// Find the affected tracks. Tags and platform exclusive messages
+	// modify the song, so those require a full parse.
+	std::set<uint16_t> tracks;
+	bool full_parse = false;
+	for(unsigned long i = first; i < old_end; i++)
+	{
+		full_parse |= line_info[i].tag || lines[i].find('\'') != std::string::npos;
+		if(line_info[i].content && line_info[i].last_cmd == &MML_Input::parse_mml)
+			tracks.insert(line_info[i].track_list.begin(), line_info[i].track_list.end());
+	}
+	for(auto& info : new_info)
+	{
+		full_parse |= info.tag;
+		if(info.content && info.last_cmd == &MML_Input::parse_mml)
+			tracks.insert(info.track_list.begin(), info.track_list.end());
+	}
+	for(unsigned long i = 0; i < new_size && !full_parse; i++)
+	{
+		const Line_Info& info = (i < first) ? line_info[i]
+			: (i - first < new_info.size()) ? new_info[i - first]
+			: line_info[i - delta];
+		if(!info.content || info.last_cmd != &MML_Input::parse_mml)
+			continue;
+		for(auto id : info.track_list)
+		{
+			if(tracks.count(id) && new_line(i).find('\'') != std::string::npos)
+				full_parse = true;
 		}
 	}
-	return;
+	if(full_parse)
+	{
+		set_line_info(line_info.empty() ? nullptr : &line_info.back());
+		return false;
+	}
+
+	// Update the document
+	lines.erase(lines.begin() + first, lines.begin() + first + count);
+	lines.insert(lines.begin() + first, new_lines.begin(), new_lines.end());
+	line_info.erase(line_info.begin() + first, line_info.begin() + old_end);
+	line_info.insert(line_info.begin() + first, new_info.begin(), new_info.end());
+	store_lines();
+
+	// Move references in the unchanged tracks
+	Track_Map& map = get_song().get_track_map();
+	for(auto& it : map)
+	{
+		if(delta && !tracks.count(it.first))
+			shift_references(it.second, old_end, delta);
+	}
+
+	// Parse the affected tracks again
+	for(auto id : tracks)
+	{
+		map.erase(id);
+		for(unsigned long i = 0; i < lines.size(); i++)
+		{
+			const Line_Info& info = line_info[i];
+			if(!info.content || !info.has_track(id))
+				continue;
+			set_line(lines[i], i, info.column);
+			track_list = info.track_list;
+			for(unsigned int k = 0; k < track_list.size(); k++)
+			{
+				if(track_list[k] != id)
+					continue;
+				seek(info.column);
+				parse_mml_track(k);
+			}
+		}
+	}
+	set_line_info(line_info.empty() ? nullptr : &line_info.back());
+	return true;
+}
+
+//! Open file and parse lines.
+/*!
+ *  The file is parsed in two passes. The first pass reads the track
+ *  lists and collects the MML lines for each track, as well as the
+ *  tag lines. The tracks are then parsed in parallel by
+ *  parse_tracks().
+ *
+ *  The Song and the error messages are the same as when parsing
+ *  the lines one at a time.
+ */
+void MML_Input::parse_file()
+{
+	// Handlers in derived classes may use their own state, which
+	// is not copied to the worker threads.
+	if(typeid(*this) != typeid(MML_Input))
+	{
+		Line_Input::parse_file();
+		return;
+	}
+
+	Track_Scan track_scan;
+	std::exception_ptr scan_error = nullptr;
+	scan = &track_scan;
+	try
+	{
+		Line_Input::parse_file();
+	}
+	catch(...)
+	{
+		scan_error = std::current_exception();
+	}
+	scan = nullptr;
+
+	// Lines before a scan error are parsed, so that errors are
+	// reported in the same order as in a serial parse.
+	parse_tracks(track_scan);
+	if(scan_error)
+		std::rethrow_exception(scan_error);
+}
+
+//! Record an MML line during the first pass of parse_file().
+void MML_Input::scan_mml()
+{
+	if(scan->track_lists.empty() || scan->track_lists.back() != track_list)
+		scan->track_lists.push_back(track_list);
+	Input_Position position = get_position();
+	scan->lines.push_back({position.line, line_start, line_length, position.column,
+		(unsigned int)scan->track_lists.size() - 1});
+	scan->data = buffer;
+	// Tracks are created in the same order as in a serial parse.
+	for(auto id : track_list)
+		get_song().make_track(id);
+}
+
+//! Record a tag line during the first pass of parse_file().
+void MML_Input::scan_tag()
+{
+	Input_Position position = get_position();
+	scan->tags.push_back({position.line, line_start, line_length, position.column, tag_key});
+	scan->data = buffer;
+	if(tag_key[0] == '#')
+		last_cmd = nullptr; // Only read a single line
+}
+
+//! Raise a parse warning.
+/*!
+ *  When parsing a track in parallel, the warning is buffered so that
+ *  parse_tracks() can print the warnings in file order.
+ */
+void MML_Input::parse_warning(const char* msg)
+{
+	if(warnings)
+		warnings->push_back({get_position().line, track_offset, get_reference(), msg});
+	else
+		Line_Input::parse_warning(msg);
 }
 
+//! Parse the MML lines collected by parse_file().
+/*!
+ *  Each track is parsed by a copy of this MML_Input. Afterwards, the
+ *  tag lines and platform exclusive messages are added to the song
+ *  in the order they appear in the file, so that the tag order and
+ *  platform command numbers are the same as in a serial parse.
+ *  Warnings are also printed in file order, up to the first error.
+ *
+ *  \exception InputError The first error in the file.
+ */
+void MML_Input::parse_tracks(const Track_Scan& track_scan)
+{
+	// Lines and track list positions for each track
+	typedef std::vector<std::pair<unsigned int, unsigned int>> Line_List;
+	std::map<uint16_t, Line_List> track_lines;
+	for(unsigned int i = 0; i < track_scan.lines.size(); i++)
+	{
+		auto& list = track_scan.track_lists[track_scan.lines[i].track_list];
+		for(unsigned int k = 0; k < list.size(); k++)
+			track_lines[list[k]].push_back({i, k});
+	}
+	std::vector<const Line_List*> jobs;
+	for(auto& it : track_lines)
+		jobs.push_back(&it.second);
+
+	std::vector<std::vector<Platform_Command>> commands(jobs.size());
+	std::vector<std::vector<Parse_Warning>> warning_list(jobs.size());
+	std::vector<std::exception_ptr> errors(jobs.size());
+	std::vector<std::pair<unsigned int, unsigned int>> error_position(jobs.size());
+	parallel_for(jobs.size(), [&](unsigned int i)
+	{
+		MML_Input worker(*this);
+		worker.platform_commands = &commands[i];
+		worker.warnings = &warning_list[i];
+		try
+		{
+			for(auto& item : *jobs[i])
+			{
+				const Track_Line& line = track_scan.lines[item.first];
+				error_position[i] = {line.line, item.second};
+				worker.set_line(track_scan.data, line.start, line.length, line.line, line.column);
+				worker.track_list = track_scan.track_lists[line.track_list];
+				worker.parse_mml_track(item.second);
+			}
+		}
+		catch(InputError&)
+		{
+			errors[i] = std::current_exception();
+		}
+	});
+
+	int first = -1;
+	for(unsigned int i = 0; i < jobs.size(); i++)
+	{
+		if(errors[i] && (first < 0 || error_position[i] < error_position[first]))
+			first = i;
+	}
+
+	std::vector<const Parse_Warning*> warning_order;
+	for(auto& list : warning_list)
+	{
+		for(auto& warning : list)
+			warning_order.push_back(&warning);
+	}
+	std::stable_sort(warning_order.begin(), warning_order.end(),
+		[](const Parse_Warning* a, const Parse_Warning* b) {
+			return std::make_pair(a->line, a->offset) < std::make_pair(b->line, b->offset);
+		});
+	for(auto warning : warning_order)
+	{
+		// Warnings on the line of the first error were raised before it
+		if(first >= 0 && std::make_pair(warning->line, warning->offset) > error_position[first])
+			break;
+		print_warning(*warning->reference, warning->message.c_str());
+	}
+
+	std::vector<const Platform_Command*> platform_list;
+	for(auto& list : commands)
+	{
+		for(auto& command : list)
+			platform_list.push_back(&command);
+	}
+	std::stable_sort(platform_list.begin(), platform_list.end(),
+		[](const Platform_Command* a, const Platform_Command* b) {
+			return std::make_pair(a->line, a->offset) < std::make_pair(b->line, b->offset);
+		});
+
+	// Add tags and platform commands in file order, stopping at the
+	// first error.
+	auto old_cmd = last_cmd;
+	std::string old_tag_key = tag_key;
+	auto tag = track_scan.tags.begin();
+	auto platform = platform_list.begin();
+	while(tag != track_scan.tags.end() || platform != platform_list.end())
+	{
+		if(tag != track_scan.tags.end() && (platform == platform_list.end() || tag->line < (*platform)->line))
+		{
+			if(first >= 0 && tag->line > error_position[first].first)
+				break;
+			set_line(track_scan.data, tag->start, tag->length, tag->line, tag->column);
+			tag_key = tag->tag_key;
+			parse_tag();
+			tag++;
+		}
+		else
+		{
+			const Platform_Command& command = **platform;
+			Event& event = get_song().get_track(command.track_id).get_event(command.position);
+			event.param = get_song().register_platform_command(-1, command.value);
+			platform++;
+		}
+	}
+	last_cmd = old_cmd;
+	tag_key = old_tag_key;
+
+	if(first >= 0)
+		std::rethrow_exception(errors[first]);
+}
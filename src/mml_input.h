@@ -18,8 +18,10 @@
  *  For more info about the MML dialect used here, see
  *  the [MML reference](mml_ref.md).
  *
- *  \todo it should be possible to derive this in order to
- *        better support different MML dialects.
+ *  MML commands are dispatched by their first character using a
+ *  Command_Table. To support a different MML dialect, derive this
+ *  class, copy #default_commands and replace the entries that differ,
+ *  then pass the new table to the protected constructor.
  */
 class MML_Input: public Line_Input
 {
@@ -31,49 +33,190 @@ class MML_Input: public Line_Input
 
 		Track_Position_Map get_track_map();
 
-	private:
+		void read_lines(const std::vector<std::string>& input_lines);
+		bool update_lines(unsigned long first, unsigned long count, const std::vector<std::string>& new_lines);
+
+	protected:
+		//! MML command handler.
+		/*!
+		 *  \param c The first character of the command.
+		 *  \param type Event type from the Command_Table entry.
+		 */
+		typedef void (MML_Input::*Command_Handler)(int c, Event::Type type);
+
+		//! Command table entry.
+		struct Command
+		{
+			//! Handler, or nullptr for unknown commands.
+			Command_Handler handler;
+			//! Event type passed to the handler.
+			Event::Type type;
+		};
+
+		//! Table mapping the first character of a command to its handler.
+		struct Command_Table
+		{
+			Command command[256];
+		};
+
+		static const Command_Table default_commands;
+
+		MML_Input(Song* song, const Command_Table& commands);
+
 		// MML read helpers
 		unsigned int read_duration();
 		int read_parameter(int default_parameter);
 		int expect_parameter();
 		int expect_signed();
 		int read_note(int c); // c is the first character
-		void platform_exclusive();
 
 		// Wrappers that provide error/warning messages
 		// or other functions
-		void mml_slur();
-		void mml_reverse_rest(int duration);
-		void mml_grace();
-		void mml_transpose();
+		void reverse_rest(int duration);
 		void event_relative(Event::Type type, Event::Type subtype);
+
+		// MML command handlers
+		void mml_event(int c, Event::Type type);
+		void mml_event_param(int c, Event::Type type);
+		void mml_event_signed(int c, Event::Type type);
+		void mml_note(int c, Event::Type type);
+		void mml_rest(int c, Event::Type type);
+		void mml_tie(int c, Event::Type type);
+		void mml_slur(int c, Event::Type type);
+		void mml_octave(int c, Event::Type type);
+		void mml_octave_change(int c, Event::Type type);
+		void mml_length(int c, Event::Type type);
+		void mml_quantize(int c, Event::Type type);
+		void mml_early_release(int c, Event::Type type);
+		void mml_reverse_rest(int c, Event::Type type);
+		void mml_grace(int c, Event::Type type);
+		void mml_loop_end(int c, Event::Type type);
+		void mml_platform_exclusive(int c, Event::Type type);
+		void mml_transpose(int c, Event::Type type);
+		void mml_volume_change(int c, Event::Type type);
+		void mml_volume_fine(int c, Event::Type type);
+		void mml_drum_mode(int c, Event::Type type);
+
+		Track* track;
+
+	private:
+		//! Parser state after reading a line, used by update_lines().
+		struct Line_Info
+		{
+			//! Command for the following lines.
+			void (MML_Input::*last_cmd)();
+			//! Track list for the following lines.
+			std::vector<uint16_t> track_list;
+			//! Tag key for the following lines.
+			std::string tag_key;
+			//! Set if the line sets a tag key or adds tag data.
+			bool tag;
+			//! Set if the line has data for last_cmd.
+			bool content;
+			//! Column where the data starts.
+			unsigned long column;
+
+			bool has_track(uint16_t id) const;
+			bool same_state(const Line_Info& other) const;
+		};
+
+		//! MML line found while scanning the input file.
+		struct Track_Line
+		{
+			unsigned int line;
+			//! Position of the line in the file data.
+			unsigned long start;
+			unsigned long length;
+			//! Column where the MML starts.
+			unsigned int column;
+			//! Index in Track_Scan::track_lists.
+			unsigned int track_list;
+		};
+
+		//! Tag line found while scanning the input file.
+		struct Tag_Line
+		{
+			unsigned int line;
+			unsigned long start;
+			unsigned long length;
+			unsigned int column;
+			std::string tag_key;
+		};
+
+		//! Result of the first pass of parse_file().
+		struct Track_Scan
+		{
+			std::shared_ptr<const std::string> data;
+			std::vector<Track_Line> lines;
+			std::vector<std::vector<uint16_t>> track_lists;
+			std::vector<Tag_Line> tags;
+		};
+
+		//! Platform command found while parsing a track in parallel.
+		struct Platform_Command
+		{
+			unsigned int line;
+			unsigned int offset;
+			uint16_t track_id;
+			unsigned long position;
+			std::string value;
+		};
+
+		//! Warning raised while parsing a track in parallel.
+		struct Parse_Warning
+		{
+			unsigned int line;
+			unsigned int offset;
+			std::shared_ptr<InputRef> reference;
+			std::string message;
+		};
+
+		static constexpr Command_Table make_command_table();
+
 		void conditional_block_begin();
 		void conditional_block_end(int c);
 
-		// MML command parsers. Returns 0 and increments position if parsing succeeds.
-		// the idea is that these can be swapped out for different MML dialects or platforms.
-		bool mml_basic(); // Notes, length, octave, etc.
-		bool mml_control(); // Loop control
-		bool mml_envelope(); // Instrument, volume, envelope etc.
-
 		// Parsers for various parts of the MML file
 		void parse_mml_track();
+		void parse_mml_track(unsigned int offset);
 		void parse_mml();
 		void parse_tag();
+		Line_Info parse_line_header();
+		void set_line_info(const Line_Info* info);
+		void shift_references(Track& track, unsigned long first, long delta);
+		void store_lines();
+		void parse_file();
+		void scan_mml();
+		void scan_tag();
+		void parse_tracks(const Track_Scan& track_scan);
 
 		// Convert track id from character
 		int get_track_id();
 
 		// Virtual function override from Line_Input
 		void parse_line();
+		// Virtual function override from Input
+		void parse_warning(const char* msg);
 
+		const Command_Table* commands;
 		std::string tag_key;
-		Track* track;
 		uint16_t track_id;
 		uint16_t track_offset;
 		std::vector<uint16_t> track_list;
 		void (MML_Input::*last_cmd)();
 		bool conditional_block;
+
+		//! Set during the first pass of parse_file().
+		Track_Scan* scan;
+		//! Set when parsing a track in parallel.
+		std::vector<Platform_Command>* platform_commands;
+		//! Set when parsing a track in parallel.
+		std::vector<Parse_Warning>* warnings;
+
+		//! Lines read by read_lines().
+		std::vector<std::string> lines;
+		//! Parser state after each line in lines.
+		std::vector<Line_Info> line_info;
 };
 #endif
 
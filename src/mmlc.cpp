@@ -6,24 +6,42 @@
 #include "platform/md.h"
 #include "platform/mdsdrv.h"
 #include "stringf.h"
+#include "parallel.h"
+#include "wave.h"
 
 #include <iostream>
 #include <fstream>
 #include <stdexcept>
+#include <sstream>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <set>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <poll.h>
+#endif
 
 void print_usage(const char* exename)
 {
 	std::cout << "ctrmml Music Compiler, version " CTRMML_VERSION "\n";
 	std::cout << "(C) 2019-2020 Ian Karlsson.\n";
 	std::cout << "Licensed under GPLv2, see COPYING for details.\n\n";
-	std::cout << "Usage: " << exename << " [options] <input_file.mml>\n";
+	std::cout << "Usage: " << exename << " [options] <input_file.mml> [input_file2.mml ...]\n";
+	std::cout << "       " << exename << " [options] @<list_file>\n";
 	std::cout << "Options:\n";
 	std::cout << "\t--output / -o <filename> : Set output filename\n";
 	std::cout << "\t--format / -f <format> : Set output file format\n";
+	std::cout << "\t--jobs / -j <count> : Set number of threads (default: all cores)\n";
+	std::cout << "\t--paranoid : Verify track lengths by playing all tracks\n";
+	std::cout << "\t--verbose / -v : Report redundant register writes that were dropped\n";
+	std::cout << "\t--watch : Compile again when the input file or samples are modified\n";
 }
 
 std::string get_extension(const char* input_filename)
@@ -38,70 +56,59 @@ std::string get_extension(const char* input_filename)
 		return "";
 }
 
-std::string output_filename(const char* input_filename, const char* extension)
+std::string output_filename(const std::string& input_filename, const std::string& extension)
 {
-	static char str[256];
-	char *last_dot;
-	strncpy(str,input_filename, 256);
-	last_dot = strrchr(str, '.');
-	if(last_dot)
-		*last_dot = 0;
-	strncat(last_dot, ".", 256);
-	strncat(last_dot, extension, 256);
-	return str;
+	std::string str = input_filename.substr(0, input_filename.rfind('.'));
+	return str + "." + extension;
 }
 
-Song convert_file(const char* filename)
+Song convert_file(const char* filename, bool paranoid, std::ostream& log)
 {
 	Song song;
 	MML_Input input = MML_Input(&song);
 	input.open_file(filename);
-	auto validator = Song_Validator(song);
+	auto validator = Song_Validator(song, paranoid);
 	for(auto it = validator.get_track_map().begin(); it != validator.get_track_map().end(); it++)
 	{
-		std::cout << stringf("Track%3d:%7d", it->first, it->second.get_play_time());
+		log << stringf("Track%3d:%7d", it->first, it->second.get_play_time());
 		if(auto length = it->second.get_loop_length())
-			std::cout << stringf(" (loop %7d)", length);
-		std::cout << "\n";
+			log << stringf(" (loop %7d)", length);
+		log << "\n";
 	}
 	return song;
 }
 
-int main(int argc, char* argv[])
+//! Print the number of redundant register writes that were dropped.
+void print_dropped_writes(const Driver::Write_Counter& dropped_writes, std::ostream& log)
 {
-	std::string in_filename = "";
-	std::string out_filename = "";
-	std::string format = "";
-
-	for(int arg = 1, default_arguments = 0; arg < argc; arg++)
+	uint32_t total = 0;
+	for(auto&& i : dropped_writes)
+		total += i.second;
+	log << "Dropped " << total << " redundant register writes\n";
+	for(auto&& i : dropped_writes)
 	{
-		if((!strcmp(argv[arg], "-o") || !strcmp(argv[arg], "--output")) && arg < argc)
-			out_filename = argv[++arg];
-		else if((!strcmp(argv[arg], "-f") || !strcmp(argv[arg], "--format")) && arg < argc)
-			format = argv[++arg];
-		else if((!strcmp(argv[arg], "-h") || !strcmp(argv[arg], "--help")) && arg < argc)
-		{
-			print_usage(argv[0]);
-			return -1;
-		}
-		else if(default_arguments < 1)
-		{
-			default_arguments++;
-			in_filename = argv[arg];
-		}
-	}
-
-	if(!in_filename.size())
-	{
-		print_usage(argv[0]);
-		std::cerr << "no input specified\n";
-		return -1;
+		uint8_t command = i.first.first, reg = i.first.second;
+		if(command == 0x50)
+			log << stringf("\tSN76489 %02x:%8d\n", reg, i.second);
+		else
+			log << stringf("\tYM2612 port %d %02x:%8d\n", command - 0x52, reg, i.second);
 	}
+}
 
+//! Compile a MML file.
+/*!
+ * The track durations are written to \p log, errors are written to
+ * \p error_log.
+ *
+ * \return true if successful.
+ */
+bool compile_file(const std::string& in_filename, std::string out_filename, std::string format,
+	bool paranoid, bool verbose, std::ostream& log, std::ostream& error_log)
+{
 	try
 	{
 		// Parse MML
-		Song song = convert_file(in_filename.c_str());
+		Song song = convert_file(in_filename.c_str(), paranoid, log);
 
 		// Get available formats
 		unsigned int format_id = 0;
@@ -120,40 +127,368 @@ int main(int argc, char* argv[])
 		// No available format
 		if(format_id == format_list.size())
 		{
-			std::cerr << "Format not available!\n";
+			error_log << "Format not available!\n";
 			if(format_list.size())
 			{
-				std::cerr << "\nAvailable formats:\n";
+				error_log << "\nAvailable formats:\n";
 				for(auto&& i : format_list)
-					std::cerr << "\t'" << i.first << "': " << i.second << "\n";
+					error_log << "\t'" << i.first << "': " << i.second << "\n";
 			}
-			return -1;
+			return false;
 		}
 
 		// Generate output filename if not already specified
 		if(!out_filename.size())
-			out_filename = output_filename(in_filename.c_str(), format.c_str());
+			out_filename = output_filename(in_filename, format);
 
-		// Export data
-		std::vector<uint8_t> bytes = song.get_platform()->get_export_data(song, format_id);
-
-		// Write to file
-		if(bytes.size())
+		// Export data to a temporary file, which replaces the output
+		// file only if successful.
+		std::string tmp_filename = out_filename + ".tmp";
+		Driver::Write_Counter dropped_writes;
+		std::ofstream out(tmp_filename, std::ios::binary);
+		try
+		{
+			song.get_platform()->write_export_data(song, format_id, out, &dropped_writes);
+		}
+		catch(...)
+		{
+			out.close();
+			std::remove(tmp_filename.c_str());
+			throw;
+		}
+		std::streamoff size = out.tellp();
+		out.close();
+		if(!out)
 		{
-			std::ofstream out(out_filename, std::ios::binary);
-			out.write((char*)bytes.data(), bytes.size());
-			std::cout << "Wrote " << bytes.size() << " bytes to " << out_filename << "\n";
+			std::remove(tmp_filename.c_str());
+			error_log << "Failed to write " << out_filename << "\n";
+			return false;
 		}
+#ifdef _WIN32
+		// rename() does not replace existing files on Windows
+		std::remove(out_filename.c_str());
+#endif
+		if(std::rename(tmp_filename.c_str(), out_filename.c_str()))
+		{
+			std::remove(tmp_filename.c_str());
+			error_log << "Failed to write " << out_filename << "\n";
+			return false;
+		}
+		log << "Wrote " << size << " bytes to " << out_filename << "\n";
+		if(verbose)
+			print_dropped_writes(dropped_writes, log);
+		return true;
 	}
 	catch (InputError& error)
 	{
-		std::cerr << error.what() << "\n";
-		return -1;
+		error_log << error.what() << "\n";
+		return false;
 	}
 	catch (std::logic_error& error) // in case get_driver is not found
 	{
-		std::cerr << error.what() << "\n";
+		error_log << error.what() << "\n";
+		return false;
+	}
+	catch (std::exception& error)
+	{
+		error_log << in_filename << ": " << error.what() << "\n";
+		return false;
+	}
+}
+
+//! Read input filenames from a response file, one per line.
+bool read_response_file(const std::string& filename, std::vector<std::string>& in_filenames)
+{
+	std::ifstream file(filename);
+	if(!file)
+		return false;
+	std::string line;
+	while(std::getline(file, line))
+	{
+		// strip whitespace and CR
+		auto end = line.find_last_not_of(" \t\r");
+		auto begin = line.find_first_not_of(" \t");
+		if(end != std::string::npos)
+			in_filenames.push_back(line.substr(begin, end - begin + 1));
+	}
+	return true;
+}
+
+//! Waits for files to be modified.
+/*!
+ *  Uses inotify on Linux, other platforms check the modification time
+ *  of the files periodically.
+ */
+class File_Watcher
+{
+	public:
+		File_Watcher();
+		~File_Watcher();
+
+		void add(const std::string& filename);
+		bool wait();
+
+	private:
+#ifdef __linux__
+		int fd;
+		//! Watch descriptors of the directories and the watched filenames in them.
+		std::set<std::pair<int,std::string>> names;
+#else
+		std::map<std::string,std::pair<long long,long long>> mtimes;
+#endif
+};
+
+#ifdef __linux__
+File_Watcher::File_Watcher()
+	: fd(inotify_init1(IN_CLOEXEC))
+{
+	if(fd < 0)
+		std::cerr << "inotify_init1 failed\n";
+}
+
+File_Watcher::~File_Watcher()
+{
+	if(fd >= 0)
+		close(fd);
+}
+
+//! Add a file to watch.
+void File_Watcher::add(const std::string& filename)
+{
+	if(fd < 0)
+		return;
+	// Watch the directory, since some editors replace the file when saving.
+	auto slash = filename.rfind('/');
+	std::string dir = (slash == std::string::npos) ? "." : filename.substr(0, slash + 1);
+	std::string name = (slash == std::string::npos) ? filename : filename.substr(slash + 1);
+	int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+	if(wd >= 0)
+		names.insert(std::make_pair(wd, name));
+}
+
+//! Wait until one of the files has been modified.
+/*!
+ *  \return false if the files can't be watched.
+ */
+bool File_Watcher::wait()
+{
+	alignas(struct inotify_event) char buffer[4096];
+	bool changed = false;
+	struct pollfd pfd = {fd, POLLIN, 0};
+	// Block until a file is changed, then read the remaining events.
+	while(fd >= 0 && poll(&pfd, 1, changed ? 0 : -1) > 0)
+	{
+		ssize_t length = read(fd, buffer, sizeof(buffer));
+		if(length <= 0)
+			break;
+		for(char* ptr = buffer; ptr < buffer + length;)
+		{
+			auto event = (const struct inotify_event*)ptr;
+			if(event->len && names.count(std::make_pair(event->wd, std::string(event->name))))
+				changed = true;
+			ptr += sizeof(struct inotify_event) + event->len;
+		}
+	}
+	return changed;
+}
+#else
+//! Get the modification time and size of a file.
+/*!
+ *  The modification time is in nanoseconds where supported, so that
+ *  a file saved twice within a second is detected.
+ */
+static std::pair<long long, long long> get_mtime(const std::string& filename)
+{
+	struct stat st;
+	if(stat(filename.c_str(), &st))
+		return {-1, -1};
+#if defined(__APPLE__)
+	long long mtime = st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+	long long mtime = st.st_mtime * 1000000000LL;
+#else
+	long long mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+	return {mtime, (long long)st.st_size};
+}
+
+File_Watcher::File_Watcher()
+{
+}
+
+File_Watcher::~File_Watcher()
+{
+}
+
+//! Add a file to watch.
+void File_Watcher::add(const std::string& filename)
+{
+	if(!mtimes.count(filename))
+		mtimes[filename] = get_mtime(filename);
+}
+
+//! Wait until one of the files has been modified.
+bool File_Watcher::wait()
+{
+	while(true)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		bool changed = false;
+		for(auto&& i : mtimes)
+		{
+			auto mtime = get_mtime(i.first);
+			if(mtime != i.second)
+			{
+				i.second = mtime;
+				changed = true;
+			}
+		}
+		if(changed)
+			return true;
+	}
+}
+#endif
+
+//! Compile a MML file every time it is modified.
+/*!
+ *  Sample files are kept in memory between each compile, and are only
+ *  read again if they are modified.
+ */
+int watch_file(const std::string& in_filename, const std::string& out_filename, const std::string& format, bool paranoid, bool verbose)
+{
+	auto cache = std::make_shared<Wave_Cache>();
+	Wave_Bank::set_cache(cache);
+
+	File_Watcher watcher;
+	watcher.add(in_filename);
+	while(true)
+	{
+		auto start = std::chrono::steady_clock::now();
+		bool ok = compile_file(in_filename, out_filename, format, paranoid, verbose, std::cout, std::cerr);
+		std::chrono::duration<double, std::milli> time = std::chrono::steady_clock::now() - start;
+		std::cout << stringf("%s in %.1f ms, waiting for changes...\n", ok ? "Compiled" : "Failed", time.count()) << std::flush;
+
+		for(auto&& i : cache->get_filenames())
+			watcher.add(i);
+		if(!watcher.wait())
+		{
+			std::cerr << "Couldn't watch " << in_filename << " for changes\n";
+			return -1;
+		}
+	}
+}
+
+//! Compile multiple MML files in parallel.
+/*!
+ * The reports for each file are printed in the same order as the
+ * input files. Files that could not be compiled are listed at the
+ * end.
+ */
+int compile_batch(const std::vector<std::string>& in_filenames, const std::string& format, bool paranoid, bool verbose)
+{
+	unsigned int count = in_filenames.size();
+	std::vector<std::ostringstream> logs(count);
+	std::vector<std::ostringstream> error_logs(count);
+	std::vector<int> status(count, 0);
+	std::mutex print_mutex;
+	unsigned int next_print = 0;
+
+	parallel_for(count, [&](unsigned int i) {
+		bool ok = compile_file(in_filenames[i], "", format, paranoid, verbose, logs[i], error_logs[i]);
+
+		// Print all reports that are completed
+		std::lock_guard<std::mutex> lock(print_mutex);
+		status[i] = ok ? 1 : -1;
+		for(; next_print < count && status[next_print]; next_print++)
+		{
+			std::cout << in_filenames[next_print] << ":\n" << logs[next_print].str() << std::flush;
+			std::cerr << error_logs[next_print].str() << std::flush;
+		}
+	});
+
+	std::vector<std::string> failed;
+	for(unsigned int i = 0; i < count; i++)
+	{
+		if(status[i] < 0)
+			failed.push_back(in_filenames[i]);
+	}
+	if(failed.size())
+	{
+		std::cerr << failed.size() << " of " << count << " files failed:\n";
+		for(auto&& i : failed)
+			std::cerr << "\t" << i << "\n";
 		return -1;
 	}
+	std::cout << "Compiled " << count << " files\n";
+	return 0;
 }
 
+int main(int argc, char* argv[])
+{
+	std::vector<std::string> in_filenames;
+	std::string out_filename = "";
+	std::string format = "";
+	bool paranoid = false;
+	bool verbose = false;
+	bool watch = false;
+
+	for(int arg = 1; arg < argc; arg++)
+	{
+		if((!strcmp(argv[arg], "-o") || !strcmp(argv[arg], "--output")) && arg < argc)
+			out_filename = argv[++arg];
+		else if((!strcmp(argv[arg], "-f") || !strcmp(argv[arg], "--format")) && arg < argc)
+			format = argv[++arg];
+		else if((!strcmp(argv[arg], "-j") || !strcmp(argv[arg], "--jobs")) && (arg+1) < argc)
+			set_thread_count(strtol(argv[++arg], NULL, 0));
+		else if(!strcmp(argv[arg], "--paranoid"))
+			paranoid = true;
+		else if(!strcmp(argv[arg], "-v") || !strcmp(argv[arg], "--verbose"))
+			verbose = true;
+		else if(!strcmp(argv[arg], "--watch"))
+			watch = true;
+		else if((!strcmp(argv[arg], "-h") || !strcmp(argv[arg], "--help")) && arg < argc)
+		{
+			print_usage(argv[0]);
+			return -1;
+		}
+		else if(argv[arg][0] == '@')
+		{
+			if(!read_response_file(argv[arg] + 1, in_filenames))
+			{
+				std::cerr << "Failed to read " << argv[arg] + 1 << "\n";
+				return -1;
+			}
+		}
+		else
+		{
+			in_filenames.push_back(argv[arg]);
+		}
+	}
+
+	if(!in_filenames.size())
+	{
+		print_usage(argv[0]);
+		std::cerr << "no input specified\n";
+		return -1;
+	}
+
+	if(watch)
+	{
+		if(in_filenames.size() != 1)
+		{
+			std::cerr << "--watch can only be used with a single input file\n";
+			return -1;
+		}
+		return watch_file(in_filenames[0], out_filename, format, paranoid, verbose);
+	}
+
+	if(in_filenames.size() == 1)
+		return compile_file(in_filenames[0], out_filename, format, paranoid, verbose, std::cout, std::cerr) ? 0 : -1;
+
+	if(out_filename.size())
+	{
+		std::cerr << "--output can't be used with multiple input files\n";
+		return -1;
+	}
+	return compile_batch(in_filenames, format, paranoid, verbose);
+}
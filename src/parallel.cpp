@@ -0,0 +1,68 @@
+#include "parallel.h"
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <exception>
+
+static std::atomic<unsigned int> thread_count(0);
+static thread_local bool in_worker = false;
+
+void parallel_for(unsigned int count, const std::function<void(unsigned int)>& function, unsigned int threads)
+{
+	if(!threads)
+		threads = get_thread_count();
+	if(threads > count)
+		threads = count;
+	// Nested calls are run in the worker thread
+	if(threads <= 1 || in_worker)
+	{
+		for(unsigned int i = 0; i < count; i++)
+			function(i);
+		return;
+	}
+
+	std::atomic<unsigned int> next(0);
+	std::vector<std::exception_ptr> errors(count);
+	auto worker = [&]() {
+		in_worker = true;
+		unsigned int i;
+		while((i = next++) < count)
+		{
+			try
+			{
+				function(i);
+			}
+			catch(...)
+			{
+				errors[i] = std::current_exception();
+			}
+		}
+		in_worker = false;
+	};
+
+	std::vector<std::thread> pool;
+	for(unsigned int i = 1; i < threads; i++)
+		pool.emplace_back(worker);
+	worker();
+	for(auto& thread : pool)
+		thread.join();
+
+	for(auto& error : errors)
+	{
+		if(error)
+			std::rethrow_exception(error);
+	}
+}
+
+void set_thread_count(unsigned int threads)
+{
+	thread_count = threads;
+}
+
+unsigned int get_thread_count()
+{
+	unsigned int threads = thread_count;
+	if(!threads)
+		threads = std::thread::hardware_concurrency();
+	return threads ? threads : 1;
+}
@@ -0,0 +1,37 @@
+//! \file parallel.h
+//! Helper functions for running work on multiple threads.
+#ifndef PARALLEL_H
+#define PARALLEL_H
+#include <functional>
+
+//! Call a function for each index in parallel.
+/*!
+ * The function is called once for each index from 0 to count-1.
+ * Indexes are handed out in order to a pool of worker threads.
+ *
+ * If the function throws an exception, the remaining indexes are
+ * still processed. The exception from the lowest index is then
+ * rethrown, so errors are reported the same way as if the
+ * indexes were processed one after another.
+ *
+ * If called from a function that is already run by parallel_for(),
+ * the indexes are processed in the current thread.
+ *
+ * \param count Number of indexes.
+ * \param function Function to call.
+ * \param threads Number of threads. If 0, get_thread_count() is used.
+ *                If 1, the function is called from the current thread.
+ */
+void parallel_for(unsigned int count, const std::function<void(unsigned int)>& function, unsigned int threads = 0);
+
+//! Set the default number of threads used by parallel_for().
+/*!
+ * \param threads Number of threads. If 0, use the number of
+ *                hardware threads.
+ */
+void set_thread_count(unsigned int threads);
+
+//! Get the default number of threads used by parallel_for().
+unsigned int get_thread_count();
+
+#endif
@@ -72,6 +72,48 @@ void MD_Channel::update(int seq_ticks)
 	}
 }
 
+//! Get the number of frames that can be skipped.
+/*!
+ *  Returns the number of sequence updates that would not change the
+ *  output of the channel, given that the Player does not read any new
+ *  events. This is the case when there is no pending key on, the
+ *  portamento has reached its target and no pitch envelope is active.
+ */
+unsigned int MD_Channel::get_idle_frames() const
+{
+	if(key_on_flag || get_var(Event::PITCH_ENVELOPE))
+		return 0;
+	if(get_var(Event::PORTAMENTO) && porta_value != note_pitch)
+		return 0;
+	return v_get_idle_frames();
+}
+
+//! Skip idle frames.
+/*!
+ *  \param frames Number of frames, must not be larger than the value
+ *         returned by get_idle_frames().
+ *  \param seq_ticks Total number of ticks played during those frames,
+ *         must not be larger than the value returned by get_idle_ticks().
+ *
+ *  This has the same effect as calling update() once for each frame.
+ */
+void MD_Channel::skip_frames(unsigned int frames, unsigned int seq_ticks)
+{
+	skip_ticks(seq_ticks);
+	v_skip_envelope(frames);
+}
+
+//! Get the number of frames before the envelope must be updated.
+unsigned int MD_Channel::v_get_idle_frames() const
+{
+	return UINT_MAX;
+}
+
+//! Skip envelope frames.
+void MD_Channel::v_skip_envelope(unsigned int frames)
+{
+}
+
 void MD_Channel::seek(int ticks)
 {
 	skip_ticks(ticks);
@@ -145,97 +187,87 @@ uint16_t MD_Channel::get_psg_pitch(uint16_t pitch) const
 }
 
 //! Platform-exclusive command parser
-uint32_t MD_Channel::parse_platform_event(const Tag& tag, int16_t* platform_state)
-{
-	if(iequal(tag[0], "mode"))
-	{
-		if(tag.size() < 2)
-			error("not enough parameters for 'mode' command");
-		platform_state[EVENT_CHANNEL_MODE] = std::strtol(tag[1].c_str(), 0, 0);
-		return (1 << EVENT_CHANNEL_MODE);
-	}
-	else if(iequal(tag[0], "lfo"))
-	{
-		if(tag.size() < 3)
-			error("not enough parameters for 'lfo' command");
-		platform_state[EVENT_LFO] = (std::strtol(tag[1].c_str(), 0, 0) << 4) | (std::strtol(tag[2].c_str(), 0, 0));
-		return (1 << EVENT_LFO);
-	}
-	else if(iequal(tag[0], "lfodelay"))
-	{
-		if(tag.size() < 2)
-			error("not enough parameters for 'lfodelay' command");
-		platform_state[EVENT_LFO_DELAY] = std::strtol(tag[1].c_str(), 0, 0);
-		return (1 << EVENT_LFO_DELAY);
-	}
-	else if(iequal(tag[0], "lforate"))
-	{
-		if(tag.size() < 2)
-			error("not enough parameters for 'lforate' command");
-		platform_state[EVENT_LFO_CONFIG] = std::strtol(tag[1].c_str(), 0, 0);
-		return (1 << EVENT_LFO_CONFIG);
-	}
-	else if(iequal(tag[0], "fm3"))
-	{
-		if(tag.size() < 2)
-			error("not enough parameters for 'fm3' command");
-		platform_state[EVENT_FM3] = (std::strtol(tag[1].c_str(), 0, 2) ^ 0x0f) & 0x0f;
-		return (1 << EVENT_FM3);
-	}
-	else if(iequal(tag[0], "write"))
-	{
-		if(tag.size() < 3)
-			error("not enough parameters for 'write' command");
-		platform_state[EVENT_WRITE_ADDR] = std::strtol(tag[1].c_str(), 0, 0);
-		platform_state[EVENT_WRITE_DATA] = std::strtol(tag[2].c_str(), 0, 0);
-		platform_state[EVENT_TL_MODIFY] = 0;
-		return (1 << EVENT_WRITE_DATA);
-	}
-	else if(iequal(tag[0], "pcmrate"))
-	{
-		if(tag.size() < 2)
-			error("not enough parameters for 'pcmrate' command");
-		uint8_t data = std::strtol(tag[1].c_str(), 0, 0);
-		if(data < 1 || data > 8)
-			error("pcmrate argument must be between 1 and 8");
-		if(driver->pcm_mode && pcm_channel_valid)
+/*!
+ *  Commands are looked up in the table parsed by MDSDRV_Data::read_song().
+ */
+uint32_t MD_Channel::parse_platform_command(int16_t id, int16_t* platform_state)
+{
+	auto search = driver->data.platform_command_map.find(id);
+	if(search == driver->data.platform_command_map.end())
+		error(stringf("Platform command %d is not defined", id).c_str());
+
+	const MDSDRV_Platform_Command& cmd = search->second;
+	switch(cmd.type)
+	{
+		case MDSDRV_Platform_Command::MODE:
+			if(cmd.argc < 1)
+				error("not enough parameters for 'mode' command");
+			platform_state[EVENT_CHANNEL_MODE] = cmd.arg[0];
+			return (1 << EVENT_CHANNEL_MODE);
+		case MDSDRV_Platform_Command::LFO:
+			if(cmd.argc < 2)
+				error("not enough parameters for 'lfo' command");
+			platform_state[EVENT_LFO] = (cmd.arg[0] << 4) | cmd.arg[1];
+			return (1 << EVENT_LFO);
+		case MDSDRV_Platform_Command::LFO_DELAY:
+			if(cmd.argc < 1)
+				error("not enough parameters for 'lfodelay' command");
+			platform_state[EVENT_LFO_DELAY] = cmd.arg[0];
+			return (1 << EVENT_LFO_DELAY);
+		case MDSDRV_Platform_Command::LFO_RATE:
+			if(cmd.argc < 1)
+				error("not enough parameters for 'lforate' command");
+			platform_state[EVENT_LFO_CONFIG] = cmd.arg[0];
+			return (1 << EVENT_LFO_CONFIG);
+		case MDSDRV_Platform_Command::FM3:
+			if(cmd.argc < 1)
+				error("not enough parameters for 'fm3' command");
+			platform_state[EVENT_FM3] = (cmd.arg[0] ^ 0x0f) & 0x0f;
+			return (1 << EVENT_FM3);
+		case MDSDRV_Platform_Command::WRITE:
+			if(cmd.argc < 2)
+				error("not enough parameters for 'write' command");
+			platform_state[EVENT_WRITE_ADDR] = cmd.arg[0];
+			platform_state[EVENT_WRITE_DATA] = cmd.arg[1];
+			platform_state[EVENT_TL_MODIFY] = 0;
+			return (1 << EVENT_WRITE_DATA);
+		case MDSDRV_Platform_Command::PCM_RATE:
 		{
-			driver->pcm.set_pitch(pcm_channel_id, data);
-			pcm_channel_enable = true;
+			if(cmd.argc < 1)
+				error("not enough parameters for 'pcmrate' command");
+			uint8_t data = cmd.arg[0];
+			if(data < 1 || data > 8)
+				error("pcmrate argument must be between 1 and 8");
+			if(driver->pcm_mode && pcm_channel_valid)
+			{
+				driver->pcm.set_pitch(pcm_channel_id, data);
+				pcm_channel_enable = true;
+			}
+			break;
 		}
-	}
-	else if(iequal(tag[0], "pcmmode"))
-	{
-		if(tag.size() < 2)
-			error("not enough parameters for 'pcmmode' command");
-		uint8_t data = std::strtol(tag[1].c_str(), 0, 0);
-		if(data < 2 || data > 3)
-			error("pcmmode argument must be between 2 or 3");
-		driver->pcm_rate = driver->pcm.set_mode(data);
-		driver->pcm_counter = 0;
-		driver->pcm_delta = driver->get_rate()/driver->pcm_rate;
-		printf("set rate to %f", driver->pcm_delta);
-	}
-	else if(MDSDRV_get_register(tag[0]))
-	{
-		if(tag.size() < 2)
-			error("not enough parameters for 'write' command");
-
-		uint8_t reg = MDSDRV_get_register(tag[0]);
-		int16_t val = std::strtol(tag[1].c_str(), 0, 0);
-
-		if(tag[1].size() > 0)
+		case MDSDRV_Platform_Command::PCM_MODE:
 		{
-			uint8_t sign = tag[1][0];
-			if(sign == '+' || sign == '-')
-				platform_state[EVENT_TL_MODIFY] = 1;
-			else
-				platform_state[EVENT_TL_MODIFY] = 0;
+			if(cmd.argc < 1)
+				error("not enough parameters for 'pcmmode' command");
+			uint8_t data = cmd.arg[0];
+			if(data < 2 || data > 3)
+				error("pcmmode argument must be between 2 or 3");
+			driver->pcm_rate = driver->pcm.set_mode(data);
+			driver->pcm_counter = 0;
+			driver->pcm_delta = driver->get_rate()/driver->pcm_rate;
+			printf("set rate to %f", driver->pcm_delta);
+			break;
 		}
-
-		platform_state[EVENT_WRITE_ADDR] = reg;
-		platform_state[EVENT_WRITE_DATA] = val;
-		return (1 << EVENT_WRITE_DATA);
+		case MDSDRV_Platform_Command::REGISTER:
+			if(cmd.argc < 1)
+				error("not enough parameters for 'write' command");
+			if(cmd.has_value)
+				platform_state[EVENT_TL_MODIFY] = cmd.relative;
+			platform_state[EVENT_WRITE_ADDR] = cmd.reg;
+			platform_state[EVENT_WRITE_DATA] = cmd.arg[0];
+			return (1 << EVENT_WRITE_DATA);
+		default:
+			break;
 	}
 	return 0;
 }
@@ -598,6 +630,11 @@ MD_FM::MD_FM(MD_Driver& driver, int track_id, int channel_id)
 	driver.ym2612_w(bank, 0xb4, id, 0, pan_lfo); //enable panning
 }
 
+std::unique_ptr<MD_Channel> MD_FM::clone() const
+{
+	return std::make_unique<MD_FM>(*this);
+}
+
 void MD_FM::v_set_ins()
 {
 	write_fm_4op(bank, id);
@@ -761,6 +798,26 @@ void MD_PSG::v_update_envelope()
 	}
 }
 
+unsigned int MD_PSG::v_get_idle_frames() const
+{
+	if(env_delay < 0x20 || env_keyoff)
+	{
+		// envelope stopped, or waiting at the sustain or stop command
+		if(env_pos == 0xff)
+			return UINT_MAX;
+		else if(!env_keyoff && env_data->at(env_pos) < 0x02)
+			return UINT_MAX;
+		return 0;
+	}
+	return (env_delay >> 4) - 1;
+}
+
+void MD_PSG::v_skip_envelope(unsigned int frames)
+{
+	if(env_delay >= 0x20 && !env_keyoff)
+		env_delay -= frames << 4;
+}
+
 void MD_PSG::v_set_pan()
 {
 	error("Panning not supported for PSG channels");
@@ -773,6 +830,11 @@ MD_PSGMelody::MD_PSGMelody(MD_Driver& driver, int track_id, int channel_id)
 {
 }
 
+std::unique_ptr<MD_Channel> MD_PSGMelody::clone() const
+{
+	return std::make_unique<MD_PSGMelody>(*this);
+}
+
 void MD_PSGMelody::v_set_ins()
 {
 	int16_t ins_id = get_var(Event::INS);
@@ -808,6 +870,11 @@ MD_PSGNoise::MD_PSGNoise(MD_Driver& driver, int track_id, int channel_id)
 {
 }
 
+std::unique_ptr<MD_Channel> MD_PSGNoise::clone() const
+{
+	return std::make_unique<MD_PSGNoise>(*this);
+}
+
 void MD_PSGNoise::v_set_ins()
 {
 	int16_t ins_id = get_var(Event::INS);
@@ -871,6 +938,11 @@ MD_Dummy::MD_Dummy(MD_Driver& driver, int track_id, int channel_id)
 {
 }
 
+std::unique_ptr<MD_Channel> MD_Dummy::clone() const
+{
+	return std::make_unique<MD_Dummy>(*this);
+}
+
 void MD_Dummy::v_set_ins()
 {
 }
@@ -903,9 +975,14 @@ void MD_Dummy::v_update_envelope()
 {
 }
 
-bool MD_PCMDriver::tables_initialized;
+const uint32_t MD_PCMDriver::block_size;
+
 int8_t MD_PCMDriver::vol_table[16][256];
 
+const uint8_t MD_PCMDriver::vol_scale[16] = {
+	255, 203, 161, 128, 102, 81, 64, 51, 40, 32, 26, 20, 16, 13, 10, 8
+};
+
 const uint8_t MD_PCMDriver::pitch_table[2][8] = {
 	{
 		0b10000000, //2ch mix mode
@@ -930,28 +1007,32 @@ const uint8_t MD_PCMDriver::pitch_table[2][8] = {
 };
 
 
-//! constructs MD_PCMDriver.
-MD_PCMDriver::MD_PCMDriver(MD_Driver& driver)
-	: driver(&driver)
-	, mode(0)
+//! Initialize the volume table.
+bool MD_PCMDriver::init_tables()
 {
-	if(!tables_initialized)
+	for(int tab = 0; tab < 16; tab++)
 	{
-		tables_initialized = true;
-
-		static const uint8_t volt[16] = {
-			255, 203, 161, 128, 102, 81, 64, 51, 40, 32, 26, 20, 16, 13, 10, 8
-		};
-		for(int tab = 0; tab < 16; tab++)
+		uint8_t tvol = vol_scale[tab];
+		for(int i=0; i<256; i++)
 		{
-			uint8_t tvol = volt[tab];
-			for(int i=0; i<256; i++)
-			{
-				int8_t ivol = i ^ 0x80;
-				vol_table[tab][i] = (ivol * tvol) >> 8;
-			}
+			int8_t ivol = i ^ 0x80;
+			vol_table[tab][i] = (ivol * tvol) >> 8;
 		}
 	}
+	return true;
+}
+
+//! constructs MD_PCMDriver.
+MD_PCMDriver::MD_PCMDriver(MD_Driver& driver)
+	: driver(&driver)
+	, mode(0)
+	, rendering(false)
+	, dac_off_pending(false)
+{
+	// Static initialization is thread safe, so that drivers can be
+	// created from multiple threads.
+	static const bool tables_initialized = init_tables();
+	(void)tables_initialized;
 
 	// init channels
 	for(int i=0; i<3; i++)
@@ -1020,7 +1101,10 @@ void MD_PCMDriver::key_on(int channel)
 	if(channel > mode)
 		return;
 
-	if(!channels[0].enabled && !channels[1].enabled && !channels[2].enabled)
+	// a deferred DAC disable is cancelled, as the DAC is still enabled
+	if(dac_off_pending)
+		dac_off_pending = false;
+	else if(!channels[0].enabled && !channels[1].enabled && !channels[2].enabled)
 		driver->ym2612_w(0, 0x2b, 0, 0, 0x80);
 
 	channels[channel].position = 0;
@@ -1035,7 +1119,24 @@ void MD_PCMDriver::key_off(int channel)
 	channels[channel].enabled =  false;
 
 	if(!channels[0].enabled && !channels[1].enabled && !channels[2].enabled)
-		driver->ym2612_w(0, 0x2b, 0, 0, 0x00);
+	{
+		if(rendering)
+			dac_off_pending = true;
+		else
+			driver->ym2612_w(0, 0x2b, 0, 0, 0x00);
+	}
+}
+
+//! Get PCM driver mixing mode
+int MD_PCMDriver::get_mode() const
+{
+	return mode;
+}
+
+//! Return true if render() has deferred a DAC disable write.
+bool MD_PCMDriver::get_dac_off_pending() const
+{
+	return dac_off_pending;
 }
 
 void MD_PCMDriver::update()
@@ -1043,22 +1144,97 @@ void MD_PCMDriver::update()
 	if(!mode)
 		return;
 
+	const uint8_t* rom = get_rom_data();
 	int8_t accumulator = 0;
 	for(int i=0; i<mode; i++)
-		accumulator = mix_channel(accumulator, i);
+		accumulator = mix_channel(rom, accumulator, i);
 
 	if(channels[0].enabled || channels[1].enabled || channels[2].enabled)
 		driver->ym2612_w(0, 0x2a, 0, 0, accumulator ^ 0x80);
 }
 
-inline int8_t MD_PCMDriver::mix_channel(int16_t accumulator, int channel)
+//! Mix PCM samples to a buffer.
+/*!
+ *  This has the same effect as calling update() \p count times, except
+ *  that the DAC values are appended to \p buffer instead of being
+ *  written to the YM2612.
+ *
+ *  Mixing stops early when the last channel is keyed off by the end of
+ *  its sample. The DAC disable write is then deferred until the next
+ *  call to update_dac(), which should be done at the time of the
+ *  update that keyed off the channel.
+ *
+ *  \return the number of samples that were added to the buffer.
+ */
+uint32_t MD_PCMDriver::render(std::vector<uint8_t>& buffer, uint32_t count)
+{
+	if(!mode)
+		return 0;
+	return render(get_rom_data(), buffer, count);
+}
+
+//! Get the wave ROM that the sample positions refer to.
+const uint8_t* MD_PCMDriver::get_rom_data() const
+{
+	return driver->data.wave_rom.get_rom_data().data();
+}
+
+//! Mix PCM samples to a buffer, using \p rom as the wave ROM.
+/*!
+ *  The channels are mixed in blocks of up to block_size updates. The
+ *  output is identical to mixing one update at a time with
+ *  mix_channel().
+ */
+uint32_t MD_PCMDriver::render(const uint8_t* rom, std::vector<uint8_t>& buffer, uint32_t count)
+{
+	uint32_t samples = 0;
+	rendering = true;
+	while(samples < count && (channels[0].enabled || channels[1].enabled || channels[2].enabled))
+	{
+		int16_t accumulator[block_size] = {};
+		uint32_t size = std::min(count - samples, block_size);
+		uint32_t length = 0;
+		for(int i=0; i<mode; i++)
+			length = std::max(length, mix_channel_block(rom, accumulator, size, i));
+		// The output of the update that keys off the last channel
+		// is not written.
+		if(dac_off_pending)
+			size = length - 1;
+
+		buffer.resize(buffer.size() + size);
+		uint8_t* output = buffer.data() + buffer.size() - size;
+		for(uint32_t i=0; i<size; i++)
+			output[i] = accumulator[i] ^ 0x80;
+		samples += size;
+
+		if(dac_off_pending)
+			break;
+	}
+	rendering = false;
+	return samples;
+}
+
+//! Write the DAC disable that was deferred by render().
+/*!
+ *  \return true if the DAC was disabled. This counts as one update.
+ */
+bool MD_PCMDriver::update_dac()
+{
+	if(!dac_off_pending)
+		return false;
+	dac_off_pending = false;
+	driver->ym2612_w(0, 0x2b, 0, 0, 0x00);
+	return true;
+}
+
+int8_t MD_PCMDriver::mix_channel(const uint8_t* rom, int16_t accumulator, int channel)
 {
 	MD_PCMChannel& ch = channels[channel];
 
 	if(!ch.enabled)
 		return accumulator;
 
-	uint8_t sample = driver->data.wave_rom.get_rom_data()[ch.start + ch.position];
+	uint8_t sample = rom[ch.start + ch.position];
 
 	ch.position += ch.update_phase();
 	if(ch.count && !(--ch.count))
@@ -1078,6 +1254,84 @@ inline int8_t MD_PCMDriver::mix_channel(int16_t accumulator, int channel)
 	return accumulator;
 }
 
+//! Mix a block of updates from a single channel.
+/*!
+ *  Adds the output of the channel for up to \p size updates to
+ *  \p accumulator, clamping the result in the same way as
+ *  mix_channel().
+ *
+ *  The phase and skip counter return to the same state after 32
+ *  updates, so the position increments only need to be calculated for
+ *  one period. The sample positions are then calculated before the
+ *  volume is applied, so that the mixing loop can be vectorized.
+ *
+ *  \return the number of updates that the channel was mixed, including
+ *          the update where the channel was keyed off.
+ */
+uint32_t MD_PCMDriver::mix_channel_block(const uint8_t* rom, int16_t* accumulator, uint32_t size, int channel)
+{
+	MD_PCMChannel& ch = channels[channel];
+
+	if(!ch.enabled)
+		return 0;
+
+	MD_PCMChannel state = ch;
+	uint8_t steps[32];
+	for(int i=0; i<32; i++)
+	{
+		steps[i] = state.update_phase();
+		if(state.count && !(--state.count))
+		{
+			steps[i] += state.update_phase();
+			state.count = 4;
+		}
+	}
+
+	uint32_t position[block_size];
+	uint32_t length = size;
+	uint32_t next_position = ch.position;
+	bool end = false;
+	for(uint32_t i=0; i<size; i++)
+	{
+		position[i] = next_position;
+		next_position += steps[i & 31];
+		if(next_position > ch.length)
+		{
+			length = i + 1;
+			end = true;
+			break;
+		}
+	}
+
+	int8_t sample[block_size];
+	const uint8_t* data = rom + ch.start;
+	for(uint32_t i=0; i<length; i++)
+		sample[i] = data[position[i]] ^ 0x80;
+
+	int16_t scale = vol_scale[ch.volume];
+	for(uint32_t i=0; i<length; i++)
+	{
+		int16_t mix = accumulator[i] + ((sample[i] * scale) >> 8);
+		accumulator[i] = std::min<int16_t>(127, std::max<int16_t>(-128, mix));
+	}
+
+	// advance the phase and skip counter
+	ch.position = next_position;
+	for(uint32_t i=0; i<length % 32; i++)
+	{
+		ch.update_phase();
+		if(ch.count && !(--ch.count))
+		{
+			ch.update_phase();
+			ch.count = 4;
+		}
+	}
+
+	if(end)
+		key_off(channel);
+	return length;
+}
+
 
 //! constructs a MD_Driver.
 /*!
@@ -1090,6 +1344,9 @@ MD_Driver::MD_Driver(unsigned int rate, VGM_Interface* vgm_interface, int pcm_mo
 	, pcm(*this)
 	, vgm(vgm_interface)
 	, pcm_mode(pcm_mode)
+	, pcm_stream_position(0)
+	, pcm_buffer()
+	, pcm_blocks()
 	, tempo_delta(255)
 	, tempo_counter(0)
 	, ticks(0)
@@ -1123,15 +1380,22 @@ void MD_Driver::play_song(Song& song)
 	data.read_song(song);
 	// Need to expose data.message in a good way later for development...
 	//std::cout << data.message;
+	pcm_stream_position = 0;
+	pcm_blocks.clear();
 	if(vgm && !pcm_mode)
 	{
 		const std::vector<uint8_t>& dbdata = data.wave_rom.get_rom_data();
+		pcm_stream_position = dbdata.size() - data.wave_rom.get_free_bytes();
 		vgm->datablock(0x00,
-			dbdata.size() - data.wave_rom.get_free_bytes(),
+			pcm_stream_position,
 			dbdata.data(),
 			dbdata.size());
-		vgm->dac_setup(0x00, 0x02, 0x00, 0x2a, 0x00);
 	}
+	// In PCM mixing mode, the mixer output is also played with a DAC
+	// stream. See stream_pcm().
+	if(vgm)
+		vgm->dac_setup(0x00, 0x02, 0x00, 0x2a, 0x00);
+	checkpoints.clear();
 	// setup tempo
 	tempo_delta = 128;
 	tempo_counter = 0;
@@ -1159,17 +1423,100 @@ void MD_Driver::reset()
 }
 
 //! Skip a specified number of ticks
+/*!
+ *  If checkpoints have been created, the nearest checkpoint before
+ *  \p ticks is restored first, and only the remaining ticks are skipped.
+ *  Otherwise, ticks are skipped from the current position.
+ */
 void MD_Driver::skip_ticks(unsigned int ticks)
 {
+	unsigned int skip = ticks;
+	auto checkpoint = std::lower_bound(checkpoints.begin(), checkpoints.end(), ticks,
+		[](const MD_Checkpoint& cp, unsigned int value) { return cp.ticks < value; });
+	if(checkpoint != checkpoints.begin())
+		checkpoint--;
+	if(checkpoint != checkpoints.end())
+	{
+		load_checkpoint(*checkpoint);
+		skip -= checkpoint->ticks;
+	}
 	this->ticks = ticks;
 	for(auto it = channels.begin(); it != channels.end(); it++)
 	{
 		MD_Channel* ch = it->get();
 		if(ch->is_enabled())
-			ch->seek(ticks);
+			ch->seek(skip);
 	}
 }
 
+//! Create checkpoints for faster seeking.
+/*!
+ *  Must be called after play_song() and before play_step(). The song
+ *  is skipped until the end or until \p max_ticks, saving the driver
+ *  state every \p interval ticks. The driver is then returned to the
+ *  beginning of the song.
+ *
+ *  After this, skip_ticks() always seeks from the beginning of the song.
+ *
+ *  Register writes during the skipped events are not logged.
+ */
+void MD_Driver::create_checkpoints(unsigned int interval, unsigned int max_ticks)
+{
+	checkpoints.clear();
+	if(!interval)
+		return;
+
+	checkpoints.push_back(save_checkpoint());
+	set_vgm_interface(nullptr);
+	while(is_playing() && ticks + interval <= max_ticks)
+	{
+		ticks += interval;
+		for(auto it = channels.begin(); it != channels.end(); it++)
+			it->get()->skip_ticks(interval, false);
+		checkpoints.push_back(save_checkpoint());
+	}
+	set_vgm_interface(vgm);
+	load_checkpoint(checkpoints.front());
+}
+
+//! Save the driver playback state.
+MD_Checkpoint MD_Driver::save_checkpoint() const
+{
+	MD_Checkpoint checkpoint = {ticks, {}, pcm,
+		pcm_rate, pcm_delta, seq_counter, pcm_counter,
+		tempo_delta, tempo_counter, fm3_mask, fm3_con,
+		{fm3_tl[0], fm3_tl[1], fm3_tl[2], fm3_tl[3]},
+		last_pcm_channel, loop_trigger};
+	for(auto it = channels.begin(); it != channels.end(); it++)
+		checkpoint.channels.push_back(it->get()->clone());
+	return checkpoint;
+}
+
+//! Restore the driver playback state.
+/*!
+ *  The checkpoint must have been created by the same driver, with the
+ *  same song.
+ */
+void MD_Driver::load_checkpoint(const MD_Checkpoint& checkpoint)
+{
+	channels.clear();
+	for(auto it = checkpoint.channels.begin(); it != checkpoint.channels.end(); it++)
+		channels.push_back(it->get()->clone());
+	pcm = checkpoint.pcm;
+	pcm_rate = checkpoint.pcm_rate;
+	pcm_delta = checkpoint.pcm_delta;
+	seq_counter = checkpoint.seq_counter;
+	pcm_counter = checkpoint.pcm_counter;
+	tempo_delta = checkpoint.tempo_delta;
+	tempo_counter = checkpoint.tempo_counter;
+	ticks = checkpoint.ticks;
+	fm3_mask = checkpoint.fm3_mask;
+	fm3_con = checkpoint.fm3_con;
+	std::copy(checkpoint.fm3_tl, checkpoint.fm3_tl+4, fm3_tl);
+	last_pcm_channel = checkpoint.last_pcm_channel;
+	loop_trigger = checkpoint.loop_trigger;
+}
+
 //! Return true if driver is currently playing a song, false otherwise.
 bool MD_Driver::is_playing()
 {
@@ -1209,24 +1556,37 @@ double MD_Driver::play_step()
 		// update tracks
 		seq_counter -= seq_delta;
 		seq_update();
+		// skip ahead to the next update that changes the output
+		if(!pcm.get_mode())
+			seq_counter -= seq_delta * seq_skip();
 	}
-	if(pcm_counter >= 0)
-	{
-		// update pcm
-		pcm_counter -= pcm_delta;
-		pcm.update();
-	}
+	// set the loop point before the PCM stream is started
 	if(loop_trigger && get_loop_count() == 0)
 	{
 		set_loop();
 		reset_loop_count();
 		loop_trigger = 0;
 	}
+	// PCM updates have no effect if mixing is disabled
+	bool pcm_enabled = pcm.get_mode();
+	if(pcm_enabled && pcm_counter >= 0)
+	{
+		// update pcm
+		if(vgm)
+		{
+			pcm_counter -= pcm_delta * stream_pcm();
+		}
+		else
+		{
+			pcm_counter -= pcm_delta;
+			pcm.update();
+		}
+	}
 	// get the time to the next event
-	double next_delta = std::max(seq_delta, pcm_delta);
+	double next_delta = std::max(std::max(seq_delta, pcm_delta), -seq_counter);
 	if((seq_counter + next_delta) > 0)
 		next_delta -= seq_counter + next_delta;
-	if((pcm_counter + next_delta) > 0)
+	if(pcm_enabled && (pcm_counter + next_delta) > 0)
 		next_delta -= pcm_counter + next_delta;
 	if(std::abs(next_delta) < 1/10000.0)
 		next_delta += 1/10000.0;
@@ -1235,6 +1595,43 @@ double MD_Driver::play_step()
 	return next_delta;
 }
 
+//! Mix the PCM updates until the next sequence update and play them using a DAC stream.
+/*!
+ *  Writing each sample to the DAC register would add a register write
+ *  and a delay command to the VGM for every PCM update. Instead, the
+ *  samples are written as a VGM datablock and played with a DAC stream
+ *  at the PCM rate, so that only a single play_step() is needed for
+ *  each sequence update.
+ *
+ *  \return the number of PCM updates that were processed.
+ */
+unsigned int MD_Driver::stream_pcm()
+{
+	// updates remaining before the next sequence update
+	unsigned int count = std::max(1.0, std::ceil((pcm_counter - seq_counter) / pcm_delta));
+	if(pcm.update_dac())
+		return count;
+
+	pcm_buffer.clear();
+	uint32_t samples = pcm.render(pcm_buffer, count);
+	if(samples)
+	{
+		// Repeated sounds often give the same output, so the
+		// datablock written the first time can be reused.
+		auto block = pcm_blocks.find(pcm_buffer);
+		if(block == pcm_blocks.end())
+		{
+			vgm->datablock(0x00, samples, pcm_buffer.data(), samples);
+			block = pcm_blocks.emplace(pcm_buffer, pcm_stream_position).first;
+			pcm_stream_position += samples;
+		}
+		vgm->dac_start(0x00, block->second, samples, pcm_rate);
+	}
+	// Return at the update that disabled the DAC
+	if(pcm.get_dac_off_pending())
+		return samples;
+	return count;
+}
 
 //! Converts BPM to fractional tempo
 uint8_t MD_Driver::bpm_to_delta(uint16_t bpm)
@@ -1259,6 +1656,57 @@ void MD_Driver::seq_update()
 	}
 }
 
+//! Skip sequence updates that do not change the output.
+/*!
+ *  Finds the number of upcoming sequence updates during which no
+ *  channel reads a new event or changes its register state, and
+ *  advances the tempo counter and all channels past those updates.
+ *
+ *  \return the number of updates that were skipped.
+ */
+unsigned int MD_Driver::seq_skip()
+{
+	unsigned int idle_frames = UINT_MAX;
+	unsigned int idle_ticks = UINT_MAX;
+	for(auto it = channels.begin(); it != channels.end(); it++)
+	{
+		MD_Channel* ch = it->get();
+		if(ch->is_enabled())
+		{
+			idle_frames = std::min(idle_frames, ch->get_idle_frames());
+			idle_ticks = std::min(idle_ticks, ch->get_idle_ticks());
+		}
+	}
+	if(idle_ticks == UINT_MAX)
+		return 0;
+
+	unsigned int frames = 0;
+	unsigned int frame_ticks = 0;
+	uint8_t counter = tempo_counter;
+	while(frames < idle_frames)
+	{
+		uint16_t next_counter = counter + tempo_delta + 1;
+		uint8_t tempo_step = next_counter >> 7;
+		if(frame_ticks + tempo_step > idle_ticks)
+			break;
+		frame_ticks += tempo_step;
+		counter = next_counter & 0x7f;
+		frames++;
+	}
+	if(frames)
+	{
+		tempo_counter = counter;
+		ticks += frame_ticks;
+		for(auto it = channels.begin(); it != channels.end(); it++)
+		{
+			MD_Channel* ch = it->get();
+			if(ch->is_enabled())
+				ch->skip_frames(frames, frame_ticks);
+		}
+	}
+	return frames;
+}
+
 //! Reset loop count
 void MD_Driver::reset_loop_count()
 {
@@ -6,6 +6,7 @@
 #include "../driver.h"
 #include "../vgm.h"
 #include "mdsdrv.h"
+#include <map>
 #include <memory>
 #include <vector>
 
@@ -19,6 +20,11 @@ class MD_Channel : public Player
 		MD_Channel(MD_Driver& driver, int id);
 		void update(int seq_ticks);
 		void seek(int ticks);
+		unsigned int get_idle_frames() const;
+		void skip_frames(unsigned int frames, unsigned int seq_ticks);
+
+		//! Create a copy of the channel, used for driver checkpoints.
+		virtual std::unique_ptr<MD_Channel> clone() const = 0;
 
 	protected:
 		enum
@@ -46,6 +52,8 @@ class MD_Channel : public Player
 		virtual void v_set_pitch() = 0;
 		virtual void v_set_type() = 0;
 		virtual void v_update_envelope() = 0;
+		virtual unsigned int v_get_idle_frames() const;
+		virtual void v_skip_envelope(unsigned int frames);
 
 		MD_Driver* driver;
 		int channel_id;
@@ -71,7 +79,7 @@ class MD_Channel : public Player
 		uint8_t tl[4]; // also used for Ch3 mode
 
 	private:
-		uint32_t parse_platform_event(const Tag& tag, int16_t* platform_state) override;
+		uint32_t parse_platform_command(int16_t id, int16_t* platform_state) override;
 		void write_event() override;
 
 		void update_tempo();
@@ -96,6 +104,7 @@ class MD_FM : public MD_Channel
 {
 	public:
 		MD_FM(MD_Driver& driver, int track_id, int channel_id);
+		std::unique_ptr<MD_Channel> clone() const override;
 
 	private:
 		void v_set_ins() override;
@@ -129,6 +138,8 @@ class MD_PSG : public MD_Channel
 		void v_key_off() override;
 		void v_set_pan() override;
 		void v_update_envelope() override;
+		unsigned int v_get_idle_frames() const override;
+		void v_skip_envelope(unsigned int frames) override;
 
 		//! Channel index
 		int id;
@@ -143,6 +154,7 @@ class MD_PSGMelody : public MD_PSG
 {
 	public:
 		MD_PSGMelody(MD_Driver& driver, int track_id, int channel_id);
+		std::unique_ptr<MD_Channel> clone() const override;
 	private:
 		enum
 		{
@@ -161,6 +173,7 @@ class MD_PSGNoise : public MD_PSG
 {
 	public:
 		MD_PSGNoise(MD_Driver& driver, int track_id, int channel_id);
+		std::unique_ptr<MD_Channel> clone() const override;
 
 	private:
 		enum
@@ -181,6 +194,7 @@ class MD_Dummy : public MD_Channel
 {
 	public:
 		MD_Dummy(MD_Driver& driver, int track_id, int channel_id);
+		std::unique_ptr<MD_Channel> clone() const override;
 
 	private:
 		int id;
@@ -227,21 +241,60 @@ class MD_PCMDriver
 		void key_on(int channel);
 		void key_off(int channel);
 
+		int get_mode() const;
+		bool get_dac_off_pending() const;
 		void update();
+		uint32_t render(std::vector<uint8_t>& buffer, uint32_t count);
+		bool update_dac();
 
 	protected:
+		//! Number of updates mixed at a time by render().
+		static const uint32_t block_size = 256;
+
 		MD_Driver* driver;
 		MD_PCMChannel channels[3];
 
 		int mode;
+		//! Set while render() is running.
+		bool rendering;
+		//! The DAC disable write was deferred by render().
+		bool dac_off_pending;
 
-		int8_t mix_channel(int16_t accumulator, int channel);
+		const uint8_t* get_rom_data() const;
+		uint32_t render(const uint8_t* rom, std::vector<uint8_t>& buffer, uint32_t count);
+		int8_t mix_channel(const uint8_t* rom, int16_t accumulator, int channel);
+		uint32_t mix_channel_block(const uint8_t* rom, int16_t* accumulator, uint32_t size, int channel);
 
-		static bool tables_initialized;
+		static bool init_tables();
 		static int8_t vol_table[16][256];
+		static const uint8_t vol_scale[16];
 		static const uint8_t pitch_table[2][8];
 };
 
+//! Megadrive sound driver checkpoint
+/*!
+ *  Contains a copy of the playback state of a MD_Driver at a specific
+ *  tick. The sequence data of the song is not included, so a
+ *  checkpoint can only be restored to the driver that created it.
+ */
+struct MD_Checkpoint
+{
+	uint32_t ticks;
+	std::vector<std::unique_ptr<MD_Channel>> channels;
+	MD_PCMDriver pcm;
+	double pcm_rate;
+	double pcm_delta;
+	double seq_counter;
+	double pcm_counter;
+	uint8_t tempo_delta;
+	uint8_t tempo_counter;
+	uint8_t fm3_mask;
+	uint8_t fm3_con;
+	uint8_t fm3_tl[4];
+	int last_pcm_channel;
+	bool loop_trigger;
+};
+
 //! Megadrive sound driver
 class MD_Driver : public Driver
 {
@@ -262,10 +315,16 @@ class MD_Driver : public Driver
 		double play_step();
 		uint32_t get_player_ticks();
 
+		void create_checkpoints(unsigned int interval, unsigned int max_ticks);
+		MD_Checkpoint save_checkpoint() const;
+		void load_checkpoint(const MD_Checkpoint& checkpoint);
+
 	private:
 		uint8_t bpm_to_delta(uint16_t bpm);
 		void seq_update();
+		unsigned int seq_skip();
 		void reset_loop_count();
+		unsigned int stream_pcm();
 
 		MDSDRV_Data data;
 		MD_PCMDriver pcm;
@@ -281,6 +340,12 @@ class MD_Driver : public Driver
 		double seq_counter;
 		double pcm_counter;
 
+		//! Size of the VGM datablocks written so far.
+		uint32_t pcm_stream_position;
+		std::vector<uint8_t> pcm_buffer;
+		//! Maps the contents of each datablock to its position.
+		std::map<std::vector<uint8_t>, uint32_t> pcm_blocks;
+
 		uint8_t tempo_delta;
 		uint8_t tempo_counter;
 		uint32_t ticks;
@@ -292,6 +357,8 @@ class MD_Driver : public Driver
 		int last_pcm_channel;
 
 		bool loop_trigger;
+
+		std::vector<MD_Checkpoint> checkpoints;
 };
 
 #endif
@@ -0,0 +1,187 @@
+#include <fstream>
+#include <thread>
+#include <functional>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include "mdscache.h"
+#include "mdsdrv.h"
+#include "../stringf.h"
+
+//! Identifies the compiler. Cached files from other versions are not used.
+static const std::string cache_version = stringf("ctrmml %s mdsdrv %d.%d",
+	CTRMML_VERSION, MDSDRV_SEQ_VERSION_MAJOR, MDSDRV_SEQ_VERSION_MINOR);
+
+static const uint64_t fnv_offset_basis = 0xcbf29ce484222325ULL;
+static const uint64_t fnv_prime = 0x100000001b3ULL;
+
+//! 64-bit FNV-1a hash
+static uint64_t fnv1a(const void* data, size_t size, uint64_t hash = fnv_offset_basis)
+{
+	const uint8_t* ptr = (const uint8_t*)data;
+	for(size_t i = 0; i < size; i++)
+	{
+		hash ^= ptr[i];
+		hash *= fnv_prime;
+	}
+	return hash;
+}
+
+static uint64_t fnv1a(const std::string& str, uint64_t hash = fnv_offset_basis)
+{
+	// include the terminator so that the boundary between strings is hashed
+	return fnv1a(str.c_str(), str.size() + 1, hash);
+}
+
+static inline std::string hash_string(uint64_t hash)
+{
+	return stringf("%08x%08x", (uint32_t)(hash >> 32), (uint32_t)hash);
+}
+
+//! Creates a MDS_Cache.
+/*!
+ *  \param path Cache directory. It is created if it doesn't exist.
+ */
+MDS_Cache::MDS_Cache(const std::string& path)
+	: path(path)
+{
+#ifdef _WIN32
+	_mkdir(path.c_str());
+#else
+	mkdir(path.c_str(), 0777);
+#endif
+	if(this->path.size() && this->path.back() != '/' && this->path.back() != '\\')
+		this->path += "/";
+}
+
+//! Get the cache key for a MML file.
+/*!
+ *  The key is a hash of the compiler version, the filename and the
+ *  file contents. The key should be read before the file is compiled,
+ *  so that later changes to the file are not missed.
+ *
+ *  \return The key, or an empty string if the file could not be read.
+ */
+std::string MDS_Cache::get_key(const std::string& filename) const
+{
+	std::vector<uint8_t> data;
+	if(!read_file(filename, data))
+		return "";
+	uint64_t hash = fnv1a(cache_version);
+	hash = fnv1a(filename, hash);
+	hash = fnv1a(data.data(), data.size(), hash);
+	return hash_string(hash);
+}
+
+//! Look up a song in the cache.
+/*!
+ *  \param key Key from get_key().
+ *  \param[out] mds MDS data, if found.
+ *  \return true if the song was found and none of the dependencies
+ *          have changed.
+ */
+bool MDS_Cache::lookup(const std::string& key, RIFF& mds) const
+{
+	if(!key.size())
+		return false;
+	std::ifstream list(path + key + ".dep");
+	if(!list)
+		return false;
+
+	// Check the hash of each dependency
+	uint64_t hash = fnv1a(key);
+	std::string line;
+	while(std::getline(list, line))
+	{
+		std::vector<uint8_t> data;
+		std::string expected = line.substr(0, 16);
+		std::string filename = line.size() > 17 ? line.substr(17) : "";
+		if(!read_file(filename, data))
+			return false;
+		uint64_t file_hash = fnv1a(data.data(), data.size());
+		if(hash_string(file_hash) != expected)
+			return false;
+		hash = fnv1a(line, hash);
+	}
+
+	std::vector<uint8_t> data;
+	if(!read_file(path + hash_string(hash) + ".mds", data))
+		return false;
+	try
+	{
+		mds = RIFF(data);
+	}
+	catch(std::exception&)
+	{
+		return false;
+	}
+	return true;
+}
+
+//! Store a song in the cache.
+/*!
+ *  \param key Key from get_key(), read before the song was compiled.
+ *  \param dependencies Other files read when compiling the song.
+ *  \param mds MDS data.
+ *  \return false if the cache files could not be written.
+ */
+bool MDS_Cache::store(const std::string& key, const std::vector<std::string>& dependencies, const RIFF& mds) const
+{
+	if(!key.size())
+		return false;
+	std::string list;
+	uint64_t hash = fnv1a(key);
+	for(auto&& filename : dependencies)
+	{
+		std::vector<uint8_t> data;
+		if(!read_file(filename, data))
+			return false;
+		std::string line = hash_string(fnv1a(data.data(), data.size())) + " " + filename;
+		hash = fnv1a(line, hash);
+		list += line + "\n";
+	}
+	// The MDS data is written first, so that the dependency list never
+	// points to a missing file.
+	return write_file(path + hash_string(hash) + ".mds", mds.to_bytes())
+		&& write_file(path + key + ".dep", std::vector<uint8_t>(list.begin(), list.end()));
+}
+
+bool MDS_Cache::read_file(const std::string& filename, std::vector<uint8_t>& data) const
+{
+	if (std::ifstream in{filename, std::ios::binary | std::ios::ate})
+	{
+		auto size = in.tellg();
+		data.resize(size);
+		in.seekg(0);
+		if(!size || in.read((char*)data.data(), size))
+			return true;
+	}
+	return false;
+}
+
+//! Write a file, replacing it only after it has been completely written.
+bool MDS_Cache::write_file(const std::string& filename, const std::vector<uint8_t>& data) const
+{
+	std::string temp_filename = filename + stringf(".%x", (unsigned int)std::hash<std::thread::id>()(std::this_thread::get_id()));
+	{
+		std::ofstream out(temp_filename, std::ios::binary);
+		out.write((const char*)data.data(), data.size());
+		if(!out)
+			return false;
+	}
+#ifdef _WIN32
+	std::remove(filename.c_str());
+#endif
+	if(std::rename(temp_filename.c_str(), filename.c_str()))
+	{
+		std::remove(temp_filename.c_str());
+		return false;
+	}
+	return true;
+}
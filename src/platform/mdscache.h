@@ -0,0 +1,40 @@
+//! \file platform/mdscache.h
+#ifndef PLATFORM_MDSCACHE_H
+#define PLATFORM_MDSCACHE_H
+#include "../core.h"
+#include "../riff.h"
+#include <string>
+#include <vector>
+
+//! Cache for compiled MDS files.
+/*!
+ *  Compiled songs are stored in a cache directory, so that songs that
+ *  have not changed since the last time do not need to be recompiled.
+ *
+ *  Two files are stored for each song:
+ *  - A dependency list, named after the key from get_key(). This lists
+ *    the other files that were read when compiling the song, along
+ *    with a hash of their contents.
+ *  - The MDS data, named after a hash of the key and the contents of
+ *    the dependency files.
+ *
+ *  The cache files are only read and written by this class, so the
+ *  cache can be shared by multiple threads.
+ */
+class MDS_Cache
+{
+	public:
+		MDS_Cache(const std::string& path);
+
+		std::string get_key(const std::string& filename) const;
+		bool lookup(const std::string& key, RIFF& mds) const;
+		bool store(const std::string& key, const std::vector<std::string>& dependencies, const RIFF& mds) const;
+
+	private:
+		bool read_file(const std::string& filename, std::vector<uint8_t>& data) const;
+		bool write_file(const std::string& filename, const std::vector<uint8_t>& data) const;
+
+		std::string path;
+};
+
+#endif
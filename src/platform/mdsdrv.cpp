@@ -6,6 +6,7 @@
 #include <cctype>
 #include <cmath>
 #include <stack>
+#include <sstream>
 
 #include "md.h"
 #include "mdsdrv.h"
@@ -37,8 +38,53 @@ uint8_t MDSDRV_get_register(const std::string& str)
 	return 0;
 }
 
+//! Parse a platform command tag.
+/*!
+ *  The tag is formatted as in Song::register_platform_command(), with
+ *  the command name in the first item followed by the parameters.
+ */
+void MDSDRV_Platform_Command::from_tag(const Tag& tag)
+{
+	static const std::map<std::string, Type> lookup = {
+		{"mode", MODE}, {"lfo", LFO}, {"lfodelay", LFO_DELAY},
+		{"lforate", LFO_RATE}, {"fm3", FM3}, {"write", WRITE},
+		{"pcmrate", PCM_RATE}, {"pcmmode", PCM_MODE}, {"cmd", CMD}
+	};
+	type = UNKNOWN;
+	argc = 0;
+	reg = 0;
+	has_value = false;
+	relative = false;
+	arg[0] = 0;
+	arg[1] = 0;
+	if(!tag.size())
+		return;
+
+	std::string name(tag[0]);
+	std::transform(name.begin(), name.end(), name.begin(), [](uint8_t c){return std::tolower(c);});
+	auto search = lookup.find(name);
+	if(search != lookup.end())
+		type = search->second;
+	else if((reg = MDSDRV_get_register(name)))
+		type = REGISTER;
+
+	argc = std::min<size_t>(tag.size() - 1, 255);
+	for(int i = 0; i < 2 && i < argc; i++)
+	{
+		// FM3 operator mask is written in binary
+		int base = (type == FM3 && i == 0) ? 2 : 0;
+		arg[i] = std::strtol(tag[i+1].c_str(), 0, base);
+	}
+	if(argc && tag[1].size())
+	{
+		has_value = true;
+		relative = (tag[1][0] == '+' || tag[1][0] == '-');
+	}
+}
+
 MDSDRV_Data::MDSDRV_Data()
 	: data_bank()
+	, data_index()
 	, wave_rom(0x200000)
 	, envelope_map()
 	, wave_map()
@@ -58,6 +104,7 @@ void MDSDRV_Data::read_song(Song& song)
 	pitch_map.clear();
 	wave_map.clear();
 	ins_type.clear();
+	platform_command_map.clear();
 	try
 	{
 		// just do this if we have this tag
@@ -74,6 +121,7 @@ void MDSDRV_Data::read_song(Song& song)
 	for(auto it = tag_order.begin(); it != tag_order.end(); it++)
 	{
 		uint16_t id;
+		int16_t cmd_id;
 		Tag& tag = song.get_tag(*it);
 		if(std::sscanf(it->c_str(), "@%hu", &id) == 1)
 		{
@@ -84,6 +132,10 @@ void MDSDRV_Data::read_song(Song& song)
 			add_pitch_envelope(id, tag);
 			message += "read pitch envelope " + dump_data(id, pitch_map[id]) + "\n";
 		}
+		else if(std::sscanf(it->c_str(), "cmd_%hd", &cmd_id) == 1)
+		{
+			add_platform_command(cmd_id, tag);
+		}
 	}
 }
 
@@ -388,6 +440,16 @@ void MDSDRV_Data::add_pitch_envelope(uint16_t id, const Tag& tag)
 	pitch_map[id] = add_unique_data(env_data);
 }
 
+//! Add a platform command.
+/*!
+ *  \param id Command id, as returned by Song::register_platform_command().
+ *  \param tag Command tag.
+ */
+void MDSDRV_Data::add_platform_command(int16_t id, const Tag& tag)
+{
+	platform_command_map[id].from_tag(tag);
+}
+
 //! Adds a node to the pitch envelope.
 void MDSDRV_Data::add_pitch_node(const char* s, std::vector<uint8_t>* env_data)
 {
@@ -457,20 +519,17 @@ void MDSDRV_Data::add_pitch_vibrato(const char* s, std::vector<uint8_t>* env_dat
  */
 int MDSDRV_Data::add_unique_data(const std::vector<uint8_t>& data)
 {
-	unsigned int i;
 	// look for previous matching data in the data bank
-	for(i=0; i<data_bank.size(); i++)
-	{
-		if(data != data_bank[i])
-			continue;
-		return i;
-	}
-	i = data_bank.size();
+	auto search = data_index.find(data);
+	if(search != data_index.end())
+		return search->second;
+	int i = data_bank.size();
 	if(i >= data_count_max)
 	{
 		throw InputError(nullptr, "error: maximum amount of data table entries reached\n");
 	}
 	data_bank.push_back(data);
+	data_index[data] = i;
 	return i;
 }
 
@@ -590,16 +649,13 @@ void MDSDRV_Track_Writer::event_hook()
 			converted_events.push_back(MDSDRV_Event(MDSDRV_Event::SLR,0));
 			break;
 		case Event::PLATFORM:
-			try
-			{
-				const Tag& tag = mdsdrv.song->get_platform_command(event.param);
-				parse_platform_event(tag);
-			}
-			catch (std::out_of_range &)
-			{
+		{
+			auto search = mdsdrv.data.platform_command_map.find(event.param);
+			if(search == mdsdrv.data.platform_command_map.end())
 				error(stringf("MDSDRV: Platform command %d is not defined", event.param).c_str());
-			}
+			parse_platform_event(search->second);
 			break;
+		}
 		case Event::TRANSPOSE_REL:
 			converted_events.push_back(MDSDRV_Event(MDSDRV_Event::TRSM,param));
 			break;
@@ -674,104 +730,111 @@ void MDSDRV_Track_Writer::end_hook()
 		converted_events.push_back(MDSDRV_Event(MDSDRV_Event::FINISH,0));
 }
 
-void MDSDRV_Track_Writer::parse_platform_event(const Tag& tag)
+void MDSDRV_Track_Writer::parse_platform_event(const MDSDRV_Platform_Command& cmd)
 {
-	if(iequal(tag[0], "mode")) // PSG noise mode
-	{
-		if(tag.size() < 2)
-			error("not enough parameters for 'mode' command");
-		uint16_t param = std::strtol(tag[1].c_str(), 0, 0);
-		if(param == 1)
-			param = 0xe7;
-		else if(param == 2)
-			param = 0xe3;
-		else
-			param = 0x00;
-		converted_events.push_back(MDSDRV_Event(MDSDRV_Event::LFO, param));
-	}
-	else if(iequal(tag[0], "lfo")) // LFO depth
-	{
-		if(tag.size() < 3)
-			error("not enough parameters for 'lfo' command");
-		converted_events.push_back(MDSDRV_Event(MDSDRV_Event::LFO,
-					((std::strtol(tag[1].c_str(), 0, 0) << 4) | (std::strtol(tag[2].c_str(), 0, 0) & 0x3f))));
-	}
-	else if(iequal(tag[0], "lforate")) // LFO rate
-	{
-		if(tag.size() < 2)
-			error("not enough parameters for 'lforate' command");
-		uint8_t param = std::strtol(tag[1].c_str(), 0, 0);
-		if(param)
-			param += 7;
-		converted_events.push_back(MDSDRV_Event(MDSDRV_Event::FMREG, 0x2200 | param));
-	}
-	else if(iequal(tag[0], "fm3")) // FM3 mode
-	{
-		if(tag.size() < 2)
-			error("not enough parameters for 'fm3' command");
-		converted_events.push_back(MDSDRV_Event(MDSDRV_Event::FLG,
-					0x80 | ((std::strtol(tag[1].c_str(), 0, 2) ^ 0x0f) & 0x0f)));
-	}
-	else if(iequal(tag[0], "write")) // FM register write
-	{
-		if(tag.size() < 3)
-			error("not enough parameters for 'write' command");
-		uint8_t write_addr = std::strtol(tag[1].c_str(), 0, 0);
-		uint16_t write_data = (write_addr << 8) | (std::strtol(tag[2].c_str(), 0, 0) & 0xff);
-		if(write_addr >= 0x30)
-			converted_events.push_back(MDSDRV_Event(MDSDRV_Event::FMCREG, write_data));
-		else
-			converted_events.push_back(MDSDRV_Event(MDSDRV_Event::FMREG, write_data));
-	}
-	else if(iequal(tag[0], "pcmrate")) // PCM channel sample rate
-	{
-		if(tag.size() < 2)
-			error("not enough parameters for 'pcmrate' command");
-		uint8_t data = std::strtol(tag[1].c_str(), 0, 0);
-		if(data < 1 || data > 8)
-			error("pcmrate argument must be between 1 and 8");
-		converted_events.push_back(MDSDRV_Event(MDSDRV_Event::PCMRATE, data));
-	}
-	else if(iequal(tag[0], "pcmmode")) // PCM mixing mode
+	switch(cmd.type)
 	{
-		if(tag.size() < 2)
-			error("not enough parameters for 'pcmmode' command");
-		uint8_t data = std::strtol(tag[1].c_str(), 0, 0);
-		if(data < 2 || data > 3)
-			error("pcmmode argument must be between 2 and 3");
-		converted_events.push_back(MDSDRV_Event(MDSDRV_Event::PCMMODE, data));
-	}
-	else if(iequal(tag[0], "cmd")) // Direct command
-	{
-		if(tag.size() < 2)
-			error("not enough parameters for 'cmd' command");
-		MDSDRV_Event::Type type = (MDSDRV_Event::Type)std::strtol(tag[1].c_str(), 0, 0);
-		uint16_t data = 0;
-		if(tag.size() > 2)
-			data = std::strtol(tag[2].c_str(), 0, 0);
-		converted_events.push_back(MDSDRV_Event(type, data));
-	}
-	else if(MDSDRV_get_register(tag[0]))
-	{
-		if(tag.size() < 2)
-			error("not enough parameters for 'write' command");
+		case MDSDRV_Platform_Command::MODE: // PSG noise mode
+		{
+			if(cmd.argc < 1)
+				error("not enough parameters for 'mode' command");
+			uint16_t param = cmd.arg[0];
+			if(param == 1)
+				param = 0xe7;
+			else if(param == 2)
+				param = 0xe3;
+			else
+				param = 0x00;
+			converted_events.push_back(MDSDRV_Event(MDSDRV_Event::LFO, param));
+			break;
+		}
+		case MDSDRV_Platform_Command::LFO: // LFO depth
+			if(cmd.argc < 2)
+				error("not enough parameters for 'lfo' command");
+			converted_events.push_back(MDSDRV_Event(MDSDRV_Event::LFO,
+						((cmd.arg[0] << 4) | (cmd.arg[1] & 0x3f))));
+			break;
+		case MDSDRV_Platform_Command::LFO_RATE: // LFO rate
+		{
+			if(cmd.argc < 1)
+				error("not enough parameters for 'lforate' command");
+			uint8_t param = cmd.arg[0];
+			if(param)
+				param += 7;
+			converted_events.push_back(MDSDRV_Event(MDSDRV_Event::FMREG, 0x2200 | param));
+			break;
+		}
+		case MDSDRV_Platform_Command::FM3: // FM3 mode
+			if(cmd.argc < 1)
+				error("not enough parameters for 'fm3' command");
+			converted_events.push_back(MDSDRV_Event(MDSDRV_Event::FLG,
+						0x80 | ((cmd.arg[0] ^ 0x0f) & 0x0f)));
+			break;
+		case MDSDRV_Platform_Command::WRITE: // FM register write
+		{
+			if(cmd.argc < 2)
+				error("not enough parameters for 'write' command");
+			uint8_t write_addr = cmd.arg[0];
+			uint16_t write_data = (write_addr << 8) | (cmd.arg[1] & 0xff);
+			if(write_addr >= 0x30)
+				converted_events.push_back(MDSDRV_Event(MDSDRV_Event::FMCREG, write_data));
+			else
+				converted_events.push_back(MDSDRV_Event(MDSDRV_Event::FMREG, write_data));
+			break;
+		}
+		case MDSDRV_Platform_Command::PCM_RATE: // PCM channel sample rate
+		{
+			if(cmd.argc < 1)
+				error("not enough parameters for 'pcmrate' command");
+			uint8_t data = cmd.arg[0];
+			if(data < 1 || data > 8)
+				error("pcmrate argument must be between 1 and 8");
+			converted_events.push_back(MDSDRV_Event(MDSDRV_Event::PCMRATE, data));
+			break;
+		}
+		case MDSDRV_Platform_Command::PCM_MODE: // PCM mixing mode
+		{
+			if(cmd.argc < 1)
+				error("not enough parameters for 'pcmmode' command");
+			uint8_t data = cmd.arg[0];
+			if(data < 2 || data > 3)
+				error("pcmmode argument must be between 2 and 3");
+			converted_events.push_back(MDSDRV_Event(MDSDRV_Event::PCMMODE, data));
+			break;
+		}
+		case MDSDRV_Platform_Command::CMD: // Direct command
+		{
+			if(cmd.argc < 1)
+				error("not enough parameters for 'cmd' command");
+			MDSDRV_Event::Type type = (MDSDRV_Event::Type)cmd.arg[0];
+			uint16_t data = cmd.arg[1];
+			converted_events.push_back(MDSDRV_Event(type, data));
+			break;
+		}
+		case MDSDRV_Platform_Command::REGISTER:
+		{
+			if(cmd.argc < 1)
+				error("not enough parameters for 'write' command");
 
-		uint8_t reg = MDSDRV_get_register(tag[0]);
-		uint16_t data = (reg << 8) | (std::strtol(tag[1].c_str(), 0, 0) & 0xff);
+			uint8_t reg = cmd.reg;
+			uint16_t data = (reg << 8) | (cmd.arg[0] & 0xff);
 
-		if(reg > 0xfc && tag[1].size() > 0)
-		{
-			data -= 0xfc00;
-			uint8_t sign = tag[1][0];
-			if(sign == '+' || sign == '-')
-				converted_events.push_back(MDSDRV_Event(MDSDRV_Event::FMTLM, data));
+			if(reg > 0xfc && cmd.has_value)
+			{
+				data -= 0xfc00;
+				if(cmd.relative)
+					converted_events.push_back(MDSDRV_Event(MDSDRV_Event::FMTLM, data));
+				else
+					converted_events.push_back(MDSDRV_Event(MDSDRV_Event::FMTL, data));
+			}
+			else if(reg >= 0x30)
+				converted_events.push_back(MDSDRV_Event(MDSDRV_Event::FMCREG, data));
 			else
-				converted_events.push_back(MDSDRV_Event(MDSDRV_Event::FMTL, data));
+				converted_events.push_back(MDSDRV_Event(MDSDRV_Event::FMREG, data));
+			break;
 		}
-		else if(reg >= 0x30)
-			converted_events.push_back(MDSDRV_Event(MDSDRV_Event::FMCREG, data));
-		else
-			converted_events.push_back(MDSDRV_Event(MDSDRV_Event::FMREG, data));
+		default:
+			break;
 	}
 }
 
@@ -882,6 +945,15 @@ RIFF MDSDRV_Converter::get_mds()
 	return riff;
 }
 
+//! Get the files read during conversion, other than the MML file.
+/*!
+ *  This is currently the PCM sample files.
+ */
+const std::vector<std::string>& MDSDRV_Converter::get_dependencies() const
+{
+	return data.wave_rom.get_loaded_files();
+}
+
 //! uses MDSDRV_Track_Writer to convert a track into an event stream
 void MDSDRV_Converter::parse_track(int track_id)
 {
@@ -1140,9 +1212,11 @@ int MDSDRV_Converter::get_envelope(int mapped_id)
 //! Creates a MDSDRV_Linker
 MDSDRV_Linker::MDSDRV_Linker()
 	: data_bank()
+	, data_index()
 	, data_offset()
 	, seq_bank()
 	, wave_rom(0x3f8000, 0x8000)
+	, pcm_packing(false)
 {
 }
 
@@ -1154,6 +1228,7 @@ void MDSDRV_Linker::add_song(RIFF& mds, const std::string& filename)
 	std::vector<uint8_t> seq = {};
 	std::vector<uint8_t> group = {};
 	std::vector<std::pair<uint16_t,uint16_t>> patch_table;
+	std::vector<std::pair<uint16_t,unsigned int>> pcm_patch_table;
 	RIFF dblk = RIFF(0);
 	mds.rewind();
 	if(mds.get_type() != RIFF::TYPE_RIFF || mds.get_id() != FOURCC("MDS0"))
@@ -1205,6 +1280,14 @@ void MDSDRV_Linker::add_song(RIFF& mds, const std::string& filename)
 			header.position = 0;
 			uint16_t offset = wave_rom.add_sample(header, std::vector<uint8_t>(begin, end));
 
+			// Sample position is not known until pack_pcm()
+			if(pcm_packing)
+			{
+				printf("replace seq+%04x with sample %d (PCM header)\n", addr, offset);
+				pcm_patch_table.push_back({addr, offset});
+				continue;
+			}
+
 			// Get new PCM header
 			header = wave_rom.get_sample_headers().at(offset);
 			auto hdata = get_pcm_header(header);
@@ -1216,7 +1299,7 @@ void MDSDRV_Linker::add_song(RIFF& mds, const std::string& filename)
 	auto group_str = keyify_string(std::string(group.begin(), group.end()));
 	if(!group_str.size()) // set default group name
 		group_str = "BGM";
-	seq_bank[group_str].push_back({filename, seq, patch_table});
+	seq_bank[group_str].push_back({filename, seq, patch_table, pcm_patch_table});
 }
 
 std::vector<uint8_t> MDSDRV_Linker::get_pcm_header(const Wave_Bank::Sample& sample) const
@@ -1256,6 +1339,28 @@ void MDSDRV_Linker::check_version(uint8_t major, uint8_t minor)
 
 }
 
+//! Place the PCM samples and add their headers to the data bank.
+/*!
+ *  Only needed if PCM packing is enabled. Safe to call more than once.
+ */
+void MDSDRV_Linker::pack_pcm()
+{
+	wave_rom.pack();
+	auto& headers = wave_rom.get_sample_headers();
+	for(auto&& group : seq_bank)
+	{
+		for(auto&& seq : group.second)
+		{
+			for(auto&& j : seq.pcm_patch_table)
+			{
+				auto hdata = get_pcm_header(headers.at(j.second));
+				seq.patch_table.push_back({j.first, add_unique_data(hdata)});
+			}
+			seq.pcm_patch_table.clear();
+		}
+	}
+}
+
 //! Get the number of sequences
 unsigned int MDSDRV_Linker::get_seq_count() const
 {
@@ -1268,6 +1373,8 @@ unsigned int MDSDRV_Linker::get_seq_count() const
 //! Get the output mdsseq.bin
 std::vector<uint8_t> MDSDRV_Linker::get_seq_data()
 {
+	pack_pcm();
+
 	int header_size = 12 + get_seq_count() * 4;
 	auto data = std::vector<uint8_t>(header_size);
 
@@ -1337,6 +1444,7 @@ std::vector<uint8_t> MDSDRV_Linker::get_seq_data()
 //! Get the output mdspcm.bin
 std::vector<uint8_t> MDSDRV_Linker::get_pcm_data()
 {
+	pack_pcm();
 	auto wave = wave_rom.get_rom_data();
 	return std::vector<uint8_t>(wave.begin(), wave.end() - wave_rom.get_free_bytes());
 }
@@ -1344,15 +1452,47 @@ std::vector<uint8_t> MDSDRV_Linker::get_pcm_data()
 //! Get linker statistics
 std::string MDSDRV_Linker::get_statistics()
 {
+	pack_pcm();
+
 	auto str = std::string();
 	str += stringf("PCM data size: %d bytes (max %d)\n",
 		wave_rom.get_rom_data().size() - wave_rom.get_free_bytes(),
 		wave_rom.get_rom_data().size());
 	str += stringf("Gaps: %d bytes, largest %d\n",
 		wave_rom.get_total_gap(), wave_rom.get_largest_gap());
+	str += stringf("Duplicate samples: %d (%d bytes saved)\n",
+		wave_rom.get_duplicate_count(), wave_rom.get_duplicate_bytes());
+	str += stringf("Shared samples: %d (%d bytes saved)\n",
+		wave_rom.get_shared_count(), wave_rom.get_shared_bytes());
+	auto wasted = wave_rom.get_wasted_bytes();
+	for(unsigned int i = 0; i < wasted.size(); i++)
+		str += stringf("Bank %d: %d bytes wasted\n", i, wasted[i]);
 	return str;
 }
 
+//! Enable offline packing of PCM data.
+/*!
+ *  Samples are collected from all songs first, and are then placed to
+ *  use as few banks as possible. This can not be combined with partial
+ *  sharing.
+ *
+ *  \see Wave_Bank::pack()
+ */
+void MDSDRV_Linker::set_pcm_packing(bool enable)
+{
+	pcm_packing = enable;
+	wave_rom.set_deferred_packing(enable);
+}
+
+//! Enable partial sharing of PCM data between samples.
+/*!
+ *  \see Wave_Bank::set_partial_sharing()
+ */
+void MDSDRV_Linker::set_pcm_sharing(bool enable)
+{
+	wave_rom.set_partial_sharing(enable);
+}
+
 static inline const std::string asm_define(std::string key, uint16_t value)
 {
 	return key + " = " + std::to_string(value) + "\n";
@@ -1427,30 +1567,22 @@ std::string MDSDRV_Linker::unique_string(const std::string& input, MDSDRV_Linker
 //! Add unique data to the databank (same as MDSDRV_Data::add_unique_data())
 int MDSDRV_Linker::add_unique_data(const std::vector<uint8_t>& data)
 {
-	unsigned int i;
 	// look for previous matching data in the data bank
-	for(i=0; i<data_bank.size(); i++)
-	{
-		if(data != data_bank[i])
-			continue;
-		return i;
-	}
+	auto search = data_index.find(data);
+	if(search != data_index.end())
+		return search->second;
 	data_bank.push_back(data);
+	data_index[data] = data_bank.size()-1;
 	return data_bank.size()-1;
 }
 
 //! Find unique data in the databank. Throws out_of_range if not found.
 int MDSDRV_Linker::find_unique_data(const std::vector<uint8_t>& data) const
 {
-	unsigned int i;
-	// look for previous matching data in the data bank
-	for(i=0; i<data_bank.size(); i++)
-	{
-		if(data != data_bank[i])
-			continue;
-		return i;
-	}
-	throw std::out_of_range("MDSDRV_Linker::find_unique_data");
+	auto search = data_index.find(data);
+	if(search == data_index.end())
+		throw std::out_of_range("MDSDRV_Linker::find_unique_data");
+	return search->second;
 }
 
 //=====================================================================
@@ -1467,7 +1599,7 @@ std::shared_ptr<Driver> MDSDRV_Platform::get_driver(unsigned int rate, VGM_Inter
 
 const Platform::Format_List& MDSDRV_Platform::get_export_formats() const
 {
-	static const Platform::Format_List out = {{"vgm", "VGM"}, {"mds", "MDS song data"}};
+	static const Platform::Format_List out = {{"vgm", "VGM"}, {"mds", "MDS song data"}, {"wav", "WAV"}};
 	return out;
 }
 
@@ -1482,6 +1614,13 @@ std::vector<uint8_t> MDSDRV_Platform::get_export_data(Song& song, int format) co
 		MDSDRV_Converter converter(song);
 		return converter.get_mds().to_bytes();
 	}
+	else if(format == 2)
+	{
+		std::stringstream stream;
+		write_wav(song, stream);
+		std::string bytes = stream.str();
+		return std::vector<uint8_t>(bytes.begin(), bytes.end());
+	}
 	else
 	{
 		throw std::logic_error("no such exporter");
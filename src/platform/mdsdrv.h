@@ -14,6 +14,7 @@
 #include <memory>
 
 class MDSDRV_Data;
+struct MDSDRV_Platform_Command;
 struct MDSDRV_Event;
 class MDSDRV_Track_Writer;
 class MDSDRV_Converter;
@@ -34,6 +35,48 @@ class MDSDRV_Platform;
 //! helper functions for MDSDRV
 uint8_t MDSDRV_get_register(const std::string& str);
 
+//! Pre-parsed platform command.
+/*!
+ *  Platform commands are stored as tags by the MML parser (see
+ *  Song::register_platform_command()). MDSDRV_Data::read_song() parses
+ *  them once into this form so that the players can dispatch on the
+ *  command type instead of comparing strings at every event.
+ *
+ *  Parameter checking is left to the players, so that errors are
+ *  reported with a reference to the event that used the command.
+ */
+struct MDSDRV_Platform_Command
+{
+	enum Type {
+		UNKNOWN = 0,	// unknown or empty command, ignored
+		MODE,		// PSG noise mode
+		LFO,		// LFO depth
+		LFO_DELAY,	// LFO delay
+		LFO_RATE,	// LFO rate
+		FM3,		// FM3 special mode
+		WRITE,		// FM register write
+		PCM_RATE,	// PCM channel sample rate
+		PCM_MODE,	// PCM mixing mode
+		CMD,		// direct sequence command
+		REGISTER	// named FM register write (see MDSDRV_get_register())
+	};
+
+	Type type;
+	//! Number of parameters, not including the command name.
+	uint8_t argc;
+	//! Register address (REGISTER only)
+	uint8_t reg;
+	//! Set if the first parameter is not blank.
+	bool has_value;
+	//! Set if the first parameter has a '+' or '-' prefix.
+	bool relative;
+	//! Numeric parameters. Missing parameters are set to 0.
+	long arg[2];
+
+	// aggregate type - no constructor
+	void from_tag(const Tag& tag);
+};
+
 //! MDSDRV data bank
 class MDSDRV_Data
 {
@@ -61,6 +104,7 @@ class MDSDRV_Data
 		void read_song(Song& song);
 		void add_instrument(uint16_t id, const Tag& tag);
 		void add_pitch_envelope(uint16_t id, const Tag& tag);
+		void add_platform_command(int16_t id, const Tag& tag);
 
 	private:
 		static const int data_count_max = 256;
@@ -78,6 +122,8 @@ class MDSDRV_Data
 
 		//! Data bank, holds all instrument and envelope data
 		std::vector<std::vector<uint8_t>> data_bank;
+		//! Maps data_bank contents to their index, for duplicate lookup.
+		std::map<std::vector<uint8_t>, int> data_index;
 		//! Waverom bank, holds PCM samples.
 		Wave_Bank wave_rom;
 		//! Maps the current song instruments to data_bank entries.
@@ -90,6 +136,8 @@ class MDSDRV_Data
 		std::map<uint16_t, int> pitch_map;
 		//! Specify the instrument types of the defined song instruments.
 		std::map<uint16_t, InstrumentType> ins_type;
+		//! Maps the platform command IDs to the parsed commands.
+		std::map<int16_t, MDSDRV_Platform_Command> platform_command_map;
 		//! Diagnostic message
 		std::string message;
 };
@@ -159,7 +207,7 @@ class MDSDRV_Track_Writer : public Basic_Player
 		bool loop_hook() override;
 		void end_hook() override;
 
-		void parse_platform_event(const Tag& tag);
+		void parse_platform_event(const MDSDRV_Platform_Command& cmd);
 		uint8_t bpm_to_delta(uint16_t bpm);
 
 		MDSDRV_Converter& mdsdrv;
@@ -179,6 +227,7 @@ class MDSDRV_Converter
 		MDSDRV_Converter(Song& song);
 
 		RIFF get_mds();
+		const std::vector<std::string>& get_dependencies() const;
 
 	private:
 		void parse_track(int track_id);
@@ -203,11 +252,14 @@ class MDSDRV_Converter
 //! MDSDRV data linker
 class MDSDRV_Linker
 {
+	friend class MDSDRV_Linker_Test;
 	typedef std::map<std::string, int> String_Counter;
 	struct Seq_Data {
 		std::string filename;
 		std::vector<uint8_t> data;
 		std::vector<std::pair<uint16_t,uint16_t>> patch_table;
+		//! PCM header patches waiting for pack_pcm(). Maps to a sample ID.
+		std::vector<std::pair<uint16_t,unsigned int>> pcm_patch_table;
 	};
 
 	public:
@@ -219,6 +271,8 @@ class MDSDRV_Linker
 		std::vector<uint8_t> get_seq_data();
 		std::vector<uint8_t> get_pcm_data();
 		std::string get_statistics();
+		void set_pcm_sharing(bool enable);
+		void set_pcm_packing(bool enable);
 
 		std::string get_asm_header() const;
 		std::string get_c_header() const;
@@ -228,14 +282,17 @@ class MDSDRV_Linker
 		int find_unique_data(const std::vector<uint8_t>& data) const;
 		std::vector<uint8_t> get_pcm_header(const Wave_Bank::Sample& sample) const;
 		void check_version(uint8_t major, uint8_t minor);
+		void pack_pcm();
 
 		std::string keyify_string(const std::string& input) const;
 		std::string unique_string(const std::string& input, String_Counter& map) const;
 
 		std::vector<std::vector<uint8_t>> data_bank;
+		std::map<std::vector<uint8_t>, int> data_index;
 		std::vector<int> data_offset;
 		std::map<std::string, std::vector<Seq_Data>> seq_bank;
 		Wave_Bank wave_rom;
+		bool pcm_packing;
 };
 
 class MDSDRV_Platform : public Platform
@@ -2,10 +2,14 @@
 #include "../input.h"
 #include "../mml_input.h"
 #include "../stringf.h"
+#include "../parallel.h"
 #include "mdsdrv.h"
+#include "mdscache.h"
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <exception>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -20,6 +24,11 @@ void print_usage(const char* exename)
 	std::cout << "\t-o <mdsseq.bin> <mdsbin.bin> : Specify output filenames\n";
 	std::cout << "\t-i <mdsseq.inc>              : Specify ASM headers\n";
 	std::cout << "\t-h <mdsseq.h>                : Specify C headers\n";
+	std::cout << "\t-s                          : Share PCM data between overlapping samples\n";
+	std::cout << "\t                              (slower when there are many samples)\n";
+	std::cout << "\t-p                          : Pack PCM data after all songs are added\n";
+	std::cout << "\t-j <count>                  : Compile songs using multiple threads\n";
+	std::cout << "\t-c <directory>              : Reuse unchanged songs from a cache directory\n";
 	std::cout << "Note:\n";
 	std::cout << "\tInput files can be in .mml or .mds format\n\n";
 	std::cout << "MDSDRV version " << MDSDRV_SEQ_VERSION_MAJOR << "." << MDSDRV_SEQ_VERSION_MINOR << " ";
@@ -52,7 +61,7 @@ std::string get_filename(const std::string& input_filename)
 		return input_filename.substr(0, epos);
 }
 
-Song convert_file(const char* filename)
+Song convert_file(const char* filename, std::ostream& log)
 {
 	Song song;
 	MML_Input input = MML_Input(&song);
@@ -60,14 +69,57 @@ Song convert_file(const char* filename)
 	auto validator = Song_Validator(song);
 	for(auto it = validator.get_track_map().begin(); it != validator.get_track_map().end(); it++)
 	{
-		std::cout << stringf("Track%3d:%7d", it->first, it->second.get_play_time());
+		log << stringf("Track%3d:%7d", it->first, it->second.get_play_time());
 		if(auto length = it->second.get_loop_length())
-			std::cout << stringf(" (loop %7d)", length);
-		std::cout << "\n";
+			log << stringf(" (loop %7d)", length);
+		log << "\n";
 	}
 	return song;
 }
 
+// read a .mds file or compile a .mml file
+RIFF load_file(const std::string& filename, std::ostream& log, const MDS_Cache* cache)
+{
+	auto extension = get_extension(filename);
+	if(iequal(extension, ".mds"))
+	{
+		if (std::ifstream in{filename, std::ios::binary | std::ios::ate})
+		{
+			auto size = in.tellg();
+			auto data = std::vector<uint8_t>(size, 0);
+			in.seekg(0);
+			if(in.read((char*)&data[0], size))
+				return RIFF(data);
+			else
+				throw InputError(nullptr, stringf("Couldn't read %s", filename.c_str()).c_str());
+		}
+		else
+		{
+			throw InputError(nullptr, stringf("Couldn't open %s", filename.c_str()).c_str());
+		}
+	}
+	else
+	{
+		std::string key;
+		if(cache)
+		{
+			RIFF mds = RIFF(0);
+			key = cache->get_key(filename);
+			if(cache->lookup(key, mds))
+			{
+				log << "Using cached data\n";
+				return mds;
+			}
+		}
+		auto song = convert_file(filename.c_str(), log);
+		auto converter = MDSDRV_Converter(song);
+		auto mds = converter.get_mds();
+		if(cache && !cache->store(key, converter.get_dependencies(), mds))
+			log << "Warning: Couldn't write cache data\n";
+		return mds;
+	}
+}
+
 int main(int argc, char* argv[])
 {
 	auto input = std::vector<std::string>();
@@ -75,6 +127,10 @@ int main(int argc, char* argv[])
 	std::string pcm_filename = "mdspcm.bin";
 	std::string c_header_filename = "";
 	std::string asm_header_filename = "";
+	bool pcm_sharing = false;
+	bool pcm_packing = false;
+	unsigned int jobs = 1;
+	std::string cache_path = "";
 
 	for(int arg = 1; arg < argc; arg++)
 	{
@@ -87,6 +143,14 @@ int main(int argc, char* argv[])
 			c_header_filename = argv[++arg];
 		else if((!strcmp(argv[arg], "-i") || !strcmp(argv[arg], "--asm-header")) && arg < argc)
 			asm_header_filename = argv[++arg];
+		else if(!strcmp(argv[arg], "-s") || !strcmp(argv[arg], "--share-pcm"))
+			pcm_sharing = true;
+		else if(!strcmp(argv[arg], "-p") || !strcmp(argv[arg], "--pack-pcm"))
+			pcm_packing = true;
+		else if((!strcmp(argv[arg], "-j") || !strcmp(argv[arg], "--jobs")) && (arg+1) < argc)
+			jobs = strtol(argv[++arg], NULL, 0);
+		else if((!strcmp(argv[arg], "-c") || !strcmp(argv[arg], "--cache")) && (arg+1) < argc)
+			cache_path = argv[++arg];
 		else
 			input.push_back(argv[arg]);
 	}
@@ -101,40 +165,47 @@ int main(int argc, char* argv[])
 	try
 	{
 		auto linker = MDSDRV_Linker();
-		for(auto it = input.begin(); it != input.end(); it++)
+		linker.set_pcm_sharing(pcm_sharing);
+		linker.set_pcm_packing(pcm_packing);
+
+		std::unique_ptr<MDS_Cache> cache;
+		if(cache_path.size())
+			cache.reset(new MDS_Cache(cache_path));
+
+		// compile songs in parallel
+		auto mds = std::vector<RIFF>(input.size(), RIFF(0));
+		auto logs = std::vector<std::ostringstream>(input.size());
+		auto errors = std::vector<std::exception_ptr>(input.size());
+		if(jobs > 1)
 		{
-			auto extension = get_extension(it->c_str());
-			RIFF mds = RIFF(0);
-			printf("[%ld/%ld] %s\n", 1+it-input.begin(), input.size(), it->c_str());
-			if(iequal(extension, ".mds"))
-			{
-				if (std::ifstream in{*it, std::ios::binary | std::ios::ate})
+			parallel_for(input.size(), [&](unsigned int i) {
+				try
 				{
-					auto size = in.tellg();
-					auto data = std::vector<uint8_t>(size, 0);
-					in.seekg(0);
-					if(in.read((char*)&data[0], size))
-					{
-						mds = RIFF(data);
-					}
-					else
-					{
-						throw InputError(nullptr, stringf("Couldn't read %s", it->c_str()).c_str());
-					}
+					mds[i] = load_file(input[i], logs[i], cache.get());
 				}
-				else
+				catch(InputError&)
 				{
-					throw InputError(nullptr, stringf("Couldn't open %s", it->c_str()).c_str());
+					errors[i] = std::current_exception();
 				}
+			}, jobs);
+		}
+
+		// link songs in input order
+		for(unsigned int i = 0; i < input.size(); i++)
+		{
+			printf("[%d/%d] %s\n", i+1, (int)input.size(), input[i].c_str());
+			if(jobs > 1)
+			{
+				std::cout << logs[i].str() << std::flush;
+				if(errors[i])
+					std::rethrow_exception(errors[i]);
 			}
 			else
 			{
-				auto song = convert_file(it->c_str());
-				auto converter = MDSDRV_Converter(song);
-				mds = converter.get_mds();
+				mds[i] = load_file(input[i], std::cout, cache.get());
 			}
 			// pass to linker
-			linker.add_song(mds, get_filename(*it));
+			linker.add_song(mds[i], get_filename(input[i]));
 		}
 		if(seq_filename.size())
 		{
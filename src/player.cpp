@@ -7,6 +7,7 @@
 #include "song.h"
 #include "track.h"
 #include "stringf.h"
+#include "parallel.h"
 
 //! Creates a Basic_Player.
 /*!
@@ -14,7 +15,9 @@
  *  \param[in,out] track reference to a Track.
  */
 Basic_Player::Basic_Player(Song& song, Track& track)
-	: play_time(0)
+	: reference_track(nullptr)
+	, reference_position(0)
+	, play_time(0)
 	, on_time(0)
 	, off_time(0)
 	, song(&song)
@@ -27,7 +30,7 @@ Basic_Player::Basic_Player(Song& song, Track& track)
 	, loop_reset_count(0)
 	, stack()
 	, stack_depth()
-	, max_stack_depth(10)
+	, max_stack_depth(DEFAULT_MAX_STACK_DEPTH)
 	, loop_begin_depth(0)
 {
 }
@@ -53,25 +56,22 @@ void Basic_Player::step_event()
 	off_time = 0;
 	if(position == loop_reset_position)
 		loop_reset_count = loop_count;
-	try
+	if((unsigned long)position < track->get_event_count())
 	{
 		// Read the next event
-		track_event = &track->get_event(position++);
-		// Set the event time
-		if(track_event->play_time > play_time)
-			track_event->play_time = play_time;
-		event = *track_event;
+		event = track->get_event(position);
+		reference_track = track;
+		reference_position = position++;
 	}
-	catch(std::out_of_range&)
+	else
 	{
 		// reached the end
-		event = {Event::END, 0, 0, 0, UINT_MAX, reference};
-		track_event = nullptr;
+		event = {Event::END, 0, 0, 0, UINT_MAX};
+		position++;
 	}
 	// Set new on/off time
 	on_time = event.on_time;
 	off_time = event.off_time;
-	reference = event.reference;
 	// Handle events
 	switch(event.type)
 	{
@@ -83,8 +83,6 @@ void Basic_Player::step_event()
 		case Event::LOOP_BREAK:
 			// verify
 			stack_top(Player_Stack::LOOP);
-			// set param to end position to help with conversion
-			track_event->param = stack.top().end_position;
 			// Break if at the final loop iteration
 			if(stack.top().loop_count == 1)
 			{
@@ -120,18 +118,17 @@ void Basic_Player::step_event()
 			event_hook();
 			break;
 		case Event::JUMP:
-			try
+			if(Track* new_track = song->find_track(event.param))
 			{
-				Track& new_track = song->get_track(event.param);
 				// Event hook should be sent before pushing the stack
 				event_hook();
 				// Push old position
 				stack_push({Player_Stack::JUMP, track, position, 0, 0});
 				// Set new position
-				track = &new_track;
+				track = new_track;
 				position = 0;
 			}
-			catch(std::exception& ex)
+			else
 			{
 				error("jump destination doesn't exist");
 			}
@@ -245,14 +242,14 @@ const Event& Basic_Player::get_event() const
 std::vector<std::shared_ptr<InputRef>> Basic_Player::get_references()
 {
 	std::vector<std::shared_ptr<InputRef>> reflist;
-	reflist.push_back(track->get_events().at(position-1).reference);
+	reflist.push_back(track->get_reference(position-1));
 
 	std::stack<Player_Stack> copy_stack = stack;
 	while(!copy_stack.empty())
 	{
 		auto frame = copy_stack.top();
 		if(frame.type != Player_Stack::LOOP)
-			reflist.push_back(frame.track->get_events().at(frame.position-1).reference);
+			reflist.push_back(frame.track->get_reference(frame.position-1));
 		copy_stack.pop();
 	}
 	return reflist;
@@ -344,7 +341,15 @@ unsigned int Basic_Player::get_stack_depth(Player_Stack::Type type)
  */
 void Basic_Player::error(const char* message) const
 {
-	throw InputError(reference, message);
+	throw InputError(get_reference(), message);
+}
+
+//! Get the input reference of the last read event.
+std::shared_ptr<InputRef> Basic_Player::get_reference() const
+{
+	if(!reference_track)
+		return nullptr;
+	return reference_track->get_reference(reference_position);
 }
 
 
@@ -397,44 +402,48 @@ Player::~Player()
 /*!
  *  \param ticks Number of ticks to skip, counting from the current
  *               position.
+ *  \param read_next If true, events starting at the end position are
+ *               read and passed to write_event(). If false, they are
+ *               left unread, so that a following call to skip_ticks()
+ *               gives the same result as skipping both durations at once.
  */
-void Player::skip_ticks(unsigned int ticks)
+void Player::skip_ticks(unsigned int ticks, bool read_next)
 {
-	if(!is_enabled())
+	if(!is_enabled() || !ticks)
 	{
 		play_time += ticks;
 		return;
 	}
 	skip_flag = true;
-	while(ticks && is_enabled())
+	while(is_enabled())
 	{
-		if(on_time)
+		if(!on_time && !off_time)
 		{
-			if(on_time > ticks)
+			if(!ticks)
 			{
-				on_time -= ticks;
-				break;
+				if(!read_next)
+					break;
+				skip_flag = false;
 			}
-			play_time += on_time;
-			ticks -= on_time;
-			on_time = 0;
+			step_event();
 		}
-		else if(off_time)
+		else if(!ticks)
 		{
-			if(off_time > ticks)
-			{
-				off_time -= ticks;
-				break;
-			}
-			play_time += off_time;
-			ticks -= off_time;
-			off_time = 0;
+			break;
 		}
-		while (!on_time && !off_time && is_enabled())
+		else if(on_time)
 		{
-			if(ticks == 0)
-				skip_flag = false;
-			step_event();
+			unsigned int count = std::min(on_time, ticks);
+			play_time += count;
+			ticks -= count;
+			on_time -= count;
+		}
+		else
+		{
+			unsigned int count = std::min(off_time, ticks);
+			play_time += count;
+			ticks -= count;
+			off_time -= count;
 		}
 	}
 	play_time += ticks;
@@ -460,7 +469,7 @@ void Player::play_tick()
 		// key off
 		if(!on_time && off_time)
 		{
-			event = {Event::REST, 0, 0, 0, UINT_MAX, reference};
+			event = {Event::REST, 0, 0, 0, UINT_MAX};
 			write_event();
 		}
 	}
@@ -475,6 +484,22 @@ void Player::play_tick()
 	}
 }
 
+//! Get the number of ticks that can be played without reading an Event.
+/*!
+ *  During this time, play_tick() only decrements the remaining
+ *  duration of the current event and write_event() is not called.
+ *  The same number of ticks can therefore be skipped at once using
+ *  skip_ticks().
+ */
+unsigned int Player::get_idle_ticks() const
+{
+	if(on_time)
+		return on_time - 1;
+	else if(off_time)
+		return off_time - 1;
+	return 0;
+}
+
 //! Return the coarse volume flag.
 /*!
  *  The coarse volume flag determines the scaling of the event variable
@@ -614,6 +639,36 @@ void Player::clear_update_flag(Event::Type type)
 	FLAG_CLR(type);
 }
 
+//! Platform command dispatcher.
+/*!
+ *  Called for every Event::PLATFORM. The default implementation looks
+ *  up the Tag registered with Song::register_platform_command() and
+ *  passes it to parse_platform_event().
+ *
+ *  Platforms that have already parsed the commands in advance can
+ *  override this function to avoid the tag lookup.
+ *
+ *  \param[in] id Platform command id (the event parameter).
+ *  \param[in,out] platform_state Pointer to the internal platform
+ *                 command state array.
+ *  \return Bitmask of the modified platform state variables. See
+ *          parse_platform_event().
+ *  \exception InputError if the command is not defined.
+ */
+uint32_t Player::parse_platform_command(int16_t id, int16_t* platform_state)
+{
+	try
+	{
+		const Tag& tag = song->get_platform_command(id);
+		return parse_platform_event(tag, platform_state);
+	}
+	catch (std::out_of_range &)
+	{
+		error(stringf("Platform command %d is not defined", id).c_str());
+	}
+	return 0;
+}
+
 //! Custom platform event parser.
 /*!
  *  The override function should modify the \p platform_state as appropriate
@@ -711,15 +766,7 @@ void Player::handle_event()
 				handle_drum_mode();
 			break;
 		case Event::PLATFORM:
-			try
-			{
-				const Tag& tag = song->get_platform_command(event.param);
-				platform_update_mask |= parse_platform_event(tag, platform_state);
-			}
-			catch (std::out_of_range &)
-			{
-				error(stringf("Platform command %d is not defined", event.param).c_str());
-			}
+			platform_update_mask |= parse_platform_command(event.param, platform_state);
 			break;
 		case Event::TRANSPOSE_REL:
 			CH_STATE(Event::TRANSPOSE) += event.param;
@@ -772,7 +819,7 @@ bool Player::loop_hook()
 
 void Player::end_hook()
 {
-	event = {Event::END, 0, 0, 0, UINT_MAX, reference};
+	event = {Event::END, 0, 0, 0, UINT_MAX};
 	write_event();
 }
 
@@ -790,6 +837,14 @@ Track_Validator::Track_Validator(Song& song, Track& track)
 		step_event();
 }
 
+//! Creates a Track_Validator with a precalculated play time and loop length.
+Track_Validator::Track_Validator(Song& song, Track& track, unsigned int play_time, unsigned int loop_time)
+	: Basic_Player(song, track), segno_time(-1), loop_time(loop_time)
+{
+	this->play_time = play_time;
+	disable();
+}
+
 //! Gets the length of the loop section
 /*!
  *  The loop section strats from the position of the Event::SEGNO to
@@ -826,15 +881,206 @@ void Track_Validator::end_hook()
 
 //! Creates a Song_Validator.
 /*!
+ *  \param paranoid If set, also play each track with Track_Validator
+ *                  and check that the results are the same.
  *  \exception InputError if any validation errors occur.
  *             These should be displayed to the user.
+ *  \exception std::logic_error if the results do not match in
+ *             paranoid mode.
  */
-Song_Validator::Song_Validator(Song& song)
+Song_Validator::Song_Validator(Song& song, bool paranoid)
 {
+	// Tracks are only modified by the analysis, so it is done first.
+	std::vector<std::pair<uint16_t,Track*>> tracks;
 	for(auto it = song.get_track_map().begin(); it != song.get_track_map().end(); it++)
 	{
-		track_map.insert(std::make_pair(it->first, Track_Validator(song, it->second)));
+		analyze_track(song, it->first);
+		tracks.push_back(std::make_pair(it->first, &it->second));
+	}
+
+	// Then the tracks are validated in parallel.
+	std::vector<std::unique_ptr<Track_Validator>> validators(tracks.size());
+	parallel_for(tracks.size(), [&](unsigned int i) {
+		validators[i] = validate_track(song, tracks[i].first, *tracks[i].second, paranoid);
+	});
+	for(unsigned int i = 0; i < tracks.size(); i++)
+		track_map.insert(std::make_pair(tracks[i].first, *validators[i]));
+}
+
+//! Create the Track_Validator for a track.
+/*!
+ *  The results from analyze_track() are used if the track is valid,
+ *  otherwise the track is played in order to report the error.
+ *
+ *  Only reads from the Song, so this can be called from multiple
+ *  threads.
+ */
+std::unique_ptr<Track_Validator> Song_Validator::validate_track(Song& song, uint16_t id, Track& track, bool paranoid) const
+{
+	auto& info = info_map.at(id);
+	if(info.state != Track_Info::VALID)
+		return std::unique_ptr<Track_Validator>(new Track_Validator(song, track));
+
+	unsigned int loop_time = 0;
+	if(info.has_segno && (int)info.segno_time >= 0)
+		loop_time = info.play_time - info.segno_time;
+	auto validator = std::unique_ptr<Track_Validator>(new Track_Validator(song, track, info.play_time, loop_time));
+	if(paranoid)
+	{
+		auto check = Track_Validator(song, track);
+		if(check.get_play_time() != validator->get_play_time() || check.get_loop_length() != validator->get_loop_length())
+			throw std::logic_error(stringf("Song_Validator: track %d length %d (loop %d), expected %d (loop %d)",
+				id, validator->get_play_time(), validator->get_loop_length(),
+				check.get_play_time(), check.get_loop_length()));
 	}
+	return validator;
+}
+
+//! Calculate the play time of a track.
+/*!
+ *  The loop body is multiplied by the loop count, taking the loop
+ *  break into account. Subroutines are only analyzed once.
+ *
+ *  Also sets Event::play_time of the events in the track, using the
+ *  time relative to the start of the track, and the parameter of
+ *  Event::LOOP_BREAK to the position after the loop end.
+ *
+ *  \return false if the track or any subroutine is not valid.
+ */
+bool Song_Validator::analyze_track(Song& song, uint16_t id)
+{
+	Track_Info& info = info_map[id];
+	if(info.state != Track_Info::UNKNOWN)
+		return info.state == Track_Info::VALID; // BUSY means a recursive jump
+	info.state = Track_Info::BUSY;
+
+	struct Loop
+	{
+		unsigned int start_time;
+		bool has_break;
+		unsigned int break_time;
+		bool has_segno_before_break;
+		unsigned int segno_before_break;
+		bool has_segno_after_break;
+		unsigned int segno_after_break;
+		std::vector<Event*> break_events;
+	};
+	std::vector<Loop> loops;
+	unsigned int time = 0;
+	bool has_segno = false;
+	unsigned int segno_time = 0;
+	unsigned int stack_depth = 0;
+	bool valid = true;
+
+	// Record the last segno time in the current loop or track.
+	auto set_segno = [&](unsigned int segno) {
+		if(!loops.size())
+		{
+			has_segno = true;
+			segno_time = segno;
+		}
+		else if(!loops.back().has_break)
+		{
+			loops.back().has_segno_before_break = true;
+			loops.back().segno_before_break = segno;
+		}
+		else
+		{
+			loops.back().has_segno_after_break = true;
+			loops.back().segno_after_break = segno;
+		}
+	};
+
+	Track& track = *song.find_track(id);
+	unsigned long count = track.get_event_count();
+	for(unsigned long i = 0; valid && i < count; i++)
+	{
+		Event& event = track.get_event(i);
+		if(event.play_time > time)
+			event.play_time = time;
+		if(event.type == Event::END)
+			break;
+		if(event.type == Event::SEGNO)
+			set_segno(time);
+		time += event.on_time + event.off_time;
+
+		switch(event.type)
+		{
+			case Event::LOOP_START:
+				loops.push_back({time, false, 0, false, 0, false, 0});
+				stack_depth = std::max<unsigned int>(stack_depth, loops.size());
+				break;
+			case Event::LOOP_BREAK:
+				if(!loops.size())
+					valid = false;
+				else
+				{
+					loops.back().break_events.push_back(&event);
+					if(!loops.back().has_break)
+					{
+						loops.back().has_break = true;
+						loops.back().break_time = time - loops.back().start_time;
+					}
+				}
+				break;
+			case Event::LOOP_END:
+				if(!loops.size() || event.param < 0)
+				{
+					valid = false;
+				}
+				else
+				{
+					Loop loop = loops.back();
+					loops.pop_back();
+					for(auto&& break_event : loop.break_events)
+						break_event->param = i + 1;
+					unsigned int body = time - loop.start_time;
+					unsigned int loop_count = event.param;
+					if(loop_count > 1)
+					{
+						// The final iteration ends at the loop break
+						time = loop.start_time + (loop_count - 1) * body;
+						time += loop.has_break ? loop.break_time : body;
+						if(loop.has_segno_before_break)
+							set_segno(loop.segno_before_break + (loop_count - 1) * body);
+						else if(loop.has_segno_after_break)
+							set_segno(loop.segno_after_break + (loop_count - 2) * body);
+					}
+					else if(loop.has_segno_after_break)
+						set_segno(loop.segno_after_break);
+					else if(loop.has_segno_before_break)
+						set_segno(loop.segno_before_break);
+				}
+				break;
+			case Event::JUMP:
+				if(!song.find_track(event.param) || !analyze_track(song, event.param))
+				{
+					valid = false;
+				}
+				else
+				{
+					Track_Info& sub = info_map[event.param];
+					stack_depth = std::max<unsigned int>(stack_depth, loops.size() + 1 + sub.stack_depth);
+					if(sub.has_segno)
+						set_segno(time + sub.segno_time);
+					time += sub.play_time;
+				}
+				break;
+			default:
+				break;
+		}
+	}
+	if(loops.size() || stack_depth > Basic_Player::DEFAULT_MAX_STACK_DEPTH)
+		valid = false;
+
+	// info_map may have been modified by recursive calls
+	Track_Info& result = info_map[id];
+	result.state = valid ? Track_Info::VALID : Track_Info::INVALID;
+	result.play_time = time;
+	result.has_segno = has_segno;
+	result.segno_time = segno_time;
+	result.stack_depth = stack_depth;
+	return valid;
 }
 
 //! Gets a reference to the Track_Validator map.
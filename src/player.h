@@ -56,6 +56,9 @@ class Basic_Player
 	friend class Player_Test;
 
 	public:
+		//! Default maximum stack depth.
+		static const unsigned int DEFAULT_MAX_STACK_DEPTH = 10;
+
 		Basic_Player(Song& song, Track& track);
 		virtual ~Basic_Player();
 
@@ -80,6 +83,7 @@ class Basic_Player
 		unsigned int get_stack_depth(Player_Stack::Type type);
 
 		void error(const char* message) const;
+		std::shared_ptr<InputRef> get_reference() const;
 
 		//! Called at every event.
 		virtual void event_hook() = 0;
@@ -90,10 +94,10 @@ class Basic_Player
 
 		//! Current event.
 		Event event;
-		//! Pointer to current event in the track.
-		Event *track_event;
-		//! Current reference
-		std::shared_ptr<InputRef> reference;
+		//! Track of the last read event, used to look up the input reference.
+		Track* reference_track;
+		//! Position of the last read event.
+		int reference_position;
 		//! Playing time
 		unsigned int play_time;
 		//! Keyon time from current event
@@ -150,8 +154,9 @@ class Player : public Basic_Player
 		Player(Song& song, Track& track);
 		virtual ~Player();
 
-		void skip_ticks(unsigned int ticks);
+		void skip_ticks(unsigned int ticks, bool read_next = true);
 		void play_tick();
+		unsigned int get_idle_ticks() const;
 
 		bool coarse_volume_flag() const;
 		bool bpm_flag() const;
@@ -166,6 +171,7 @@ class Player : public Basic_Player
 		void clear_platform_flag(unsigned int type);
 		bool get_update_flag(Event::Type type) const;
 		void clear_update_flag(Event::Type type);
+		virtual uint32_t parse_platform_command(int16_t id, int16_t* platform_state);
 		virtual uint32_t parse_platform_event(const Tag& tag, int16_t* platform_state);
 		virtual void write_event();
 
@@ -194,12 +200,15 @@ class Player : public Basic_Player
  */
 class Track_Validator : public Basic_Player
 {
+	friend class Song_Validator;
 	public:
 		Track_Validator(Song& song, Track& track);
 
 		unsigned int get_loop_length() const;
 
 	private:
+		Track_Validator(Song& song, Track& track, unsigned int play_time, unsigned int loop_time);
+
 		void event_hook() override;
 		bool loop_hook() override;
 		void end_hook() override;
@@ -210,17 +219,50 @@ class Track_Validator : public Basic_Player
 
 //! Song validator
 /*!
- *  Validates all tracks in a song using Track_Validator.
+ *  Validates all tracks in a song.
+ *
+ *  The play time and loop length of each track are calculated without
+ *  playing the tracks. Loops are not expanded and each track is only
+ *  analyzed once, so the time needed is linear to the number of
+ *  events in the song. If an error is found, the track is played with
+ *  Track_Validator in order to report the error.
+ *
+ *  The tracks are validated in parallel using parallel_for(). Errors
+ *  are reported in the same order as if the tracks were validated one
+ *  after another.
  */
 class Song_Validator
 {
 	public:
-		Song_Validator(Song& song);
+		Song_Validator(Song& song, bool paranoid = false);
 
 		const std::map<uint16_t,Track_Validator>& get_track_map() const;
 
 	private:
+		//! Summary of a track, calculated by analyze_track().
+		struct Track_Info
+		{
+			enum State {
+				UNKNOWN = 0,
+				BUSY,
+				VALID,
+				INVALID
+			} state;
+			//! Play time of the track, including subroutines.
+			unsigned int play_time;
+			//! Set if the track contains an Event::SEGNO.
+			bool has_segno;
+			//! Time of the last Event::SEGNO.
+			unsigned int segno_time;
+			//! Maximum number of stack frames used by the track.
+			unsigned int stack_depth;
+		};
+
+		bool analyze_track(Song& song, uint16_t id);
+		std::unique_ptr<Track_Validator> validate_track(Song& song, uint16_t id, Track& track, bool paranoid) const;
+
 		std::map<uint16_t,Track_Validator> track_map;
+		std::map<uint16_t,Track_Info> info_map;
 };
 
 #endif
@@ -3,8 +3,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdexcept>
+#include <ostream>
 #include "song.h"
 #include "vgm.h"
+#include "wave_renderer.h"
 #include "driver.h"
 #include "track.h"
 #include "stringf.h"
@@ -27,6 +29,17 @@ Song::~Song()
 		delete platform;
 }
 
+//! Remove all tracks, tags and platform commands.
+/*!
+ *  The platform and PPQN setting are kept.
+ */
+void Song::clear()
+{
+	tag_map.clear();
+	track_map.clear();
+	platform_command_index = -32768;
+}
+
 //! Get a reference to the tag map.
 Tag_Map& Song::get_tag_map()
 {
@@ -263,6 +276,18 @@ Track& Song::get_track(uint16_t id)
 	return track_map.at(id);
 }
 
+//! Get a pointer to the track with the specified id.
+/*!
+ *  Returns nullptr if not found.
+ */
+Track* Song::find_track(uint16_t id)
+{
+	auto it = track_map.find(id);
+	if(it == track_map.end())
+		return nullptr;
+	return &it->second;
+}
+
 //! Get a reference to the track with the specified id.
 /*!
  *  If the track is not found, a new one is created.
@@ -337,6 +362,38 @@ std::vector<uint8_t> Platform::get_export_data(Song& song, int format) const
 	}
 }
 
+//! Write the exported data to a stream.
+/*!
+ *  VGM and WAV files are written while they are being generated, so
+ *  that the whole file does not need to be kept in memory. Other
+ *  formats are generated with get_export_data().
+ *
+ *  \param stream Output stream. Must be seekable.
+ *  \param[out] dropped_writes If not nullptr, set to the redundant
+ *         register writes that were dropped by the driver. This is
+ *         only set for the VGM and WAV formats.
+ */
+void Platform::write_export_data(Song& song, int format, std::ostream& stream, Driver::Write_Counter* dropped_writes) const
+{
+	Driver::Write_Counter dropped;
+	if(get_export_formats().at(format).first == "vgm")
+	{
+		VGM_Writer vgm(stream, 0x61, 0x100);
+		dropped = write_vgm(song, vgm);
+	}
+	else if(get_export_formats().at(format).first == "wav")
+	{
+		dropped = write_wav(song, stream);
+	}
+	else
+	{
+		auto bytes = get_export_data(song, format);
+		stream.write((char*)bytes.data(), bytes.size());
+	}
+	if(dropped_writes)
+		*dropped_writes = dropped;
+}
+
 static inline std::string safe_get_tag(Song& song, const std::string& tagname)
 {
 	if(song.get_tag_map()[tagname].size())
@@ -376,6 +433,38 @@ static inline VGM_Tag get_tags(Song& song)
 std::vector<uint8_t> Platform::vgm_export(Song& song, unsigned int max_seconds, unsigned int num_loops) const
 {
 	VGM_Writer vgm("", 0x61, 0x100);
+	write_vgm(song, vgm, max_seconds, num_loops);
+	return vgm.get_buffer();
+}
+
+//! Play the song and log the output to a VGM_Writer.
+/*!
+ *  \return The redundant register writes that were dropped.
+ */
+Driver::Write_Counter Platform::write_vgm(Song& song, VGM_Writer& vgm, unsigned int max_seconds, unsigned int num_loops) const
+{
+	auto dropped_writes = play(song, vgm, max_seconds, num_loops);
+	vgm.write_tag(get_tags(song));
+	return dropped_writes;
+}
+
+//! Play the song and render the output to a WAV file.
+/*!
+ *  \param stream Output stream. Must be seekable.
+ *  \return The redundant register writes that were dropped.
+ */
+Driver::Write_Counter Platform::write_wav(Song& song, std::ostream& stream, unsigned int max_seconds, unsigned int num_loops) const
+{
+	Wave_Renderer wav(stream);
+	return play(song, wav, max_seconds, num_loops);
+}
+
+//! Play the song until it ends, loops or reaches the time limit.
+/*!
+ *  \return The redundant register writes that were dropped.
+ */
+Driver::Write_Counter Platform::play(Song& song, VGM_Interface& vgm, unsigned int max_seconds, unsigned int num_loops) const
+{
 	auto driver = song.get_platform()->get_driver(44100, &vgm);
 	unsigned long max_time = max_seconds * 44100;
 	driver->play_song(song);
@@ -396,6 +485,5 @@ std::vector<uint8_t> Platform::vgm_export(Song& song, unsigned int max_seconds,
 	if(!looped_or_finished)
 		vgm.delay(max_time-elapsed_time);
 	vgm.stop();
-	vgm.write_tag(get_tags(song));
-	return vgm.get_buffer();
+	return driver->get_dropped_writes();
 }
@@ -4,8 +4,10 @@
 #include <stdint.h>
 #include <memory>
 #include <utility>
+#include <iosfwd>
 
 #include "core.h"
+#include "driver.h"
 
 //! Song class.
 /*!
@@ -26,6 +28,8 @@ class Song
 		Song();
 		virtual ~Song();
 
+		void clear();
+
 		Tag_Map& get_tag_map();
 		void add_tag(const std::string& key, std::string value);
 		void add_tag_list(const std::string &key, const std::string &value);
@@ -40,6 +44,7 @@ class Song
 		Tag& get_tag_order_list();
 
 		Track& get_track(uint16_t id);
+		Track* find_track(uint16_t id);
 		Track& make_track(uint16_t id);
 
 		Track_Map& get_track_map();
@@ -76,8 +81,12 @@ class Platform
 		virtual std::shared_ptr<Driver> get_driver(unsigned int rate, VGM_Interface* vgm_interface) const;
 		virtual const Format_List& get_export_formats() const;
 		virtual std::vector<uint8_t> get_export_data(Song& song, int format) const;
+		virtual void write_export_data(Song& song, int format, std::ostream& stream, Driver::Write_Counter* dropped_writes = nullptr) const;
 	protected:
 		virtual std::vector<uint8_t> vgm_export(Song& song, unsigned int max_seconds = 3600, unsigned int num_loops = 1) const;
+		Driver::Write_Counter write_vgm(Song& song, VGM_Writer& vgm, unsigned int max_seconds = 3600, unsigned int num_loops = 1) const;
+		Driver::Write_Counter write_wav(Song& song, std::ostream& stream, unsigned int max_seconds = 3600, unsigned int num_loops = 1) const;
+		Driver::Write_Counter play(Song& song, VGM_Interface& vgm, unsigned int max_seconds, unsigned int num_loops) const;
 };
 
 #endif
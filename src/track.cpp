@@ -6,6 +6,7 @@
 #include <stdexcept>
 #include "track.h"
 #include "song.h"
+#include "input.h"
 
 //! Constructs a Track.
 /*!
@@ -24,6 +25,8 @@ Track::Track(uint16_t ppqn)
 	, early_release(0)
 	, sharp_mask(0)
 	, flat_mask(0)
+	, reference{0, 0, 0}
+	, references()
 {
 }
 
@@ -33,6 +36,7 @@ Track::Track(uint16_t ppqn)
  */
 void Track::add_event(Event& new_event)
 {
+	add_reference();
 	events.push_back(new_event);
 }
 
@@ -45,7 +49,8 @@ void Track::add_event(Event& new_event)
  */
 void Track::add_event(Event::Type type, int16_t param, uint16_t on_time, uint16_t off_time)
 {
-	Event a = {type, param, on_time, off_time, UINT_MAX, reference};
+	Event a = {type, param, on_time, off_time, UINT_MAX};
+	add_reference();
 	events.push_back(a);
 }
 
@@ -231,7 +236,13 @@ void Track::reverse_rest(uint16_t duration)
  */
 void Track::set_reference(const std::shared_ptr<InputRef>& ref)
 {
-	reference = ref;
+	reference = ref ? ref->get_position() : Input_Position{0, 0, 0};
+}
+
+//! Sets the reference to use for successive Events.
+void Track::set_reference(const Input_Position& position)
+{
+	reference = position;
 }
 
 //! Set the octave, affecting subsequent calls to add_note().
@@ -324,6 +335,27 @@ Event& Track::get_event(unsigned long position)
 	return events.at(position);
 }
 
+//! Get the input reference of the Event at the specified position.
+/*!
+ *  Returns nullptr if the Event has no reference.
+ */
+std::shared_ptr<InputRef> Track::get_reference(unsigned long position) const
+{
+	auto it = std::upper_bound(references.begin(), references.end(), position,
+		[](unsigned long value, const std::pair<unsigned long, Input_Position>& ref) {
+			return value < ref.first;
+		});
+	if(it == references.begin() || !(--it)->second.file)
+		return nullptr;
+	return std::make_shared<InputRef>(it->second);
+}
+
+//! Get the input references and the position of the first Event that uses them.
+std::vector<std::pair<unsigned long, Input_Position>>& Track::get_references()
+{
+	return references;
+}
+
 //! Get the total number of events in the track.
 unsigned long Track::get_event_count() const
 {
@@ -519,3 +551,10 @@ uint16_t Track::off_time(uint16_t duration) const
 {
 	return duration - on_time(duration);
 }
+
+//! Store the current reference for the next added Event, if it has changed.
+void Track::add_reference()
+{
+	if(references.empty() || !(references.back().second == reference))
+		references.push_back({events.size(), reference});
+}
@@ -9,6 +9,7 @@
 #include <stdint.h>
 #include <vector>
 #include <memory>
+#include <utility>
 #include "core.h"
 
 //! Track event.
@@ -24,6 +25,9 @@
  *
  *  All other kinds of events are immediate and both the `on_time` and
  *  `off_time` must be 0.
+ *
+ *  The input file reference is not stored in the event, see
+ *  Track::get_reference().
  */
 struct Event
 {
@@ -33,7 +37,7 @@ struct Event
 	 *  but does not show in Doxygen documentation right now. Just
 	 *  view the source code for more clear documentation.
 	 */
-	enum Type {
+	enum Type : int8_t {
 		// Basic events
 		NOP = 0,		//!< Does nothing and ignores all parameters.
 		REST,			//!< Key off. Reads \ref off_time.
@@ -88,10 +92,8 @@ struct Event
 	uint16_t on_time;
 	//! Key-off time (for \ref NOTE, \ref REST and \ref TIE types only)
 	uint16_t off_time;
-	//! Set by a Player to help look up the play time of an event.
+	//! Set by Song_Validator to help look up the play time of an event.
 	uint32_t play_time;
-	//! Pointer to an input file reference.
-	std::shared_ptr<InputRef> reference;
 };
 
 //! Track structure.
@@ -129,6 +131,7 @@ class Track
 
 		// Methods that modify following Events
 		void set_reference(const std::shared_ptr<InputRef>& ref);
+		void set_reference(const Input_Position& position);
 		void set_octave(int param);
 		void change_octave(int param);
 		void set_duration(uint16_t duration);
@@ -140,6 +143,8 @@ class Track
 		std::vector<Event>& get_events();
 		Event& get_event(unsigned long position);
 		unsigned long get_event_count() const;
+		std::shared_ptr<InputRef> get_reference(unsigned long position) const;
+		std::vector<std::pair<unsigned long, Input_Position>>& get_references();
 
 		// Methods that set Track state
 		void set_key_signature(const char* key);
@@ -156,6 +161,7 @@ class Track
 		void enable();
 		uint16_t on_time(uint16_t duration) const;
 		uint16_t off_time(uint16_t duration) const;
+		void add_reference();
 
 		uint8_t flag;
 		uint8_t ch;
@@ -169,7 +175,9 @@ class Track
 		uint16_t early_release;
 		uint8_t sharp_mask;
 		uint8_t flat_mask;
-		std::shared_ptr<InputRef> reference;
+		Input_Position reference;
+		//! Input references and the position of the first event that uses them.
+		std::vector<std::pair<unsigned long, Input_Position>> references;
 };
 #endif
 
@@ -0,0 +1,177 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include "../driver.h"
+#include "../vgm.h"
+
+// Records register writes
+class Write_Logger final : public VGM_Interface
+{
+	public:
+		std::vector<std::vector<uint16_t>> writes;
+
+		void write(uint8_t command, uint16_t port, uint16_t reg, uint16_t data) override
+		{
+			if(command == 0x50)
+				writes.push_back({command, data});
+			else
+				writes.push_back({(uint16_t)(command + port), reg, data});
+		}
+		void dac_setup(uint8_t sid, uint8_t chip_id, uint32_t port, uint32_t reg, uint8_t db_id) override {}
+		void dac_start(uint8_t sid, uint32_t start, uint32_t length, uint32_t freq) override {}
+		void dac_stop(uint8_t sid) override {}
+		void poke32(uint32_t offset, uint32_t data) override {}
+		void poke16(uint32_t offset, uint16_t data) override {}
+		void poke8(uint32_t offset, uint8_t data) override {}
+		void datablock(uint8_t dbtype, uint32_t dbsize, const uint8_t* db, uint32_t maxsize,
+				uint32_t mask, uint32_t flags, uint32_t offset) override {}
+};
+
+// Exposes the register write helpers
+class Test_Driver final : public Driver
+{
+	public:
+		Test_Driver(VGM_Interface* vgm)
+			: Driver(44100, vgm)
+		{}
+		void play_song(Song& song) override {}
+		void reset() override {}
+		void skip_ticks(unsigned int ticks) override {}
+		double play_step() override { return 0; }
+		bool is_playing() override { return false; }
+		uint32_t get_player_ticks() override { return 0; }
+		int get_loop_count() override { return 0; }
+
+		using Driver::ym2612_w;
+		using Driver::sn76489_w;
+		using Driver::set_vgm_interface;
+		using Driver::set_loop;
+};
+
+class Driver_Test : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(Driver_Test);
+	CPPUNIT_TEST(test_fm_register);
+	CPPUNIT_TEST(test_fm_key_on);
+	CPPUNIT_TEST(test_fm_frequency);
+	CPPUNIT_TEST(test_fm_frequency_latch);
+	CPPUNIT_TEST(test_psg);
+	CPPUNIT_TEST(test_psg_noise);
+	CPPUNIT_TEST(test_interface_change);
+	CPPUNIT_TEST(test_loop);
+	CPPUNIT_TEST_SUITE_END();
+private:
+	Write_Logger *logger;
+	Test_Driver *driver;
+
+	uint32_t dropped(uint8_t command, uint8_t reg)
+	{
+		auto& map = driver->get_dropped_writes();
+		auto it = map.find({command, reg});
+		return (it == map.end()) ? 0 : it->second;
+	}
+public:
+	void setUp()
+	{
+		logger = new Write_Logger();
+		driver = new Test_Driver(logger);
+	}
+	void tearDown()
+	{
+		delete driver;
+		delete logger;
+	}
+	void test_fm_register()
+	{
+		driver->ym2612_w(1, 0x40, 2, 3, 0x7f);
+		driver->ym2612_w(1, 0x40, 2, 3, 0x7f);
+		driver->ym2612_w(0, 0x40, 2, 3, 0x7f);
+		driver->ym2612_w(1, 0x40, 2, 3, 0x10);
+		std::vector<std::vector<uint16_t>> expected = {{0x53, 0x4e, 0x7f}, {0x52, 0x4e, 0x7f}, {0x53, 0x4e, 0x10}};
+		CPPUNIT_ASSERT(expected == logger->writes);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)1, dropped(0x53, 0x4e));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)1, driver->get_dropped_write_count());
+	}
+	void test_fm_key_on()
+	{
+		driver->ym2612_w(0, 0x28, 1, 0, 15);
+		driver->ym2612_w(0, 0x28, 1, 0, 15);
+		CPPUNIT_ASSERT_EQUAL((size_t)2, logger->writes.size());
+		CPPUNIT_ASSERT_EQUAL((uint32_t)0, driver->get_dropped_write_count());
+	}
+	void test_fm_frequency()
+	{
+		driver->ym2612_w(0, 0xa0, 1, 0, 0x2345);
+		driver->ym2612_w(0, 0xa0, 1, 0, 0x2345);
+		driver->ym2612_w(0, 0xa0, 1, 0, 0x2346);
+		driver->ym2612_w(0, 0xa0, 1, 0, 0x2446);
+		std::vector<std::vector<uint16_t>> expected = {
+			{0x52, 0xa5, 0x23}, {0x52, 0xa1, 0x45},
+			{0x52, 0xa1, 0x46},
+			{0x52, 0xa5, 0x24}, {0x52, 0xa1, 0x46}};
+		CPPUNIT_ASSERT(expected == logger->writes);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)2, dropped(0x52, 0xa5));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)1, dropped(0x52, 0xa1));
+	}
+	// the MSB latch is shared, so it must be rewritten after another channel uses it
+	void test_fm_frequency_latch()
+	{
+		driver->ym2612_w(0, 0xa0, 0, 0, 0x2345);
+		driver->ym2612_w(0, 0xa0, 1, 0, 0x1000);
+		driver->ym2612_w(0, 0xa0, 0, 0, 0x2346);
+		std::vector<std::vector<uint16_t>> expected = {
+			{0x52, 0xa4, 0x23}, {0x52, 0xa0, 0x45},
+			{0x52, 0xa5, 0x10}, {0x52, 0xa1, 0x00},
+			{0x52, 0xa4, 0x23}, {0x52, 0xa0, 0x46}};
+		CPPUNIT_ASSERT(expected == logger->writes);
+	}
+	void test_psg()
+	{
+		driver->sn76489_w(0, 1, 0x123);
+		driver->sn76489_w(0, 1, 0x123);
+		driver->sn76489_w(0, 1, 0x124);
+		driver->sn76489_w(0, 1, 0x134);
+		driver->sn76489_w(1, 1, 15);
+		driver->sn76489_w(1, 1, 15);
+		std::vector<std::vector<uint16_t>> expected = {
+			{0x50, 0xa3}, {0x50, 0x12},
+			{0x50, 0xa4},
+			{0x50, 0xa4}, {0x50, 0x13},
+			{0x50, 0xbf}};
+		CPPUNIT_ASSERT(expected == logger->writes);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)3, dropped(0x50, 0xa0));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)1, dropped(0x50, 0xb0));
+	}
+	// noise register writes reset the noise generator, so they can't be dropped
+	void test_psg_noise()
+	{
+		driver->sn76489_w(0, 3, 3);
+		driver->sn76489_w(0, 3, 3);
+		CPPUNIT_ASSERT_EQUAL((size_t)2, logger->writes.size());
+	}
+	void test_interface_change()
+	{
+		Write_Logger other;
+		driver->ym2612_w(0, 0xb0, 0, 0, 0x32);
+		// disabling logging does not change the chip state
+		driver->set_vgm_interface(nullptr);
+		driver->set_vgm_interface(logger);
+		driver->ym2612_w(0, 0xb0, 0, 0, 0x32);
+		CPPUNIT_ASSERT_EQUAL((size_t)1, logger->writes.size());
+		// a new interface may have a different state
+		driver->set_vgm_interface(&other);
+		driver->ym2612_w(0, 0xb0, 0, 0, 0x32);
+		CPPUNIT_ASSERT_EQUAL((size_t)1, other.writes.size());
+	}
+	// the state at the loop point is not known when looping back
+	void test_loop()
+	{
+		driver->ym2612_w(0, 0xb4, 0, 0, 0x40);
+		driver->sn76489_w(1, 1, 15);
+		driver->set_loop();
+		driver->ym2612_w(0, 0xb4, 0, 0, 0x40);
+		driver->sn76489_w(1, 1, 15);
+		CPPUNIT_ASSERT_EQUAL((size_t)4, logger->writes.size());
+		CPPUNIT_ASSERT_EQUAL((uint32_t)0, driver->get_dropped_write_count());
+	}
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(Driver_Test);
@@ -21,6 +21,9 @@ class Line_Input_Test : public CppUnit::TestFixture, private Line_Input
 	CPPUNIT_TEST_EXCEPTION(test_get_num_nan, std::invalid_argument);
 	CPPUNIT_TEST(test_get_num_nan_increment);
 	CPPUNIT_TEST(test_inputref);
+	CPPUNIT_TEST(test_shared_buffer);
+	CPPUNIT_TEST_EXCEPTION(test_shared_buffer_get_num, std::invalid_argument);
+	CPPUNIT_TEST(test_inputref_file_table);
 	CPPUNIT_TEST_SUITE_END();
 public:
 	Line_Input_Test() : Line_Input(0) {}
@@ -160,6 +163,40 @@ public:
 		ptr = get_reference();
 		CPPUNIT_ASSERT_EQUAL((unsigned int)2,ptr->get_column());
 	}
+	void test_shared_buffer()
+	{
+		auto data = std::make_shared<const std::string>("A cd\nB ef\n");
+		set_buffer(data, 5, 4, 2);
+		line = 1;
+		std::shared_ptr<InputRef> ptr = get_reference();
+		CPPUNIT_ASSERT_EQUAL((int)'e', get());
+		CPPUNIT_ASSERT_EQUAL((int)'f', get());
+		CPPUNIT_ASSERT_EQUAL((int)0, get());
+		seek(0);
+		CPPUNIT_ASSERT_EQUAL(std::string("B ef"), get_line());
+		CPPUNIT_ASSERT_EQUAL(std::string("B ef"), ptr->get_line_contents());
+		CPPUNIT_ASSERT_EQUAL((unsigned int)1, ptr->get_line());
+		CPPUNIT_ASSERT_EQUAL((unsigned int)2, ptr->get_column());
+	}
+	void test_inputref_file_table()
+	{
+		auto data = std::make_shared<const std::string>("A c\r\nB d\n\nC e");
+		unsigned int file = InputRef::add_file("file_table_test.mml", data);
+		CPPUNIT_ASSERT(file != InputRef::add_file("file_table_test.mml"));
+		InputRef ref(Input_Position{file, 3, 2});
+		CPPUNIT_ASSERT_EQUAL(std::string("file_table_test.mml"), ref.get_filename());
+		CPPUNIT_ASSERT_EQUAL(std::string("C e"), ref.get_line_contents());
+		CPPUNIT_ASSERT_EQUAL(std::string("A c"), InputRef(Input_Position{file, 0, 0}).get_line_contents());
+		CPPUNIT_ASSERT_EQUAL(std::string(""), InputRef(Input_Position{file, 2, 0}).get_line_contents());
+		CPPUNIT_ASSERT_EQUAL(std::string(""), InputRef(Input_Position{file, 9, 0}).get_line_contents());
+	}
+	// numbers on the next line should not be read
+	void test_shared_buffer_get_num()
+	{
+		auto data = std::make_shared<const std::string>("l\r\n16");
+		set_buffer(data, 0, 2, 1);
+		get_num(); // should throw std::invalid_argument
+	}
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(Line_Input_Test);
@@ -0,0 +1,105 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <fstream>
+#include <cstdio>
+#include <dirent.h>
+#include <unistd.h>
+#include "../platform/mdscache.h"
+
+class MDS_Cache_Test : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(MDS_Cache_Test);
+	CPPUNIT_TEST(test_lookup);
+	CPPUNIT_TEST(test_song_changed);
+	CPPUNIT_TEST(test_dependency_changed);
+	CPPUNIT_TEST(test_missing_file);
+	CPPUNIT_TEST_SUITE_END();
+private:
+	MDS_Cache *cache;
+	std::vector<std::string> files;
+
+	// write a file and delete it when the test is finished
+	void write(const std::string& filename, const std::string& data)
+	{
+		std::ofstream out(filename, std::ios::binary);
+		out << data;
+		files.push_back(filename);
+	}
+	RIFF make_mds(uint8_t value)
+	{
+		std::vector<uint8_t> data = {value};
+		RIFF riff(RIFF::TYPE_RIFF, FOURCC("MDS0"));
+		riff.add_chunk(RIFF(FOURCC("seq "), data));
+		return riff;
+	}
+	void store(uint8_t value)
+	{
+		RIFF mds = make_mds(value);
+		cache->store(cache->get_key("cache_test.mml"), {"cache_test.wav"}, mds);
+	}
+	bool lookup(RIFF& mds)
+	{
+		return cache->lookup(cache->get_key("cache_test.mml"), mds);
+	}
+public:
+	void setUp()
+	{
+		cache = new MDS_Cache("cache_test");
+		write("cache_test.mml", "A cde");
+		write("cache_test.wav", "sample data");
+	}
+	void tearDown()
+	{
+		delete cache;
+		for(auto&& i : files)
+			std::remove(i.c_str());
+		files.clear();
+		// delete the cache directory
+		if(DIR* dir = opendir("cache_test"))
+		{
+			while(struct dirent* entry = readdir(dir))
+				std::remove((std::string("cache_test/") + entry->d_name).c_str());
+			closedir(dir);
+		}
+		rmdir("cache_test");
+	}
+	void test_lookup()
+	{
+		RIFF mds(0);
+		CPPUNIT_ASSERT_EQUAL(false, lookup(mds));
+		store(1);
+		CPPUNIT_ASSERT_EQUAL(true, lookup(mds));
+		CPPUNIT_ASSERT(make_mds(1).to_bytes() == mds.to_bytes());
+	}
+	void test_song_changed()
+	{
+		RIFF mds(0);
+		store(1);
+		write("cache_test.mml", "A cdf");
+		CPPUNIT_ASSERT_EQUAL(false, lookup(mds));
+		store(2);
+		write("cache_test.mml", "A cde");
+		CPPUNIT_ASSERT_EQUAL(true, lookup(mds));
+		CPPUNIT_ASSERT(make_mds(1).to_bytes() == mds.to_bytes());
+	}
+	void test_dependency_changed()
+	{
+		RIFF mds(0);
+		store(1);
+		write("cache_test.wav", "new sample data");
+		CPPUNIT_ASSERT_EQUAL(false, lookup(mds));
+		store(2);
+		CPPUNIT_ASSERT_EQUAL(true, lookup(mds));
+		CPPUNIT_ASSERT(make_mds(2).to_bytes() == mds.to_bytes());
+	}
+	void test_missing_file()
+	{
+		RIFF mds(0);
+		store(1);
+		std::remove("cache_test.wav");
+		CPPUNIT_ASSERT_EQUAL(false, lookup(mds));
+		CPPUNIT_ASSERT_EQUAL(std::string(""), cache->get_key("missing.mml"));
+		CPPUNIT_ASSERT_EQUAL(false, cache->lookup("", mds));
+	}
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(MDS_Cache_Test);
@@ -1,9 +1,12 @@
 #include <stdexcept>
 #include <algorithm>
 #include <cppunit/extensions/HelperMacros.h>
+#include "../input.h"
 #include "../mml_input.h"
 #include "../song.h"
 #include "../platform/mdsdrv.h"
+#include "../platform/md.h"
+#include "../vgm.h"
 #include "../stringf.h"
 
 class MDSDRV_Converter_Test : public CppUnit::TestFixture
@@ -11,6 +14,8 @@ class MDSDRV_Converter_Test : public CppUnit::TestFixture
 	CPPUNIT_TEST_SUITE(MDSDRV_Converter_Test);
 	CPPUNIT_TEST(test_track_writer);
 	CPPUNIT_TEST(test_track_writer_sequence_output);
+	CPPUNIT_TEST(test_platform_command);
+	CPPUNIT_TEST_EXCEPTION(test_platform_command_undefined, InputError);
 	CPPUNIT_TEST(test_subroutine_handling);
 	CPPUNIT_TEST(test_drum_mode_handling);
 	CPPUNIT_TEST(test_loop_handling);
@@ -121,6 +126,39 @@ public:
 		CPPUNIT_ASSERT_EQUAL((uint16_t)MDSDRV_Event::SLR, (uint16_t)trk3.at(3));
 		CPPUNIT_ASSERT_EQUAL((uint16_t)MDSDRV_Event::FINISH, (uint16_t)trk3.at(4));
 	}
+	//! test conversion of platform commands
+	void test_platform_command()
+	{
+		mml_input->read_line("A 'lfo 3 2' 'LFORATE 1' 'write 0x22 0x0f' 'write 0xb4 0x40'");
+		mml_input->read_line("A 'tl2 +5' 'tl4 12' 'mode 2' 'fm3 0011' 'lfodelay 5' 'foo 1'");
+		auto converter = MDSDRV_Converter(*song);
+		auto& trk = converter.track_list[0];
+
+		CPPUNIT_ASSERT_EQUAL((int)9, (int)trk.size());
+		CPPUNIT_ASSERT_EQUAL((uint16_t)MDSDRV_Event::LFO, (uint16_t)trk[0].type);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x32, trk[0].arg);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)MDSDRV_Event::FMREG, (uint16_t)trk[1].type);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x2208, trk[1].arg);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)MDSDRV_Event::FMREG, (uint16_t)trk[2].type);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x220f, trk[2].arg);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)MDSDRV_Event::FMCREG, (uint16_t)trk[3].type);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0xb440, trk[3].arg);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)MDSDRV_Event::FMTLM, (uint16_t)trk[4].type);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x0205, trk[4].arg);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)MDSDRV_Event::FMTL, (uint16_t)trk[5].type);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x030c, trk[5].arg);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)MDSDRV_Event::LFO, (uint16_t)trk[6].type);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0xe3, trk[6].arg);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)MDSDRV_Event::FLG, (uint16_t)trk[7].type);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0x8c, trk[7].arg);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)MDSDRV_Event::FINISH, (uint16_t)trk[8].type);
+	}
+	//! referencing an unregistered platform command should fail.
+	void test_platform_command_undefined()
+	{
+		mml_input->read_line("A %5");
+		auto converter = MDSDRV_Converter(*song);
+	}
 	void test_subroutine_handling()
 	{
 		mml_input->read_line("A *20 l8o4cde");
@@ -384,9 +422,209 @@ public:
 		auto export_list = platform->get_export_formats();
 		CPPUNIT_ASSERT_EQUAL(std::string("vgm"), export_list[0].first);
 		CPPUNIT_ASSERT_EQUAL(std::string("mds"), export_list[1].first);
+		CPPUNIT_ASSERT_EQUAL(std::string("wav"), export_list[2].first);
+	}
+};
+
+class MDSDRV_Linker_Test : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(MDSDRV_Linker_Test);
+	CPPUNIT_TEST(test_unique_data);
+	CPPUNIT_TEST_EXCEPTION(test_unique_data_not_found, std::out_of_range);
+	CPPUNIT_TEST_SUITE_END();
+private:
+	MDSDRV_Linker *linker;
+public:
+	void setUp()
+	{
+		linker = new MDSDRV_Linker();
+	}
+	void tearDown()
+	{
+		delete linker;
+	}
+	//! duplicates must return the index of the first entry, also with many entries.
+	void test_unique_data()
+	{
+		const int count = 20000;
+		for(int i = 0; i < count; i++)
+		{
+			CPPUNIT_ASSERT_EQUAL(i, linker->add_unique_data({0x80, (uint8_t)(i >> 8), (uint8_t)i}));
+			CPPUNIT_ASSERT_EQUAL(i / 2, linker->add_unique_data({0x80, (uint8_t)(i >> 9), (uint8_t)(i >> 1)}));
+		}
+		CPPUNIT_ASSERT_EQUAL(count, (int)linker->data_bank.size());
+		for(int i = 0; i < count; i++)
+			CPPUNIT_ASSERT_EQUAL(i, linker->find_unique_data({0x80, (uint8_t)(i >> 8), (uint8_t)i}));
+	}
+	void test_unique_data_not_found()
+	{
+		linker->add_unique_data({0x10, 0x01, 0x1f, 0x00});
+		linker->find_unique_data({0x10, 0x01, 0x1f});
+	}
+};
+
+class MD_Driver_Test : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(MD_Driver_Test);
+	CPPUNIT_TEST(test_checkpoint_seek);
+	CPPUNIT_TEST_SUITE_END();
+private:
+	Song *song;
+	MML_Input *mml_input;
+
+	std::vector<uint8_t> render(unsigned int seek_ticks, unsigned int interval)
+	{
+		VGM_Writer vgm("", 0x61, 0x100);
+		MD_Driver driver(44100, &vgm);
+		driver.play_song(*song);
+		if(interval)
+		{
+			// seek twice to ensure that checkpoints can be reused
+			driver.create_checkpoints(interval, 1000);
+			driver.skip_ticks(seek_ticks + 30);
+		}
+		driver.skip_ticks(seek_ticks);
+		for(int i = 0; i < 300; i++)
+			vgm.delay(driver.play_step());
+		vgm.stop();
+		return vgm.get_buffer();
+	}
+public:
+	void setUp()
+	{
+		song = new Song();
+		mml_input = new MML_Input(song);
+	}
+	void tearDown()
+	{
+		delete mml_input;
+		delete song;
+	}
+	//! seeking from a checkpoint must give the same result as seeking from the start.
+	void test_checkpoint_seek()
+	{
+		mml_input->read_line("A l8o4v10 [cdefg]4 L e4.d16c16 r4 'lfo 1 2' c&c");
+		mml_input->read_line("B o3 l16 [c d8 e q4 f8 Q4 g]8 t140 a2");
+		mml_input->read_line("G l24o5 [[c]3 r d]5 L e4 f4");
+		for(unsigned int ticks : {0, 1, 7, 8, 9, 33, 100, 250})
+		{
+			auto expected = render(ticks, 0);
+			auto result = render(ticks, 8);
+			CPPUNIT_ASSERT(expected == result);
+		}
+	}
+};
+
+// Exposes the PCM mixer so that a test wave ROM can be used
+class Test_PCMDriver : public MD_PCMDriver
+{
+	public:
+		Test_PCMDriver(MD_Driver& driver)
+			: MD_PCMDriver(driver)
+		{}
+		using MD_PCMDriver::render;
+
+		MD_PCMChannel& get_channel(int channel)
+		{
+			return channels[channel];
+		}
+		// Mix one update at a time, as done by update()
+		uint32_t render_scalar(const uint8_t* rom, std::vector<uint8_t>& buffer, uint32_t count)
+		{
+			uint32_t samples = 0;
+			rendering = true;
+			while(samples < count && (channels[0].enabled || channels[1].enabled || channels[2].enabled))
+			{
+				int8_t accumulator = 0;
+				for(int i=0; i<mode; i++)
+					accumulator = mix_channel(rom, accumulator, i);
+				if(dac_off_pending)
+					break;
+				buffer.push_back(accumulator ^ 0x80);
+				samples++;
+			}
+			rendering = false;
+			return samples;
+		}
+};
+
+class MD_PCMDriver_Test : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(MD_PCMDriver_Test);
+	CPPUNIT_TEST(test_block_mixer);
+	CPPUNIT_TEST_SUITE_END();
+private:
+	MD_Driver driver;
+	std::vector<uint8_t> rom;
+	uint32_t seed;
+
+	uint32_t random(uint32_t range)
+	{
+		seed = seed * 1103515245 + 12345;
+		return (seed >> 8) % range;
+	}
+	void check_channel(MD_PCMChannel& expected, MD_PCMChannel& result)
+	{
+		CPPUNIT_ASSERT_EQUAL(expected.enabled, result.enabled);
+		CPPUNIT_ASSERT_EQUAL(expected.position, result.position);
+		CPPUNIT_ASSERT_EQUAL((int)expected.phase, (int)result.phase);
+		CPPUNIT_ASSERT_EQUAL((int)expected.count, (int)result.count);
+	}
+public:
+	MD_PCMDriver_Test()
+		: driver(44100, nullptr)
+	{}
+	void setUp()
+	{
+		seed = 1;
+		rom.resize(0x2000);
+		for(auto&& i : rom)
+			i = random(256);
+	}
+	void tearDown()
+	{
+	}
+	//! the block mixer must give the same output as mixing one update at a time.
+	void test_block_mixer()
+	{
+		for(int test = 0; test < 500; test++)
+		{
+			Test_PCMDriver expected(driver);
+			int mode = 2 + test % 2;
+			expected.set_mode(mode);
+			for(int i = 0; i < mode; i++)
+			{
+				expected.set_pitch(i, 1 + random(8));
+				expected.set_vol(i, random(16));
+				MD_PCMChannel& ch = expected.get_channel(i);
+				ch.enabled = random(4);
+				ch.start = random(0x1000);
+				ch.length = random(0x1000);
+				ch.position = random(ch.length + 1);
+			}
+			Test_PCMDriver result(expected);
+			std::vector<uint8_t> expected_buffer, result_buffer;
+			// render twice to check that the mixer can be resumed
+			for(int step = 0; step < 2; step++)
+			{
+				uint32_t count = random(2000);
+				CPPUNIT_ASSERT_EQUAL(
+					expected.render_scalar(rom.data(), expected_buffer, count),
+					result.render(rom.data(), result_buffer, count));
+				CPPUNIT_ASSERT(expected_buffer == result_buffer);
+				CPPUNIT_ASSERT_EQUAL(expected.get_dac_off_pending(), result.get_dac_off_pending());
+				for(int i = 0; i < 3; i++)
+					check_channel(expected.get_channel(i), result.get_channel(i));
+				if(expected.get_dac_off_pending())
+					break;
+			}
+		}
 	}
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(MDSDRV_Converter_Test);
 CPPUNIT_TEST_SUITE_REGISTRATION(MDSDRV_Platform_Test);
+CPPUNIT_TEST_SUITE_REGISTRATION(MDSDRV_Linker_Test);
+CPPUNIT_TEST_SUITE_REGISTRATION(MD_Driver_Test);
+CPPUNIT_TEST_SUITE_REGISTRATION(MD_PCMDriver_Test);
 
@@ -2,12 +2,16 @@
 #include <cppunit/extensions/HelperMacros.h>
 #include <istream>
 #include "../stringf.h"
+#include "../parallel.h"
+#include <atomic>
 
 class Misc_Test : public CppUnit::TestFixture
 {
 	CPPUNIT_TEST_SUITE(Misc_Test);
 	CPPUNIT_TEST(test_open_test_file_latin1);
 	CPPUNIT_TEST(test_open_test_file_unicode);
+	CPPUNIT_TEST(test_parallel_for);
+	CPPUNIT_TEST(test_parallel_for_exception);
 	CPPUNIT_TEST_SUITE_END();
 public:
 	void setUp()
@@ -34,6 +38,32 @@ public:
 		std::getline(inputfile, str);
 		CPPUNIT_ASSERT_EQUAL(std::string("my filename contains Unicode characters"), str);
 	}
+	void test_parallel_for()
+	{
+		std::vector<std::atomic<int>> count(1000);
+		parallel_for(count.size(), [&](unsigned int i) { count[i]++; }, 4);
+		for(auto&& i : count)
+			CPPUNIT_ASSERT_EQUAL(1, i.load());
+	}
+	// the exception with the lowest index is thrown
+	void test_parallel_for_exception()
+	{
+		std::atomic<int> calls(0);
+		try
+		{
+			parallel_for(100, [&](unsigned int i) {
+				calls++;
+				if(i == 20 || i == 50 || i == 90)
+					throw std::runtime_error(stringf("%d", i));
+			}, 4);
+			CPPUNIT_FAIL("expected exception");
+		}
+		catch(std::runtime_error& error)
+		{
+			CPPUNIT_ASSERT_EQUAL(std::string("20"), std::string(error.what()));
+		}
+		CPPUNIT_ASSERT_EQUAL(100, calls.load());
+	}
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(Misc_Test);
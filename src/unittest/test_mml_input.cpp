@@ -1,13 +1,41 @@
 #include <cppunit/extensions/HelperMacros.h>
+#include <fstream>
+#include <cstdio>
+#include <sstream>
+#include <iostream>
 #include "../mml_input.h"
+#include "../parallel.h"
 #include "../song.h"
 #include "../track.h"
 
+// MML dialect where 'y' is used instead of 'v'
+class Test_Dialect : public MML_Input
+{
+	public:
+		Test_Dialect(Song* song)
+			: MML_Input(song, dialect_commands)
+		{}
+
+	private:
+		static const Command_Table dialect_commands;
+
+		static Command_Table make_dialect_commands()
+		{
+			Command_Table table = default_commands;
+			table.command['y'] = table.command['v'];
+			table.command['v'] = {nullptr, Event::INVALID};
+			return table;
+		}
+};
+
+const Test_Dialect::Command_Table Test_Dialect::dialect_commands = Test_Dialect::make_dialect_commands();
+
 class MML_Input_Test : public CppUnit::TestFixture
 {
 	CPPUNIT_TEST_SUITE(MML_Input_Test);
 	CPPUNIT_TEST(test_basic_mml);
 	CPPUNIT_TEST(test_mml_track_id);
+	CPPUNIT_TEST(test_mml_reference_line);
 	CPPUNIT_TEST(test_mml_note_octave);
 	CPPUNIT_TEST(test_mml_note_flat_sharp);
 	CPPUNIT_TEST(test_mml_note_duration);
@@ -20,10 +48,69 @@ class MML_Input_Test : public CppUnit::TestFixture
 	CPPUNIT_TEST(test_mml_error_duration);
 	CPPUNIT_TEST(test_mml_key_signature);
 	CPPUNIT_TEST(test_mml_track_map);
+	CPPUNIT_TEST(test_mml_dialect);
+	CPPUNIT_TEST(test_parse_file);
+	CPPUNIT_TEST(test_parse_file_error);
+	CPPUNIT_TEST(test_parse_file_warning);
+	CPPUNIT_TEST(test_update_note);
+	CPPUNIT_TEST(test_update_insert_line);
+	CPPUNIT_TEST(test_update_track_list);
+	CPPUNIT_TEST(test_update_tag);
+	CPPUNIT_TEST(test_update_platform_command);
+	CPPUNIT_TEST(test_update_reparse);
 	CPPUNIT_TEST_SUITE_END();
 private:
 	Song *song;
 	MML_Input *mml_input;
+
+	// Parse a file using multiple threads
+	void parse_file(const std::vector<std::string>& lines)
+	{
+		{
+			std::ofstream out("parse_test.mml");
+			for(auto& str : lines)
+				out << str << "\n";
+		}
+		set_thread_count(4);
+		try
+		{
+			mml_input->open_file("parse_test.mml");
+		}
+		catch(InputError&)
+		{
+			set_thread_count(0);
+			std::remove("parse_test.mml");
+			throw;
+		}
+		set_thread_count(0);
+		std::remove("parse_test.mml");
+	}
+
+	// Compare with a song parsed from scratch
+	void check_update(const std::vector<std::string>& lines)
+	{
+		Song full_song;
+		MML_Input(&full_song).read_lines(lines);
+		auto& expected = full_song.get_track_map();
+		auto& actual = song->get_track_map();
+		CPPUNIT_ASSERT_EQUAL(expected.size(), actual.size());
+		for(auto& it : expected)
+		{
+			Track& track = song->get_track(it.first);
+			CPPUNIT_ASSERT_EQUAL(it.second.get_event_count(), track.get_event_count());
+			for(unsigned long i = 0; i < track.get_event_count(); i++)
+			{
+				Event& a = it.second.get_event(i);
+				Event& b = track.get_event(i);
+				CPPUNIT_ASSERT_EQUAL(a.type, b.type);
+				CPPUNIT_ASSERT_EQUAL(a.param, b.param);
+				CPPUNIT_ASSERT_EQUAL(a.on_time, b.on_time);
+				CPPUNIT_ASSERT_EQUAL(a.off_time, b.off_time);
+				CPPUNIT_ASSERT_EQUAL(it.second.get_reference(i)->get_line(), track.get_reference(i)->get_line());
+				CPPUNIT_ASSERT_EQUAL(it.second.get_reference(i)->get_column(), track.get_reference(i)->get_column());
+			}
+		}
+	}
 public:
 	void setUp()
 	{
@@ -40,6 +127,15 @@ public:
 		mml_input->read_line("A cdef");
 		CPPUNIT_ASSERT(song->get_track(0).get_event_count() == 4);
 	}
+	// inputs with the same name must not share line contents
+	void test_mml_reference_line()
+	{
+		Song other_song;
+		mml_input->read_line("A cdef");
+		MML_Input(&other_song).read_line("A gab");
+		CPPUNIT_ASSERT_EQUAL(std::string("A cdef"), song->get_track(0).get_reference(0)->get_line_contents());
+		CPPUNIT_ASSERT_EQUAL(std::string("A gab"), other_song.get_track(0).get_reference(0)->get_line_contents());
+	}
 	void test_mml_track_id()
 	{
 		mml_input->read_line("A cdef");
@@ -220,7 +316,141 @@ public:
 		mml_input->read_line("B"); // also empty
 		mml_input->get_track_map();
 	}
-
+	void test_mml_dialect()
+	{
+		Test_Dialect dialect(song);
+		dialect.read_line("A y10 c");
+		CPPUNIT_ASSERT_EQUAL(Event::VOL, song->get_track(0).get_event(0).type);
+		CPPUNIT_ASSERT_EQUAL((int16_t)10, song->get_track(0).get_event(0).param);
+		CPPUNIT_ASSERT_EQUAL(Event::NOTE, song->get_track(0).get_event(1).type);
+		CPPUNIT_ASSERT_THROW(dialect.read_line("A v10"), InputError);
+	}
+	// Tracks are parsed in parallel, but the result should be the same
+	void test_parse_file()
+	{
+		std::vector<std::string> lines = {
+			"#title test", "AB 'fm3 1' c", "  d{e/'lfo 2'}", "C 'tl 1' e",
+			"@1 1 2 3", "A 'b 1' c", "B f", "CA 'x'", "D"};
+		parse_file(lines);
+		check_update(lines);
+		Song serial_song;
+		MML_Input(&serial_song).read_lines(lines);
+		CPPUNIT_ASSERT(serial_song.get_tag_map() == song->get_tag_map());
+		CPPUNIT_ASSERT(serial_song.get_tag_order_list() == song->get_tag_order_list());
+	}
+	// The first error in the file is reported
+	void test_parse_file_error()
+	{
+		std::vector<std::string> lines = {"A c", "B d", "A e", "B x", "A y", "!"};
+		std::string serial_error, error;
+		try
+		{
+			Song serial_song;
+			MML_Input input(&serial_song);
+			for(unsigned int i = 0; i < lines.size(); i++)
+				input.read_line(lines[i], i);
+		}
+		catch(InputError& e)
+		{
+			serial_error = e.what();
+		}
+		try
+		{
+			parse_file(lines);
+		}
+		catch(InputError& e)
+		{
+			error = e.what();
+		}
+		CPPUNIT_ASSERT_EQUAL(std::string(":4:3: unknown MML command"), serial_error);
+		CPPUNIT_ASSERT_EQUAL(std::string("parse_test.mml") + serial_error, error);
+	}
+	// warnings are printed in file order, up to the first error
+	void test_parse_file_warning()
+	{
+		std::vector<std::string> lines = {"B r&", "A r&", "AB r& x", "B r&"};
+		std::stringstream serial_log, log;
+		auto old_buf = std::cerr.rdbuf(serial_log.rdbuf());
+		try
+		{
+			Song serial_song;
+			MML_Input input(&serial_song);
+			for(unsigned int i = 0; i < lines.size(); i++)
+				input.read_line(lines[i], i);
+		}
+		catch(InputError& e)
+		{
+		}
+		std::cerr.rdbuf(log.rdbuf());
+		try
+		{
+			parse_file(lines);
+		}
+		catch(InputError& e)
+		{
+		}
+		std::cerr.rdbuf(old_buf);
+		std::string expected, actual;
+		int count = 0;
+		for(std::string line; std::getline(serial_log, line); count++)
+			expected += (line[0] == ':') ? "parse_test.mml" + line : line;
+		CPPUNIT_ASSERT_EQUAL(6, count);
+		for(std::string line; std::getline(log, line);)
+			actual += line;
+		CPPUNIT_ASSERT_EQUAL(expected, actual);
+	}
+	void test_update_note()
+	{
+		mml_input->read_lines({"#title test", "A cdef", "B cd", "A gab"});
+		CPPUNIT_ASSERT(mml_input->update_lines(1, 1, {"A l8 c<b>"}));
+		check_update({"#title test", "A l8 c<b>", "B cd", "A gab"});
+	}
+	void test_update_insert_line()
+	{
+		mml_input->read_lines({"A cdef", "B cd", "A gab", "C e"});
+		CPPUNIT_ASSERT(mml_input->update_lines(1, 0, {"B e", "B f"}));
+		check_update({"A cdef", "B e", "B f", "B cd", "A gab", "C e"});
+		CPPUNIT_ASSERT_EQUAL((unsigned int)4, song->get_track(0).get_reference(4)->get_line());
+		CPPUNIT_ASSERT(mml_input->update_lines(1, 3, {}));
+		check_update({"A cdef", "A gab", "C e"});
+	}
+	void test_update_track_list()
+	{
+		// continuation lines use the track list of the previous header
+		mml_input->read_lines({"A c", "  d", "  e", "B f"});
+		CPPUNIT_ASSERT(mml_input->update_lines(0, 1, {"AC c"}));
+		check_update({"AC c", "  d", "  e", "B f"});
+		CPPUNIT_ASSERT(mml_input->update_lines(0, 2, {"B c"}));
+		check_update({"B c", "  e", "B f"});
+	}
+	void test_update_tag()
+	{
+		mml_input->read_lines({"#title test", "A cdef"});
+		CPPUNIT_ASSERT(!mml_input->update_lines(0, 1, {"#title changed"}));
+		CPPUNIT_ASSERT(!mml_input->update_lines(1, 0, {"@1 1 2 3"}));
+		CPPUNIT_ASSERT(song->get_tag("#title")[0] == "test");
+		CPPUNIT_ASSERT(mml_input->update_lines(1, 1, {"A c"}));
+		check_update({"#title test", "A c"});
+	}
+	void test_update_platform_command()
+	{
+		mml_input->read_lines({"A 'fm3 1' c", "B d"});
+		CPPUNIT_ASSERT(!mml_input->update_lines(0, 1, {"A c"}));
+		CPPUNIT_ASSERT(mml_input->update_lines(1, 1, {"B e"}));
+		check_update({"A 'fm3 1' c", "B e"});
+	}
+	// parsing again after a failed update must not duplicate the song data
+	void test_update_reparse()
+	{
+		mml_input->read_lines({"#title test", "A cdef", "B 'fm3 1' c"});
+		CPPUNIT_ASSERT(!mml_input->update_lines(0, 1, {"#title changed"}));
+		mml_input->read_lines({"#title changed", "A cdef", "B 'fm3 1' c"});
+		CPPUNIT_ASSERT_EQUAL((size_t)1, song->get_tag("#title").size());
+		check_update({"#title changed", "A cdef", "B 'fm3 1' c"});
+		CPPUNIT_ASSERT_THROW(mml_input->update_lines(1, 1, {"A c!"}), InputError);
+		mml_input->read_lines({"#title changed", "A cdef", "B 'fm3 1' c"});
+		check_update({"#title changed", "A cdef", "B 'fm3 1' c"});
+	}
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(MML_Input_Test);
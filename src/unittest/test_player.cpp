@@ -3,6 +3,7 @@
 #include "../song.h"
 #include "../track.h"
 #include "../player.h"
+#include "../input.h"
 
 class Player_Test : public CppUnit::TestFixture
 {
@@ -16,10 +17,19 @@ class Player_Test : public CppUnit::TestFixture
 	CPPUNIT_TEST(test_is_inside_loop2);
 	CPPUNIT_TEST(test_loop_position);
 	CPPUNIT_TEST(test_jump);
+	CPPUNIT_TEST(test_jump_missing);
+	CPPUNIT_TEST(test_jump_recursive);
 	CPPUNIT_TEST(test_play_tick);
 	CPPUNIT_TEST(test_quantize_play_tick);
 	CPPUNIT_TEST(test_early_release_play_tick);
 	CPPUNIT_TEST(test_skip_ticks);
+	CPPUNIT_TEST(test_idle_ticks);
+	CPPUNIT_TEST(test_validate_loop);
+	CPPUNIT_TEST(test_validate_loop_break);
+	CPPUNIT_TEST(test_validate_segno_in_loop);
+	CPPUNIT_TEST(test_validate_jump);
+	CPPUNIT_TEST(test_validate_paranoid);
+	CPPUNIT_TEST(test_validate_error);
 	CPPUNIT_TEST_SUITE_END();
 private:
 	Song *song;
@@ -266,6 +276,38 @@ public:
 		CPPUNIT_ASSERT_EQUAL(Event::NOTE, player.get_event().type);
 		CPPUNIT_ASSERT_EQUAL((int16_t)40, player.get_event().param);
 	}
+	void test_jump_missing()
+	{
+		mml_input->read_line("A o4e *11");
+		auto player = Player(*song, song->get_track(0));
+		player.step_event();
+		try
+		{
+			player.step_event();
+			CPPUNIT_FAIL("expected InputError");
+		}
+		catch(InputError& error)
+		{
+			CPPUNIT_ASSERT(std::string(error.what()).find("jump destination doesn't exist") != std::string::npos);
+		}
+	}
+	// the stack overflow should not be reported as a missing jump destination
+	void test_jump_recursive()
+	{
+		mml_input->read_line("*10 c *10");
+		mml_input->read_line("A *10");
+		auto player = Player(*song, song->get_track(0));
+		try
+		{
+			for(int i = 0; i < 100; i++)
+				player.step_event();
+			CPPUNIT_FAIL("expected InputError");
+		}
+		catch(InputError& error)
+		{
+			CPPUNIT_ASSERT(std::string(error.what()).find("stack overflow") != std::string::npos);
+		}
+	}
 	// result should be the same
 	void test_play_tick()
 	{
@@ -326,6 +368,81 @@ public:
 		CPPUNIT_ASSERT_EQUAL(1, player.note_count);
 		CPPUNIT_ASSERT_EQUAL(1, player.rest_count);
 	}
+	// skipping idle ticks should not read any events
+	void test_idle_ticks()
+	{
+		mml_input->read_line("A l16q4cd"); // length should be 12
+		auto player = Player(*song, song->get_track(0));
+		player.play_tick();
+		CPPUNIT_ASSERT_EQUAL((unsigned int)1, player.get_idle_ticks());
+		player.skip_ticks(player.get_idle_ticks());
+		CPPUNIT_ASSERT_EQUAL(1, player.note_count);
+		CPPUNIT_ASSERT_EQUAL(0, player.rest_count);
+		player.play_tick();
+		CPPUNIT_ASSERT_EQUAL(1, player.rest_count);
+		CPPUNIT_ASSERT_EQUAL((unsigned int)3, player.get_idle_ticks());
+		player.skip_ticks(player.get_idle_ticks());
+		CPPUNIT_ASSERT_EQUAL(1, player.note_count);
+		player.play_tick();
+		CPPUNIT_ASSERT_EQUAL(2, player.note_count);
+		CPPUNIT_ASSERT_EQUAL((unsigned int)6, player.get_play_time());
+	}
+	// compare the analyzed length with the stepped length
+	void check_validator(uint16_t id, unsigned int play_time, unsigned int loop_length)
+	{
+		auto validator = Song_Validator(*song, true);
+		auto& track = validator.get_track_map().at(id);
+		CPPUNIT_ASSERT_EQUAL(play_time, track.get_play_time());
+		CPPUNIT_ASSERT_EQUAL(loop_length, track.get_loop_length());
+	}
+	void test_validate_loop()
+	{
+		mml_input->read_line("A l16 c [d [e]3 ]255 f");
+		check_validator(0, 6 + 255*(6+3*6) + 6, 0);
+	}
+	void test_validate_loop_break()
+	{
+		mml_input->read_line("A l16 [c / d]3 e");
+		check_validator(0, 2*12 + 6 + 6, 0);
+	}
+	void test_validate_segno_in_loop()
+	{
+		mml_input->read_line("A l16 [c / L d]3 e");
+		// segno is last visited before the final iteration
+		check_validator(0, 2*12 + 6 + 6, 6 + 6 + 6);
+		mml_input->read_line("B l16 [c L / d]3 e");
+		check_validator(1, 2*12 + 6 + 6, 6);
+	}
+	void test_validate_jump()
+	{
+		mml_input->read_line("*10 l16 c L d");
+		mml_input->read_line("*11 [*10]100");
+		mml_input->read_line("A l8 e [*11]100");
+		check_validator(0, 12 + 100*100*12, 6);
+	}
+	void test_validate_paranoid()
+	{
+		mml_input->read_line("*10 [c / d]2 L e");
+		mml_input->read_line("*11 [[f *10]3 / g]4");
+		mml_input->read_line("A c L [[*11 / a]2 b]3 *10");
+		mml_input->read_line("B [c L d [e / f]3]2");
+		CPPUNIT_ASSERT_NO_THROW(Song_Validator(*song, true));
+	}
+	// errors are reported by playing the track
+	void test_validate_error()
+	{
+		mml_input->read_line("*10 c *10");
+		mml_input->read_line("A *10");
+		try
+		{
+			Song_Validator(*song, false);
+			CPPUNIT_FAIL("expected InputError");
+		}
+		catch(InputError& error)
+		{
+			CPPUNIT_ASSERT(std::string(error.what()).find("stack overflow") != std::string::npos);
+		}
+	}
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(Player_Test);
@@ -1,6 +1,7 @@
 #include <stdexcept>
 #include <cppunit/extensions/HelperMacros.h>
 #include "../track.h"
+#include "../input.h"
 
 class Track_Test : public CppUnit::TestFixture
 {
@@ -24,6 +25,7 @@ class Track_Test : public CppUnit::TestFixture
 	CPPUNIT_TEST_EXCEPTION(test_reverse_rest_impossible, std::domain_error);
 	CPPUNIT_TEST(test_get_event_count);
 	CPPUNIT_TEST(test_key_signature);
+	CPPUNIT_TEST(test_get_reference);
 	CPPUNIT_TEST_SUITE_END();
 private:
 	Track *track;
@@ -311,7 +313,26 @@ public:
 		CPPUNIT_ASSERT_EQUAL((int8_t)-1, track->get_key_signature('a'));
 		CPPUNIT_ASSERT_EQUAL((int8_t)-1, track->get_key_signature('b'));
 	}
-
+	// References are stored only when they change
+	void test_get_reference()
+	{
+		auto ref1 = std::make_shared<InputRef>("test.mml", "c d", 1, 1);
+		auto ref2 = std::make_shared<InputRef>("test.mml", "c d", 1, 3);
+		track->add_note(0);
+		track->set_reference(ref1);
+		track->add_note(0);
+		track->add_rest();
+		track->set_reference(ref2);
+		track->add_note(0);
+		CPPUNIT_ASSERT(track->get_reference(0) == nullptr);
+		CPPUNIT_ASSERT(track->get_reference(1)->get_position() == ref1->get_position());
+		CPPUNIT_ASSERT(track->get_reference(2)->get_position() == ref1->get_position());
+		CPPUNIT_ASSERT(track->get_reference(3)->get_position() == ref2->get_position());
+		CPPUNIT_ASSERT(track->get_reference(100)->get_position() == ref2->get_position());
+		CPPUNIT_ASSERT_EQUAL(std::string("test.mml"), track->get_reference(3)->get_filename());
+		CPPUNIT_ASSERT_EQUAL(std::string("c d"), track->get_reference(3)->get_line_contents());
+		CPPUNIT_ASSERT_EQUAL((unsigned int)3, track->get_reference(3)->get_column());
+	}
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(Track_Test);
@@ -1,4 +1,5 @@
 #include <stdexcept>
+#include <sstream>
 #include <cppunit/extensions/HelperMacros.h>
 #include "../vgm.h"
 
@@ -6,7 +7,32 @@ class VGM_Writer_Test : public CppUnit::TestFixture
 {
 	CPPUNIT_TEST_SUITE(VGM_Writer_Test);
 	CPPUNIT_TEST(test_vgm_output);
+	CPPUNIT_TEST(test_vgm_stream);
+	CPPUNIT_TEST(test_vgm_stream_peek);
+	CPPUNIT_TEST(test_vgm_datablock);
 	CPPUNIT_TEST_SUITE_END();
+	// Write some test data including datablocks, loop and tags
+	void write_test_data(VGM_Writer& vgm)
+	{
+		VGM_Tag tag;
+		tag.title = "Test";
+		tag.date = "2020-01-01";
+		std::vector<uint8_t> small_db(1000, 0x80);
+		std::vector<uint8_t> large_db(200000, 0x40);
+		vgm.poke32(0x2C, 7670454);
+		vgm.datablock(0, small_db.size(), small_db.data(), small_db.size());
+		vgm.delay(100000);
+		vgm.datablock(0, large_db.size(), large_db.data(), large_db.size());
+		for(int i=0; i<100000; i++)
+		{
+			if(i == 50000)
+				vgm.set_loop();
+			vgm.write(0x52, 0, 0x2a, (i & 0xff));
+			vgm.delay(1.5);
+		}
+		vgm.stop();
+		vgm.write_tag(tag);
+	}
 public:
 	void setUp()
 	{
@@ -40,6 +66,47 @@ public:
 		// verify sample count (1.5*1000000)
 		CPPUNIT_ASSERT_EQUAL((uint32_t) 1500000, vgm.peek32(0x18));
 	}
+	// streaming output should be identical to the buffered output
+	void test_vgm_stream()
+	{
+		std::stringstream stream;
+		stream << "padding";
+		auto buffered_vgm = VGM_Writer("", 0x61, 0x100);
+		write_test_data(buffered_vgm);
+		auto expected = buffered_vgm.get_buffer();
+		{
+			VGM_Writer vgm(stream, 0x61, 0x100);
+			write_test_data(vgm);
+			CPPUNIT_ASSERT_THROW(vgm.get_buffer(), std::logic_error);
+		}
+		auto str = stream.str();
+		auto output = std::vector<uint8_t>(str.begin() + 7, str.end());
+		CPPUNIT_ASSERT(expected == output);
+	}
+	// header should be readable after it has been written
+	void test_vgm_stream_peek()
+	{
+		std::stringstream stream;
+		VGM_Writer vgm(stream, 0x61, 0x80);
+		write_test_data(vgm);
+		CPPUNIT_ASSERT_EQUAL((uint32_t) 250000, vgm.peek32(0x18));
+		CPPUNIT_ASSERT_EQUAL((uint32_t) 75000, vgm.peek32(0x20));
+		CPPUNIT_ASSERT_THROW(vgm.peek32(0x100), std::out_of_range);
+	}
+	// only ROM datablocks have the size and offset header
+	void test_vgm_datablock()
+	{
+		auto vgm = VGM_Writer("", 0x61, 0x40);
+		std::vector<uint8_t> db = {0x12, 0x34};
+		vgm.datablock(0x00, db.size(), db.data(), db.size());
+		vgm.datablock(0x80, db.size(), db.data(), 0x1000, 0xffffffff, 0, 0x100);
+		auto output = vgm.get_buffer();
+		std::vector<uint8_t> expected = {
+			0x67, 0x66, 0x00, 0x02, 0x00, 0x00, 0x00, 0x12, 0x34,
+			0x67, 0x66, 0x80, 0x0a, 0x00, 0x00, 0x00,
+			0x00, 0x10, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x12, 0x34};
+		CPPUNIT_ASSERT(expected == std::vector<uint8_t>(output.begin() + 0x40, output.end()));
+	}
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(VGM_Writer_Test);
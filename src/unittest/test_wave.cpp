@@ -0,0 +1,239 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <fstream>
+#include <cstdio>
+#include "../input.h"
+#include "../wave.h"
+
+class Wave_Bank_Test : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(Wave_Bank_Test);
+	CPPUNIT_TEST(test_duplicate);
+	CPPUNIT_TEST(test_duplicate_prefix);
+	CPPUNIT_TEST(test_no_partial_sharing);
+	CPPUNIT_TEST(test_share_suffix);
+	CPPUNIT_TEST(test_share_overlap);
+	CPPUNIT_TEST(test_share_overlap_longest);
+	CPPUNIT_TEST(test_share_bank_boundary);
+	CPPUNIT_TEST(test_wasted_bytes);
+	CPPUNIT_TEST(test_pack);
+	CPPUNIT_TEST(test_pack_least_used_last);
+	CPPUNIT_TEST(test_pack_duplicate);
+	CPPUNIT_TEST(test_pack_no_fit);
+	CPPUNIT_TEST_SUITE_END();
+private:
+	Wave_Bank *wave_bank;
+
+	unsigned int add(const std::vector<uint8_t>& data)
+	{
+		Wave_Bank::Sample header = {0, 0, (uint32_t)data.size(), 0, 0, 17500, 0, 0};
+		return wave_bank->add_sample(header, data);
+	}
+	uint32_t position(unsigned int id)
+	{
+		return wave_bank->get_sample_headers().at(id).position;
+	}
+	unsigned int used_bytes()
+	{
+		return wave_bank->get_rom_data().size() - wave_bank->get_free_bytes();
+	}
+public:
+	void setUp()
+	{
+		wave_bank = new Wave_Bank(0x100, 0x10);
+	}
+	void tearDown()
+	{
+		delete wave_bank;
+	}
+	void test_duplicate()
+	{
+		CPPUNIT_ASSERT_EQUAL(0u, add({1,2,3,4}));
+		CPPUNIT_ASSERT_EQUAL(1u, add({5,6,7,8}));
+		CPPUNIT_ASSERT_EQUAL(0u, add({1,2,3,4}));
+		CPPUNIT_ASSERT_EQUAL(1u, add({5,6,7,8}));
+		CPPUNIT_ASSERT_EQUAL(8u, used_bytes());
+		CPPUNIT_ASSERT_EQUAL(2u, wave_bank->get_duplicate_count());
+		CPPUNIT_ASSERT_EQUAL(8u, wave_bank->get_duplicate_bytes());
+	}
+	void test_duplicate_prefix()
+	{
+		add({1,2,3,4,5,6});
+		CPPUNIT_ASSERT_EQUAL(1u, add({1,2,3}));
+		CPPUNIT_ASSERT_EQUAL(0u, position(1));
+		CPPUNIT_ASSERT_EQUAL(6u, used_bytes());
+	}
+	void test_no_partial_sharing()
+	{
+		add({1,2,3,4,5,6});
+		add({4,5,6});
+		add({6,7,8});
+		CPPUNIT_ASSERT_EQUAL(12u, used_bytes());
+		CPPUNIT_ASSERT_EQUAL(0u, wave_bank->get_shared_count());
+	}
+	void test_share_suffix()
+	{
+		wave_bank->set_partial_sharing(true);
+		add({1,2,3,4,5,6});
+		add({4,5,6});
+		CPPUNIT_ASSERT_EQUAL(3u, position(1));
+		CPPUNIT_ASSERT_EQUAL(6u, used_bytes());
+		CPPUNIT_ASSERT_EQUAL(1u, wave_bank->get_shared_count());
+		CPPUNIT_ASSERT_EQUAL(3u, wave_bank->get_shared_bytes());
+	}
+	void test_share_overlap()
+	{
+		wave_bank->set_partial_sharing(true);
+		add({1,2,3,4,5,6});
+		add({5,6,7,8});
+		CPPUNIT_ASSERT_EQUAL(4u, position(1));
+		CPPUNIT_ASSERT_EQUAL(8u, used_bytes());
+		CPPUNIT_ASSERT_EQUAL(2u, wave_bank->get_shared_bytes());
+		std::vector<uint8_t> expected = {1,2,3,4,5,6,7,8};
+		CPPUNIT_ASSERT(std::equal(expected.begin(), expected.end(), wave_bank->get_rom_data().begin()));
+		// the new data should be found by later duplicates
+		CPPUNIT_ASSERT_EQUAL(1u, add({5,6,7,8}));
+	}
+	// the longest overlap is used when several overlaps match
+	void test_share_overlap_longest()
+	{
+		wave_bank->set_partial_sharing(true);
+		add({0,0,0,1,0,0});
+		add({0,0,1,0,0,2});
+		CPPUNIT_ASSERT_EQUAL(1u, position(1));
+		CPPUNIT_ASSERT_EQUAL(7u, used_bytes());
+		add({0,2,0,2,0,3});
+		CPPUNIT_ASSERT_EQUAL(5u, position(2));
+		CPPUNIT_ASSERT_EQUAL(11u, used_bytes());
+	}
+	void test_share_bank_boundary()
+	{
+		wave_bank->set_partial_sharing(true);
+		add({1,2,3,4,5,6,7,8,9,10,11,12});
+		// sharing would cross the bank boundary at 0x10
+		add({11,12,13,14,15,16});
+		CPPUNIT_ASSERT_EQUAL(0x10u, position(1));
+		CPPUNIT_ASSERT_EQUAL(0u, wave_bank->get_shared_count());
+	}
+	void test_wasted_bytes()
+	{
+		add({1,1,1,1,1,1,1});
+		add({2,2,2,2,2,2,2});
+		add({3,3,3,3,3,3,3,3});
+		add({4,4,4,4,4,4,4,4});
+		CPPUNIT_ASSERT_EQUAL(0x28u, used_bytes());
+		auto wasted = wave_bank->get_wasted_bytes();
+		CPPUNIT_ASSERT_EQUAL((size_t)3, wasted.size());
+		CPPUNIT_ASSERT_EQUAL(2u, wasted[0]);
+		CPPUNIT_ASSERT_EQUAL(8u, wasted[1]);
+		CPPUNIT_ASSERT_EQUAL(0u, wasted[2]);
+	}
+	void test_pack()
+	{
+		wave_bank->set_deferred_packing(true);
+		add({1,1,1,1,1,1,1});
+		add({2,2,2,2,2,2,2});
+		add({3,3,3,3,3,3,3,3});
+		add({4,4,4,4,4,4,4,4});
+		CPPUNIT_ASSERT_EQUAL(0u, used_bytes());
+		wave_bank->pack();
+		CPPUNIT_ASSERT_EQUAL(0x1fu, used_bytes());
+		CPPUNIT_ASSERT_EQUAL(0x08u, position(0));
+		CPPUNIT_ASSERT_EQUAL(0x18u, position(1));
+		CPPUNIT_ASSERT_EQUAL(0x00u, position(2));
+		CPPUNIT_ASSERT_EQUAL(0x10u, position(3));
+		CPPUNIT_ASSERT_EQUAL((uint8_t)2, wave_bank->get_rom_data().at(0x18));
+		auto wasted = wave_bank->get_wasted_bytes();
+		CPPUNIT_ASSERT_EQUAL((size_t)2, wasted.size());
+		CPPUNIT_ASSERT_EQUAL(1u, wasted[0]);
+		CPPUNIT_ASSERT_EQUAL(0u, wasted[1]);
+	}
+	void test_pack_least_used_last()
+	{
+		wave_bank->set_deferred_packing(true);
+		add(std::vector<uint8_t>(14, 1));
+		add(std::vector<uint8_t>(3, 2));
+		add(std::vector<uint8_t>(3, 3));
+		add(std::vector<uint8_t>(9, 4));
+		wave_bank->pack();
+		CPPUNIT_ASSERT_EQUAL(0x10u, position(0));
+		CPPUNIT_ASSERT_EQUAL(0x1eu, used_bytes());
+	}
+	void test_pack_duplicate()
+	{
+		wave_bank->set_deferred_packing(true);
+		CPPUNIT_ASSERT_EQUAL(0u, add({1,2,3,4}));
+		CPPUNIT_ASSERT_EQUAL(1u, add({5,6,7,8,9}));
+		CPPUNIT_ASSERT_EQUAL(0u, add({1,2,3,4}));
+		wave_bank->pack();
+		CPPUNIT_ASSERT_EQUAL(9u, used_bytes());
+		CPPUNIT_ASSERT_EQUAL(5u, position(0));
+		CPPUNIT_ASSERT_EQUAL(1u, wave_bank->get_duplicate_count());
+		// samples added after packing are placed after the existing data
+		add({10,11});
+		wave_bank->pack();
+		CPPUNIT_ASSERT_EQUAL(9u, position(2));
+		CPPUNIT_ASSERT_EQUAL(11u, used_bytes());
+	}
+	void test_pack_no_fit()
+	{
+		delete wave_bank;
+		wave_bank = new Wave_Bank(0x20, 0x10);
+		wave_bank->set_deferred_packing(true);
+		add({1,1,1,1,1,1,1,1});
+		add({2,2,2,2,2,2,2,2});
+		add({3,3,3,3,3,3,3,3});
+		CPPUNIT_ASSERT_THROW(wave_bank->pack(), InputError);
+	}
+};
+
+class Wave_Cache_Test : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(Wave_Cache_Test);
+	CPPUNIT_TEST(test_cache);
+	CPPUNIT_TEST(test_modified_same_size);
+	CPPUNIT_TEST_SUITE_END();
+private:
+	Wave_Cache *cache;
+
+	// Write an 8-bit mono wave file
+	void write_wave(const std::vector<uint8_t>& samples)
+	{
+		std::vector<uint8_t> data = {
+			'R','I','F','F', 0,0,0,0, 'W','A','V','E',
+			'f','m','t',' ', 16,0,0,0, 1,0, 1,0, 0x44,0xac,0,0, 0x44,0xac,0,0, 1,0, 8,0,
+			'd','a','t','a', (uint8_t)samples.size(),0,0,0};
+		data.insert(data.end(), samples.begin(), samples.end());
+		data[4] = data.size() - 8;
+		std::ofstream out("cache_test.wav", std::ios::binary);
+		out.write((char*)data.data(), data.size());
+	}
+public:
+	void setUp()
+	{
+		cache = new Wave_Cache();
+	}
+	void tearDown()
+	{
+		delete cache;
+		std::remove("cache_test.wav");
+	}
+	void test_cache()
+	{
+		write_wave({0x80, 0x90, 0xa0, 0xb0});
+		auto file = cache->read("cache_test.wav");
+		CPPUNIT_ASSERT(file != nullptr);
+		CPPUNIT_ASSERT(file == cache->read("cache_test.wav"));
+		CPPUNIT_ASSERT(cache->read("missing_file.wav") == nullptr);
+	}
+	// the modification time may not change if the file is saved twice quickly
+	void test_modified_same_size()
+	{
+		write_wave({0x80, 0x90, 0xa0, 0xb0});
+		auto file = cache->read("cache_test.wav");
+		write_wave({0x80, 0x70, 0x60, 0x50});
+		CPPUNIT_ASSERT(file != cache->read("cache_test.wav"));
+	}
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(Wave_Bank_Test);
+CPPUNIT_TEST_SUITE_REGISTRATION(Wave_Cache_Test);
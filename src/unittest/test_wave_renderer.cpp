@@ -0,0 +1,127 @@
+#include <cppunit/extensions/HelperMacros.h>
+#include <sstream>
+#include "../wave_renderer.h"
+#include "../util.h"
+
+class Wave_Renderer_Test : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(Wave_Renderer_Test);
+	CPPUNIT_TEST(test_header);
+	CPPUNIT_TEST(test_silence);
+	CPPUNIT_TEST(test_psg_tone);
+	CPPUNIT_TEST(test_fm_key_on);
+	CPPUNIT_TEST(test_dac_stream);
+	CPPUNIT_TEST_SUITE_END();
+private:
+	std::stringstream *stream;
+	Wave_Renderer *wav;
+
+	std::vector<uint8_t> get_output()
+	{
+		wav->stop();
+		std::string str = stream->str();
+		return std::vector<uint8_t>(str.begin(), str.end());
+	}
+	// Returns the left channel samples
+	std::vector<int16_t> get_samples()
+	{
+		auto data = get_output();
+		std::vector<int16_t> samples;
+		for(uint32_t pos = 44; pos + 4 <= data.size(); pos += 4)
+			samples.push_back(data[pos] | (data[pos+1] << 8));
+		return samples;
+	}
+	int32_t peak(const std::vector<int16_t>& samples, uint32_t start = 0)
+	{
+		int32_t max = 0;
+		for(uint32_t i = start; i < samples.size(); i++)
+			max = std::max(max, std::abs(samples[i]));
+		return max;
+	}
+	// Sets up an FM channel with a sine wave carrier
+	void fm_setup(uint8_t ch)
+	{
+		wav->write(0x52, 0, 0xb0 + ch, 0x07); // algorithm 7
+		wav->write(0x52, 0, 0xb4 + ch, 0xc0);
+		for(int op = 0; op < 16; op += 4)
+		{
+			wav->write(0x52, 0, 0x30 + op + ch, 0x01);
+			wav->write(0x52, 0, 0x40 + op + ch, (op == 12) ? 0x00 : 0x7f);
+			wav->write(0x52, 0, 0x50 + op + ch, 0x1f);
+			wav->write(0x52, 0, 0x60 + op + ch, 0x00);
+			wav->write(0x52, 0, 0x70 + op + ch, 0x00);
+			wav->write(0x52, 0, 0x80 + op + ch, 0x0f);
+		}
+		wav->write(0x52, 0, 0xa4 + ch, 0x22);
+		wav->write(0x52, 0, 0xa0 + ch, 0x69);
+	}
+public:
+	void setUp()
+	{
+		stream = new std::stringstream();
+		wav = new Wave_Renderer(*stream);
+	}
+	void tearDown()
+	{
+		delete wav;
+		delete stream;
+	}
+	void test_header()
+	{
+		wav->delay(100);
+		wav->delay(0.5);
+		wav->delay(0.5);
+		auto data = get_output();
+		CPPUNIT_ASSERT_EQUAL((size_t)44 + 101 * 4, data.size());
+		CPPUNIT_ASSERT_EQUAL((uint32_t)0x52494646, read_be32(data, 0));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)data.size() - 8, read_le32(data, 4));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)0x57415645, read_be32(data, 8));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)44100, read_le32(data, 24));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)0x64617461, read_be32(data, 36));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)101 * 4, read_le32(data, 40));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)101, wav->get_sample_count());
+	}
+	void test_silence()
+	{
+		wav->delay(1000);
+		CPPUNIT_ASSERT_EQUAL(0, peak(get_samples()));
+	}
+	void test_psg_tone()
+	{
+		wav->write(0x50, 0, 0, 0x8e); // channel 0 period 0x0fe (~440 Hz)
+		wav->write(0x50, 0, 0, 0x0f);
+		wav->write(0x50, 0, 0, 0x90); // full volume
+		wav->delay(4410);
+		auto samples = get_samples();
+		CPPUNIT_ASSERT_EQUAL(2048, peak(samples));
+		// count the sign changes (two per period)
+		int crossings = 0;
+		for(uint32_t i = 1; i < samples.size(); i++)
+			crossings += (samples[i] > 0) != (samples[i-1] > 0);
+		CPPUNIT_ASSERT(crossings >= 86 && crossings <= 90);
+	}
+	void test_fm_key_on()
+	{
+		fm_setup(0);
+		wav->delay(441);
+		wav->write(0x52, 0, 0x28, 0xf0);
+		wav->delay(4410);
+		auto samples = get_samples();
+		CPPUNIT_ASSERT_EQUAL(0, peak(std::vector<int16_t>(samples.begin(), samples.begin() + 441)));
+		CPPUNIT_ASSERT(peak(samples, 441) > 3000);
+	}
+	void test_dac_stream()
+	{
+		std::vector<uint8_t> data(1000, 0xc0);
+		wav->datablock(0x00, data.size(), data.data(), data.size());
+		wav->dac_setup(0x00, 0x02, 0x00, 0x2a, 0x00);
+		wav->write(0x52, 0, 0x2b, 0x80);
+		wav->dac_start(0x00, 0, data.size(), 8000);
+		wav->delay(441);
+		auto samples = get_samples();
+		// (0xc0 - 0x80) << 6, halved when mixed
+		CPPUNIT_ASSERT_EQUAL(2048, (int)samples.back());
+	}
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(Wave_Renderer_Test);
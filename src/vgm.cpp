@@ -6,6 +6,7 @@
 #include <cstring>
 #include <cmath>
 #include <ctime>
+#include <stdexcept>
 
 #if defined(_WIN32)
 #include <windows.h>
@@ -15,6 +16,7 @@
 
 #include <clocale>
 #include <cwchar>
+#include <mutex>
 
 #include "vgm.h"
 
@@ -26,6 +28,10 @@ void VGM_Interface::stop()
 {
 }
 
+void VGM_Interface::delay(double count)
+{
+}
+
 //=====================================================================
 
 //! Constructs a VGM_Writer.
@@ -33,20 +39,61 @@ void VGM_Interface::stop()
  * \param filename If blank, no file is written to the disk.
  * \param version Minor part of the VGM file version. Major version 0x1 is always written.
  * \param header_size the size of the VGM file header.
+ * \param streaming If set, the file is written while the VGM is being generated.
+ *                  The file is then written even if the VGM is not completed.
  */
-VGM_Writer::VGM_Writer(const char* filename, int version, int header_size)
+VGM_Writer::VGM_Writer(const char* filename, int version, int header_size, bool streaming)
 	: filename(filename),
 	completed(0),
+	buffer_start(0),
+	header(),
+	file(),
+	stream(nullptr),
+	stream_start(0),
+	curr_delay(0),
+	sample_count(0),
+	loop_sample(0)
+{
+	if(streaming && this->filename.size())
+	{
+		std::cout << "Writing " << filename << "...\n";
+		file = std::make_shared<std::ofstream>(filename, std::ios::binary);
+		stream = file.get();
+	}
+	init(version, header_size);
+}
+
+//! Constructs a streaming VGM_Writer.
+/*!
+ * \param stream Output stream. Must be seekable.
+ * \param version Minor part of the VGM file version. Major version 0x1 is always written.
+ * \param header_size the size of the VGM file header.
+ */
+VGM_Writer::VGM_Writer(std::ostream& stream, int version, int header_size)
+	: filename(),
+	completed(0),
+	buffer_start(0),
+	header(),
+	file(),
+	stream(&stream),
+	stream_start(stream.tellp()),
 	curr_delay(0),
 	sample_count(0),
 	loop_sample(0)
+{
+	init(version, header_size);
+}
+
+void VGM_Writer::init(int version, int header_size)
 {
 	// create initial buffer
-	buffer = (uint8_t*) std::calloc(initial_buffer_alloc, sizeof(uint8_t));
+	buffer_alloc = stream ? stream_buffer_alloc : initial_buffer_alloc;
+	if((int)buffer_alloc < header_size)
+		buffer_alloc = header_size;
+	buffer = (uint8_t*) std::calloc(buffer_alloc, sizeof(uint8_t));
 	if(!buffer)
 		throw std::bad_alloc();
 	buffer_pos = buffer;
-	buffer_alloc = initial_buffer_alloc;
 
 	// vgm magic
 	my_memcpy((uint32_t*)"Vgm ", 4);
@@ -63,20 +110,25 @@ VGM_Writer::VGM_Writer(const char* filename, int version, int header_size)
 VGM_Writer::~VGM_Writer()
 {
 	poke32(0x04, get_position() - 4);
-	if(filename.size() && completed)
+	if(stream)
+	{
+		flush();
+		patch(0, header.data(), header.size());
+	}
+	else if(filename.size() && completed)
 	{
 		std::cout << "Writing " << filename << "...\n";
 		auto output = std::ofstream(filename, std::ios::binary);
 		output.write((char*)buffer, get_position());
-		std::free(buffer);
 	}
+	std::free(buffer);
 }
 
 //! Write a command.
 void VGM_Writer::write(uint8_t command, uint16_t port, uint16_t reg, uint16_t data)
 {
-	reserve(100);
 	add_delay();
+	reserve(100);
 
 	if(command == 0xe1) // C352
 	{
@@ -109,8 +161,8 @@ void VGM_Writer::write(uint8_t command, uint16_t port, uint16_t reg, uint16_t da
 //! DAC stream setup
 void VGM_Writer::dac_setup(uint8_t sid, uint8_t chip_id, uint32_t port, uint32_t reg, uint8_t db_id)
 {
-	reserve(100);
 	add_delay();
+	reserve(100);
 	*buffer_pos++ = 0x90;
 	*buffer_pos++ = sid;
 	*buffer_pos++ = chip_id;
@@ -126,8 +178,8 @@ void VGM_Writer::dac_setup(uint8_t sid, uint8_t chip_id, uint32_t port, uint32_t
 //! DAC stream playback
 void VGM_Writer::dac_start(uint8_t sid, uint32_t start, uint32_t length, uint32_t freq)
 {
-	reserve(100);
 	add_delay();
+	reserve(100);
 	*buffer_pos++ = 0x92;
 	*buffer_pos++ = sid;
 	*buffer_pos++ = freq & 0xff;
@@ -150,8 +202,8 @@ void VGM_Writer::dac_start(uint8_t sid, uint32_t start, uint32_t length, uint32_
 //! DAC stream playback
 void VGM_Writer::dac_stop(uint8_t sid)
 {
-	reserve(100);
 	add_delay();
+	reserve(100);
 	*buffer_pos++ = 0x94;
 	*buffer_pos++ = sid;
 }
@@ -170,8 +222,19 @@ void VGM_Writer::set_loop()
  */
 void VGM_Writer::datablock(uint8_t dbtype, uint32_t dbsize, const uint8_t* db, uint32_t maxsize, uint32_t mask, uint32_t flags, uint32_t offset)
 {
-	reserve(dbsize + 100);
+	if(stream && dbsize + 100 > buffer_alloc)
+	{
+		// Write large datablocks directly
+		add_delay();
+		reserve(100);
+		add_datablockcmd(dbtype, dbsize | flags, maxsize, offset);
+		flush();
+		stream->write((const char*)db, dbsize);
+		buffer_start += dbsize;
+		return;
+	}
 	add_delay();
+	reserve(dbsize + 100);
 	add_datablockcmd(dbtype, dbsize | flags, maxsize, offset);
 	for(uint32_t i = 0; i < dbsize; i++)
 	{
@@ -189,6 +252,7 @@ void VGM_Writer::delay(double count)
 void VGM_Writer::stop()
 {
 	add_delay();
+	reserve(100);
 	*buffer_pos++ = 0x66;
 	poke32(0x18, sample_count);
 	if(loop_sample)
@@ -199,19 +263,28 @@ void VGM_Writer::stop()
 //! Write a long to the vgm buffer
 void VGM_Writer::poke32(uint32_t offset, uint32_t data)
 {
-	*(uint32_t*)(buffer+offset) = data;
+	if(auto ptr = get_pointer(offset, 4))
+		*(uint32_t*)ptr = data;
+	else
+		patch(offset, &data, 4);
 }
 
 //! Write a short to the vgm buffer
 void VGM_Writer::poke16(uint32_t offset, uint16_t data)
 {
-	*(uint16_t*)(buffer+offset) = data;
+	if(auto ptr = get_pointer(offset, 2))
+		*(uint16_t*)ptr = data;
+	else
+		patch(offset, &data, 2);
 }
 
 //! Write a char to the vgm buffer
 void VGM_Writer::poke8(uint32_t offset, uint8_t data)
 {
-	*(uint8_t*)(buffer+offset) = data;
+	if(auto ptr = get_pointer(offset, 1))
+		*ptr = data;
+	else
+		patch(offset, &data, 1);
 }
 
 //! Write GD3 tags. Only call this after calling VGM_Writer::stop().
@@ -220,9 +293,14 @@ void VGM_Writer::write_tag(const VGM_Tag& tag)
 	reserve(2000);
 	std::time_t t;
 	std::time(&t);
-	std::tm* tm = std::localtime(&t);
+	std::tm tm;
+#if defined(_WIN32)
+	localtime_s(&tm, &t);
+#else
+	localtime_r(&t, &tm);
+#endif
 	char ts[32];
-	std::strftime(ts,32,"%Y-%m-%d %H:%M:%S",tm);
+	std::strftime(ts,32,"%Y-%m-%d %H:%M:%S",&tm);
 	std::string tracknotes = "ctrmml (built " __DATE__ " " __TIME__ ")";
 	poke32(0x14, get_position()-0x14);
 	my_memcpy((uint8_t*)"Gd3 \x00\x01\x00\x00", 8);
@@ -253,7 +331,7 @@ void VGM_Writer::write_tag(const VGM_Tag& tag)
 //! Gets the current buffer position
 uint32_t VGM_Writer::get_position() const
 {
-	return buffer_pos - buffer;
+	return buffer_start + (buffer_pos - buffer);
 }
 
 //! Gets the current sample position
@@ -269,32 +347,87 @@ uint32_t VGM_Writer::get_loop_sample() const
 }
 
 //! Return a long from the vgm buffer
+/*!
+ *  In streaming mode, only the header and the data that has not yet
+ *  been written can be read.
+ *
+ *  \exception std::out_of_range if the data has already been written.
+ */
 uint32_t VGM_Writer::peek32(uint32_t offset) const
 {
-	return *(uint32_t*)(buffer+offset);
+	if(auto ptr = get_pointer(offset, 4))
+		return *(uint32_t*)ptr;
+	throw std::out_of_range("VGM_Writer::peek32");
 }
 
 //! Return a short from the vgm buffer
 uint16_t VGM_Writer::peek16(uint32_t offset) const
 {
-	return *(uint16_t*)(buffer+offset);
+	if(auto ptr = get_pointer(offset, 2))
+		return *(uint16_t*)ptr;
+	throw std::out_of_range("VGM_Writer::peek16");
 }
 
 //! Return a char from the vgm buffer
 uint8_t VGM_Writer::peek8(uint32_t offset) const
 {
-	return *(uint8_t*)(buffer+offset);
+	if(auto ptr = get_pointer(offset, 1))
+		return *ptr;
+	throw std::out_of_range("VGM_Writer::peek8");
 }
 
 //! Get the VGM buffer.
+/*!
+ *  \exception std::logic_error if called in streaming mode.
+ */
 std::vector<uint8_t> VGM_Writer::get_buffer()
 {
+	if(stream)
+		throw std::logic_error("VGM_Writer::get_buffer not available in streaming mode");
+
 	if(completed)
 		poke32(0x04, get_position() - 4);
 
 	return std::vector<uint8_t>(buffer, buffer + get_position());
 }
 
+//! Write the buffer to the output stream (streaming mode only).
+void VGM_Writer::flush()
+{
+	uint32_t size = buffer_pos - buffer;
+	// Keep a copy of the header so that it can be patched later
+	if(buffer_start == 0 && header.empty())
+	{
+		uint32_t header_size = peek32(0x34) + 0x34;
+		header.assign(buffer, buffer + header_size);
+	}
+	stream->write((char*)buffer, size);
+	buffer_start += size;
+	buffer_pos = buffer;
+}
+
+//! Get a pointer to the data at the specified file offset.
+/*!
+ *  Returns nullptr if the data has already been written.
+ */
+uint8_t* VGM_Writer::get_pointer(uint32_t offset, uint32_t size) const
+{
+	if(offset >= buffer_start)
+		return buffer + (offset - buffer_start);
+	else if(offset + size <= header.size())
+		return const_cast<uint8_t*>(header.data()) + offset;
+	return nullptr;
+}
+
+//! Overwrite data that has already been written to the output stream.
+void VGM_Writer::patch(uint32_t offset, const void* data, uint32_t size)
+{
+	auto end = stream->tellp();
+	stream->seekp(stream_start + (std::streamoff)offset);
+	stream->write((const char*)data, size);
+	stream->seekp(end);
+}
+
 void VGM_Writer::my_memcpy(void* src, int size)
 {
 	std::memcpy(buffer_pos,src,size);
@@ -306,6 +439,13 @@ void VGM_Writer::add_datablockcmd(uint8_t dtype, uint32_t size, uint32_t romsize
 	*buffer_pos++ = 0x67;
 	*buffer_pos++ = 0x66;
 	*buffer_pos++ = dtype;
+	// Only ROM/RAM dumps have the size and offset header. Stream data
+	// is appended to the data bank as is.
+	if((dtype & 0xc0) != 0x80)
+	{
+		my_memcpy((uint32_t*)&size,4);
+		return;
+	}
 	size += 8;
 	my_memcpy((uint32_t*)&size,4);
 	my_memcpy((uint32_t*)&romsize,4);
@@ -323,6 +463,8 @@ void VGM_Writer::add_delay()
 		int commandcount = delay/65535;
 		uint16_t finalcommand = delay%65535;
 
+		reserve(commandcount * 3 + 3);
+
 		while(commandcount)
 		{
 			*buffer_pos++ = 0x61;
@@ -361,8 +503,10 @@ void VGM_Writer::add_gd3(const char* s)
 			buffer_pos += 2;
 	}
 #else
-	std::setlocale(LC_ALL, "en_US.utf8");
-	static std::mbstate_t mbstate;
+	// setlocale is not thread safe, so only call it once
+	static std::once_flag locale_flag;
+	std::call_once(locale_flag, []() { std::setlocale(LC_ALL, "en_US.utf8"); });
+	std::mbstate_t mbstate = {};
 	while((l = std::mbrtoc16((char16_t*)buffer_pos,s,max,&mbstate)))
 	{
 		if(l == -1 || l == -2)
@@ -382,15 +526,18 @@ void VGM_Writer::add_gd3(const char* s)
 
 void VGM_Writer::reserve(uint32_t bytes)
 {
+	// write buffer to the stream if possible
+	if(stream && (buffer_alloc - (buffer_pos - buffer)) < bytes)
+		flush();
 	// resize buffer if needed
-	while((buffer_alloc - get_position()) < bytes)
+	while((buffer_alloc - (buffer_pos - buffer)) < bytes)
 	{
 		uint8_t* temp;
 		temp = (uint8_t*)realloc(buffer,buffer_alloc*2);
 		if(temp)
 		{
 			buffer_alloc *= 2;
-			buffer_pos = temp+get_position();
+			buffer_pos = temp+(buffer_pos - buffer);
 			buffer = temp;
 		}
 		else
@@ -4,6 +4,8 @@
 #include "core.h"
 #include <vector>
 #include <string>
+#include <memory>
+#include <ios>
 
 //! Structure for song tags
 struct VGM_Tag
@@ -51,6 +53,9 @@ class VGM_Interface
 		//! Indicate that playback or logging should be stopped.
 		virtual void stop();
 
+		//! Wait for a number of 44.1kHz samples.
+		virtual void delay(double count);
+
 		//! Add a datablock
 		virtual void datablock(
 			uint8_t dbtype,
@@ -63,10 +68,18 @@ class VGM_Interface
 };
 
 //! Writes VGM files.
+/*!
+ *  By default the whole VGM is kept in memory and written to the file
+ *  when the VGM_Writer is destroyed. In streaming mode, the data is
+ *  instead written to the output in chunks, and the header is patched
+ *  when the VGM_Writer is destroyed. The output stream must be
+ *  seekable.
+ */
 class VGM_Writer : public VGM_Interface
 {
 	public:
-		VGM_Writer(const char* filename, int version = 0x61, int header_size = 0x80);
+		VGM_Writer(const char* filename, int version = 0x61, int header_size = 0x80, bool streaming = false);
+		VGM_Writer(std::ostream& stream, int version = 0x61, int header_size = 0x80);
 		virtual ~VGM_Writer();
 
 		// Methods to write VGM register events
@@ -86,7 +99,7 @@ class VGM_Writer : public VGM_Interface
 			uint32_t offset = 0) override;
 
 		// Methods to write VGM control events
-		void delay(double count);
+		void delay(double count) override;
 		void stop();
 
 		// Methods to write VGM header
@@ -110,7 +123,12 @@ class VGM_Writer : public VGM_Interface
 
 	private:
 		static const uint32_t initial_buffer_alloc = 100000;
+		static const uint32_t stream_buffer_alloc = 0x10000;
 
+		void init(int version, int header_size);
+		void flush();
+		uint8_t* get_pointer(uint32_t offset, uint32_t size) const;
+		void patch(uint32_t offset, const void* data, uint32_t size);
 		void my_memcpy(void* src, int size);
 		void add_datablockcmd(uint8_t dtype, uint32_t size, uint32_t romsize, uint32_t offset);
 		void add_delay();
@@ -122,6 +140,13 @@ class VGM_Writer : public VGM_Interface
 		uint8_t* buffer;
 		uint8_t* buffer_pos;
 		uint32_t buffer_alloc;
+		//! File position of the start of the buffer (streaming mode only)
+		uint32_t buffer_start;
+		//! Copy of the VGM header, once it has been flushed
+		std::vector<uint8_t> header;
+		std::shared_ptr<std::ofstream> file;
+		std::ostream* stream;
+		std::streampos stream_start;
 		double curr_delay;
 		uint32_t sample_count;
 		uint32_t loop_sample;
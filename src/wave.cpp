@@ -21,6 +21,18 @@ static bool operator==(const Wave_Bank::Sample& s1, const Wave_Bank::Sample& s2)
 	return s1.to_bytes() == s2.to_bytes();
 }
 
+// FNV-1a hash, used to index the sample data
+static uint32_t fingerprint(const std::vector<uint8_t>& data)
+{
+	uint32_t hash = 2166136261u;
+	for(auto&& i : data)
+	{
+		hash ^= i;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
 //=====================================================================
 
 Wave_File::Wave_File(uint16_t channels, uint32_t rate, uint16_t bits)
@@ -183,9 +195,59 @@ uint32_t Wave_File::parse_chunk(const uint8_t *fdata)
 	return chunksize;
 }
 
+//=====================================================================
+
+//! Read a wave file, or get it from the cache if it hasn't changed.
+/*!
+ *  The file contents are compared using their size and hash, since
+ *  the modification time may not have enough resolution to detect a
+ *  file that was saved twice within a short time.
+ *
+ *  \return nullptr if the file could not be read.
+ */
+std::shared_ptr<const Wave_File> Wave_Cache::read(const std::string& filename)
+{
+	std::vector<uint8_t> data;
+	if(std::ifstream is{filename, std::ios::binary|std::ios::ate})
+	{
+		data.resize(is.tellg());
+		is.seekg(0);
+		if(!is.read((char*)data.data(), data.size()))
+			return nullptr;
+	}
+	else
+	{
+		return nullptr;
+	}
+	uint32_t hash = fingerprint(data);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = files.find(filename);
+		if(it != files.end() && it->second.size == data.size() && it->second.hash == hash)
+			return it->second.file;
+	}
+	auto file = std::make_shared<Wave_File>();
+	if(file->read(filename))
+		return nullptr;
+	std::lock_guard<std::mutex> lock(mutex);
+	files[filename] = {data.size(), hash, file};
+	return file;
+}
+
+//! Get the names of the files in the cache.
+std::vector<std::string> Wave_Cache::get_filenames() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::vector<std::string> filenames;
+	for(auto&& i : files)
+		filenames.push_back(i.first);
+	return filenames;
+}
 
 //=====================================================================
 
+std::shared_ptr<Wave_Cache> Wave_Bank::cache;
+
 //! Creates a Wave_Bank
 Wave_Bank::Wave_Bank(unsigned long max_size, unsigned long bank_size)
 	: max_size(max_size)
@@ -194,6 +256,16 @@ Wave_Bank::Wave_Bank(unsigned long max_size, unsigned long bank_size)
 	, include_paths{""}
 	, rom_data()
 	, gaps()
+	, samples()
+	, sample_index()
+	, pending()
+	, pending_index()
+	, partial_sharing(false)
+	, deferred_packing(false)
+	, duplicate_count(0)
+	, duplicate_bytes(0)
+	, shared_count(0)
+	, shared_bytes(0)
 {
 	rom_data.resize(max_size, 0);
 	if(!bank_size)
@@ -206,47 +278,103 @@ Wave_Bank::~Wave_Bank()
 	return;
 }
 
+//! Set the wave file cache.
+/*!
+ *  The cache is shared by all Wave_Bank instances. This should be set
+ *  before any Wave_Bank is used.
+ *
+ *  \param cache Wave file cache, or nullptr to always read the files.
+ */
+void Wave_Bank::set_cache(std::shared_ptr<Wave_Cache> cache)
+{
+	Wave_Bank::cache = cache;
+}
+
+//! Read a wave file, using the cache if it is set.
+std::shared_ptr<const Wave_File> Wave_Bank::read_wave_file(const std::string& filename)
+{
+	if(cache)
+		return cache->read(filename);
+	auto file = std::make_shared<Wave_File>();
+	if(file->read(filename))
+		return nullptr;
+	return file;
+}
+
 //! Set a list of include paths to check when reading samples from a Tag.
 void Wave_Bank::set_include_paths(const Tag& tag)
 {
 	include_paths = tag;
 }
 
+//! Enable or disable partial sharing of sample data.
+/*!
+ *  If enabled, a new sample that matches the end of a sample already
+ *  in the ROM reuses that data. A new sample whose beginning matches
+ *  the end of the ROM data is appended so that the common part is
+ *  shared.
+ *
+ *  Samples that match the beginning of existing samples are always
+ *  shared.
+ *
+ *  Each new sample is compared with the end of every existing
+ *  sample, so adding a sample takes time proportional to the number
+ *  of samples times the sample size. The overlap with the end of the
+ *  ROM data is found in time proportional to the sample size.
+ */
+void Wave_Bank::set_partial_sharing(bool enable)
+{
+	partial_sharing = enable;
+}
+
+//! Enable or disable deferred packing.
+/*!
+ *  If enabled, samples are not placed in the ROM until pack() is
+ *  called. Until then, the position of the sample headers is not valid.
+ *  Only exact duplicates are shared in this mode.
+ */
+void Wave_Bank::set_deferred_packing(bool enable)
+{
+	deferred_packing = enable;
+}
+
 //! Convert and add sample to the waverom.
 unsigned int Wave_Bank::add_sample(const Tag& tag)
 {
-	int status = -1;
 	if(!tag.size())
 	{
 		error_message = "Incomplete sample definition";
 		throw InputError(nullptr, error_message.c_str());
 	}
 	std::string filename = tag[0];
-	Wave_File wf;
+	std::shared_ptr<const Wave_File> wf;
+	std::string wf_filename;
 	for(auto&& i : include_paths)
 	{
-		std::string fn = i + filename;
-		//std::cout << "attempt to load " << fn << "\n";
-		status = wf.read(fn);
-		if(status == 0)
+		wf_filename = i + filename;
+		//std::cout << "attempt to load " << wf_filename << "\n";
+		wf = read_wave_file(wf_filename);
+		if(wf)
 			break;
 	}
-	if(status)
+	if(!wf)
 	{
 		error_message = filename + " not found";
 		throw InputError(nullptr, error_message.c_str());
 	}
+	if(std::find(loaded_files.begin(), loaded_files.end(), wf_filename) == loaded_files.end())
+		loaded_files.push_back(wf_filename);
 
 	// convert sample
-	std::vector<uint8_t> sample = encode_sample("", wf.data[0]);
+	std::vector<uint8_t> sample = encode_sample("", wf->data[0]);
 	Wave_Bank::Sample header = {
 		0,
 		0,
-		wf.slength,
-		wf.lstart,
-		wf.lend,
-		wf.srate,
-		wf.transpose,
+		wf->slength,
+		wf->lstart,
+		wf->lend,
+		wf->srate,
+		wf->transpose,
 		0};
 
 	// Allow overriding the sample rate and setting start offset
@@ -274,11 +402,16 @@ unsigned int Wave_Bank::add_sample(const Tag& tag)
 //! Add sample to the waverom in raw format.
 unsigned int Wave_Bank::add_sample(Wave_Bank::Sample header, const std::vector<uint8_t>& sample)
 {
+	if(deferred_packing)
+		return add_pending_sample(header, sample);
+
 	// Find duplicates of sample data and selected header parameters if needed
 	int duplicate = find_duplicate(header, sample);
 
 	if(duplicate != -1)
 	{
+		duplicate_count++;
+		duplicate_bytes += header.size;
 		header.position = samples[duplicate].position;
 		auto result = std::find(samples.begin(), samples.end(), header);
 		if(result != samples.end())
@@ -293,6 +426,28 @@ unsigned int Wave_Bank::add_sample(Wave_Bank::Sample header, const std::vector<u
 			return samples.size() - 1;
 		}
 	}
+	uint32_t shared_pos = NO_FIT;
+	if(partial_sharing)
+		shared_pos = find_shared_position(header, sample);
+
+	if(shared_pos != NO_FIT)
+	{
+		// Share all or part of the sample data with the end of the ROM
+		// or the end of another sample.
+		uint32_t shared_size = std::min<uint32_t>(current_size - shared_pos, header.size);
+		if(shared_pos + header.size > current_size)
+		{
+			std::copy_n(sample.begin() + shared_size, header.size - shared_size, rom_data.begin() + current_size);
+			current_size = shared_pos + header.size;
+		}
+		printf("Share sample %d with ROM at %08x (size %08x, %d bytes shared)\n", (int)samples.size(), shared_pos, header.size, shared_size);
+		shared_count++;
+		shared_bytes += shared_size;
+		header.position = shared_pos;
+		sample_index[{sample.size(), fingerprint(sample)}].push_back(samples.size());
+		samples.push_back(header);
+		return samples.size() - 1;
+	}
 	else
 	{
 		// Create a new entry.
@@ -330,11 +485,110 @@ unsigned int Wave_Bank::add_sample(Wave_Bank::Sample header, const std::vector<u
 		printf("Append sample %d to ROM at %08x (size %08x)\n", samples.size(), start_pos, header.size);
 		std::copy_n(sample.begin(), header.size, rom_data.begin() + start_pos);
 		header.position = start_pos;
+		sample_index[{sample.size(), fingerprint(sample)}].push_back(samples.size());
 		samples.push_back(header);
 		return samples.size() - 1;
 	}
 }
 
+//! Place all samples added in deferred packing mode.
+/*!
+ *  Samples are sorted by size and then placed in the bank with the
+ *  least remaining space that can still fit the sample (best fit
+ *  decreasing). The least used bank is placed at the end, so that the
+ *  size of the ROM is as small as possible.
+ *
+ *  Samples are placed after any samples already in the ROM.
+ *
+ *  \exception InputError if the samples do not fit in the ROM.
+ */
+void Wave_Bank::pack()
+{
+	if(!pending.size())
+		return;
+
+	struct Bank
+	{
+		uint32_t start;
+		uint32_t fill;
+		std::vector<unsigned int> data;
+	};
+	std::vector<Bank> banks;
+	uint32_t first_bank = current_size / bank_size;
+	uint32_t bank_count = (max_size + bank_size - 1) / bank_size;
+
+	// The first bank may be partially used
+	if(current_size % bank_size)
+		banks.push_back({(uint32_t)(first_bank * bank_size), (uint32_t)(current_size % bank_size), {}});
+	uint32_t next_bank = first_bank + banks.size();
+
+	std::vector<unsigned int> order(pending.size());
+	for(unsigned int i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+		return pending[a].data.size() > pending[b].data.size();
+	});
+
+	for(auto&& id : order)
+	{
+		const Sample& header = samples[pending[id].samples[0]];
+		Bank* best_bank = nullptr;
+		for(auto&& bank : banks)
+		{
+			uint32_t start = bank.start + bank.fill;
+			if(fit_sample(header, start, max_size) != start)
+				continue;
+			if(!best_bank || bank.fill > best_bank->fill)
+				best_bank = &bank;
+		}
+		if(!best_bank)
+		{
+			uint32_t start = next_bank * bank_size;
+			if(next_bank >= bank_count || fit_sample(header, start, max_size) != start)
+			{
+				error_message = stringf("Sample does not fit in remaining ROM space (sample size is %d)", header.size);
+				throw InputError(nullptr, error_message.c_str());
+			}
+			banks.push_back({start, 0, {}});
+			best_bank = &banks.back();
+			next_bank++;
+		}
+		best_bank->data.push_back(id);
+		best_bank->fill += header.size;
+	}
+
+	// Move the least used of the new banks to the end
+	auto new_banks = banks.begin() + ((current_size % bank_size) ? 1 : 0);
+	if(new_banks != banks.end())
+	{
+		auto least_used = banks.end() - 1;
+		for(auto it = new_banks; it != banks.end(); it++)
+			if(it->fill < least_used->fill)
+				least_used = it;
+		std::swap(least_used->data, banks.back().data);
+		std::swap(least_used->fill, banks.back().fill);
+	}
+
+	// Copy the sample data
+	for(auto&& bank : banks)
+	{
+		uint32_t position = bank.start + (bank.start == first_bank * bank_size ? current_size % bank_size : 0);
+		for(auto&& id : bank.data)
+		{
+			auto& data = pending[id].data;
+			printf("Pack sample %d to ROM at %08x (size %08x)\n", pending[id].samples[0], position, (int)data.size());
+			std::copy(data.begin(), data.end(), rom_data.begin() + position);
+			for(auto&& sample_id : pending[id].samples)
+				samples[sample_id].position = position;
+			position += data.size();
+		}
+		if(position > current_size)
+			current_size = position;
+	}
+	pending.clear();
+	pending_index.clear();
+}
+
 //! Get sample headers
 const std::vector<Wave_Bank::Sample>& Wave_Bank::get_sample_headers()
 {
@@ -380,6 +634,67 @@ unsigned int Wave_Bank::get_largest_gap()
 	return largest_gap;
 }
 
+//! Get the number of added samples that were duplicates of existing samples.
+unsigned int Wave_Bank::get_duplicate_count()
+{
+	return duplicate_count;
+}
+
+//! Get the number of bytes saved by reusing duplicate samples.
+unsigned int Wave_Bank::get_duplicate_bytes()
+{
+	return duplicate_bytes;
+}
+
+//! Get the number of added samples that partially share data with the ROM.
+unsigned int Wave_Bank::get_shared_count()
+{
+	return shared_count;
+}
+
+//! Get the number of bytes saved by partial sharing.
+unsigned int Wave_Bank::get_shared_bytes()
+{
+	return shared_bytes;
+}
+
+//! Get the number of unused bytes in each bank.
+/*!
+ *  Bytes after the end of the used ROM space are not counted.
+ */
+std::vector<unsigned int> Wave_Bank::get_wasted_bytes()
+{
+	std::vector<std::pair<uint32_t, uint32_t>> used;
+	for(auto&& i : samples)
+		used.push_back({i.position, i.position + i.size});
+	std::sort(used.begin(), used.end());
+
+	unsigned int bank_count = (current_size + bank_size - 1) / bank_size;
+	std::vector<unsigned int> wasted(bank_count);
+	for(unsigned int i = 0; i < bank_count; i++)
+		wasted[i] = std::min<uint32_t>(bank_size, current_size - i * bank_size);
+
+	// Subtract the used areas, without counting overlaps twice
+	uint32_t end = 0;
+	for(auto&& i : used)
+	{
+		uint32_t start = std::max(i.first, end);
+		for(; start < i.second; start++)
+			wasted[start / bank_size]--;
+		end = std::max(end, i.second);
+	}
+	return wasted;
+}
+
+//! Get the filenames of the samples read from files.
+/*!
+ *  The include path is prepended to each filename.
+ */
+const std::vector<std::string>& Wave_Bank::get_loaded_files() const
+{
+	return loaded_files;
+}
+
 //! Get error message
 const std::string& Wave_Bank::get_error()
 {
@@ -455,6 +770,20 @@ uint32_t Wave_Bank::fit_sample(const Wave_Bank::Sample& header, uint32_t start,
  */
 int Wave_Bank::find_duplicate(const Wave_Bank::Sample& header, const std::vector<uint8_t>& sample) const
 {
+	// Look up samples that were added with the same data first.
+	auto search = sample_index.find({sample.size(), fingerprint(sample)});
+	if(search != sample_index.end())
+	{
+		for(auto&& id : search->second)
+		{
+			const Sample& i = samples[id];
+			if(   i.position + sample.size() <= rom_data.size()
+			   && i.loop_start <= header.loop_start
+			   && !memcmp(&sample[0], &rom_data[i.position], sample.size()))
+				return id;
+		}
+	}
+	// Otherwise the sample may still match the beginning of another sample.
 	int id = 0;
 	for(auto&& i : samples)
 	{
@@ -469,6 +798,100 @@ int Wave_Bank::find_duplicate(const Wave_Bank::Sample& header, const std::vector
 	return -1;
 }
 
+//! Add a sample to be placed later by pack().
+unsigned int Wave_Bank::add_pending_sample(Wave_Bank::Sample header, const std::vector<uint8_t>& sample)
+{
+	auto data = std::vector<uint8_t>(sample.begin(), sample.begin() + header.size);
+	unsigned int id;
+	header.position = 0;
+
+	auto search = pending_index.find(data);
+	if(search != pending_index.end())
+	{
+		id = search->second;
+		duplicate_count++;
+		duplicate_bytes += header.size;
+		// Reuse the header if possible
+		for(auto&& sample_id : pending[id].samples)
+		{
+			header.position = samples[sample_id].position;
+			if(samples[sample_id] == header)
+				return sample_id;
+		}
+	}
+	else
+	{
+		id = pending.size();
+		pending.push_back({data, {}});
+		pending_index[data] = id;
+	}
+	pending[id].samples.push_back(samples.size());
+	samples.push_back(header);
+	return samples.size() - 1;
+}
+
+//! Look for sample data that can be partially shared.
+/*!
+ *  Returns the position of an existing sample whose end matches the
+ *  sample data. Otherwise, returns the start position where the
+ *  beginning of the sample data overlaps the end of the ROM data.
+ *
+ *  Returns NO_FIT if the data cannot be shared or if the sample
+ *  would not fit in a bank at the shared position.
+ */
+uint32_t Wave_Bank::find_shared_position(const Wave_Bank::Sample& header, const std::vector<uint8_t>& sample) const
+{
+	uint32_t size = header.size;
+	if(!size)
+		return NO_FIT;
+
+	// Match the end of an existing sample
+	for(auto&& i : samples)
+	{
+		if(i.size < size)
+			continue;
+		uint32_t pos = i.position + i.size - size;
+		if(!memcmp(&sample[0], &rom_data[pos], size) && fit_sample(header, pos, max_size) == pos)
+			return pos;
+	}
+
+	// Overlap with the end of the ROM data. The sample is matched
+	// against the end of the ROM data using the KMP failure function,
+	// so that all overlaps are found in linear time. Comparing each
+	// overlap length separately would take quadratic time when long
+	// prefixes match, which is common with silence.
+	uint32_t window = std::min<uint32_t>(size - 1, current_size);
+	// border[k] is the length of the longest proper prefix of
+	// sample[0..k) that is also its suffix.
+	std::vector<uint32_t> border(size + 1, 0);
+	for(uint32_t k = 1, length = 0; k < size; k++)
+	{
+		while(length && sample[k] != sample[length])
+			length = border[length];
+		if(sample[k] == sample[length])
+			length++;
+		border[k + 1] = length;
+	}
+	// The window is shorter than the sample, so the match length is
+	// always less than the sample size.
+	uint32_t overlap = 0;
+	for(uint32_t pos = current_size - window; pos < current_size; pos++)
+	{
+		while(overlap && rom_data[pos] != sample[overlap])
+			overlap = border[overlap];
+		if(rom_data[pos] == sample[overlap])
+			overlap++;
+	}
+	// Try the overlaps from the longest to the shortest
+	for(; overlap > 0; overlap = border[overlap])
+	{
+		uint32_t pos = current_size - overlap;
+		if(fit_sample(header, pos, max_size) == pos)
+			return pos;
+	}
+	return NO_FIT;
+}
+
 //=====================================================================
 //! Fill a sample header with values from a byte vector.
 /*!
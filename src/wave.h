@@ -4,6 +4,8 @@
 #include "core.h"
 #include <string>
 #include <vector>
+#include <map>
+#include <mutex>
 #include <stdint.h>
 
 //! Wave file
@@ -42,6 +44,32 @@ class Wave_File
 		std::vector<std::vector<int16_t>> data;
 };
 
+//! Wave file cache
+/*!
+ *  Keeps wave files in memory, so that they do not need to be decoded
+ *  again when a song is recompiled. A file is decoded again if its
+ *  size or contents have changed.
+ *
+ *  \see Wave_Bank::set_cache()
+ */
+class Wave_Cache
+{
+	public:
+		std::shared_ptr<const Wave_File> read(const std::string& filename);
+		std::vector<std::string> get_filenames() const;
+
+	private:
+		struct Entry
+		{
+			unsigned long size;
+			uint32_t hash;
+			std::shared_ptr<const Wave_File> file;
+		};
+
+		mutable std::mutex mutex;
+		std::map<std::string, Entry> files;
+};
+
 //! Base wave rom bank
 class Wave_Bank
 {
@@ -67,11 +95,15 @@ class Wave_Bank
 		virtual ~Wave_Bank();
 
 		// Helper methods
+		static void set_cache(std::shared_ptr<Wave_Cache> cache);
 		void set_include_paths(const Tag& tag);
+		void set_partial_sharing(bool enable);
+		void set_deferred_packing(bool enable);
 
 		// Methods to modify wave ROM memory
 		unsigned int add_sample(const Tag& tag);
 		unsigned int add_sample(Sample header, const std::vector<uint8_t>& sample);
+		void pack();
 
 		// Methods to get wave ROM memory
 		const std::vector<Sample>& get_sample_headers();
@@ -79,6 +111,12 @@ class Wave_Bank
 		unsigned int get_free_bytes();
 		unsigned int get_total_gap();
 		unsigned int get_largest_gap();
+		unsigned int get_duplicate_count();
+		unsigned int get_duplicate_bytes();
+		unsigned int get_shared_count();
+		unsigned int get_shared_bytes();
+		std::vector<unsigned int> get_wasted_bytes();
+		const std::vector<std::string>& get_loaded_files() const;
 		const std::string& get_error();
 
 	protected:
@@ -88,22 +126,50 @@ class Wave_Bank
 			unsigned long end;
 		};
 
+		//! Sample data waiting to be placed by pack().
+		struct Pending_Data
+		{
+			std::vector<uint8_t> data;
+			std::vector<unsigned int> samples;
+		};
+
 		static const uint32_t NO_FIT = (uint32_t)-1;
 
 		unsigned int find_gap(const Sample& header, uint32_t& gap_start) const;
 		virtual std::vector<uint8_t> encode_sample(const std::string& encoding_type, const std::vector<int16_t>& input);
 		virtual uint32_t fit_sample(const Sample& header, uint32_t start, uint32_t end) const;
 		virtual int find_duplicate(const Sample& header, const std::vector<uint8_t>& sample) const;
+		virtual uint32_t find_shared_position(const Sample& header, const std::vector<uint8_t>& sample) const;
+		unsigned int add_pending_sample(Sample header, const std::vector<uint8_t>& sample);
+		static std::shared_ptr<const Wave_File> read_wave_file(const std::string& filename);
+
+		//! Wave file cache shared by all instances.
+		static std::shared_ptr<Wave_Cache> cache;
 
 		unsigned long max_size;
 		unsigned long current_size;
 		unsigned long bank_size;
 
 		Tag include_paths;
+		//! Files read by add_sample(const Tag&).
+		std::vector<std::string> loaded_files;
 		std::vector<uint8_t> rom_data;
 		std::vector<Gap> gaps;
 		std::vector<Sample> samples;
+		//! Maps sample length and fingerprint to the samples added with that data.
+		std::map<std::pair<uint32_t, uint32_t>, std::vector<int>> sample_index;
 		std::string error_message;
+
+		std::vector<Pending_Data> pending;
+		//! Maps pending sample data to the pending index.
+		std::map<std::vector<uint8_t>, unsigned int> pending_index;
+
+		bool partial_sharing;
+		bool deferred_packing;
+		unsigned int duplicate_count;
+		unsigned int duplicate_bytes;
+		unsigned int shared_count;
+		unsigned int shared_bytes;
 };
 
 #endif
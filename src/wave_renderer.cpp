@@ -0,0 +1,252 @@
+#include <algorithm>
+#include "wave_renderer.h"
+#include "util.h"
+
+//! Constructs a Wave_Renderer.
+/*!
+ *  The chip clocks default to the NTSC Mega Drive clocks, and can be
+ *  changed by setting the clock fields of the VGM header with poke32().
+ *
+ *  \param stream Output stream. Must be seekable.
+ *  \param rate Output sample rate.
+ */
+Wave_Renderer::Wave_Renderer(std::ostream& stream, uint32_t rate)
+	: ym2612()
+	, sn76489(3579545, rate)
+	, stream(&stream)
+	, stream_start(stream.tellp())
+	, completed(0)
+	, rate(rate)
+	, fm_clock(7670454)
+	, fm_counter(0)
+	, fm_output()
+	, curr_delay(0)
+	, sample_count(0)
+	, bank()
+	, dac_streams()
+	, buffer()
+{
+	std::vector<uint8_t> header;
+	write_be32(header, 0, 0x52494646); // 'RIFF'
+	write_le32(header, 4, header_size - 8);
+	write_be32(header, 8, 0x57415645); // 'WAVE'
+	write_be32(header, 12, 0x666d7420); // 'fmt '
+	write_le32(header, 16, 16);
+	write_le32(header, 20, 0x00020001); // PCM, 2 channels
+	write_le32(header, 24, rate);
+	write_le32(header, 28, rate * 4);
+	write_le32(header, 32, 0x00100004); // 4 bytes per sample, 16 bits
+	write_be32(header, 36, 0x64617461); // 'data'
+	write_le32(header, 40, 0);
+	stream.write((char*)header.data(), header.size());
+	buffer.reserve(stream_buffer_alloc);
+}
+
+//! Completes the WAV file if stop() has not been called.
+Wave_Renderer::~Wave_Renderer()
+{
+	if(!completed)
+		stop();
+}
+
+//! Write to a sound chip.
+/*!
+ *  Only the YM2612 (0x52) and SN76489 (0x50) commands are supported.
+ */
+void Wave_Renderer::write(uint8_t command, uint16_t port, uint16_t reg, uint16_t data)
+{
+	add_delay();
+	if(command == 0x52)
+		ym2612.write(port, reg, data);
+	else if(command == 0x50)
+		sn76489.write(data);
+}
+
+//! Set up a DAC stream.
+/*!
+ *  The data is always read from the type 0x00 datablock bank.
+ */
+void Wave_Renderer::dac_setup(uint8_t sid, uint8_t chip_id, uint32_t port, uint32_t reg, uint8_t db_id)
+{
+	add_delay();
+	Dac_Stream& dac = dac_streams[sid];
+	dac.chip_id = chip_id;
+	dac.port = port;
+	dac.reg = reg;
+	dac.active = false;
+}
+
+//! Start a DAC stream.
+/*!
+ *  \param length Length in bytes.
+ *  \param freq Frequency in Hz.
+ */
+void Wave_Renderer::dac_start(uint8_t sid, uint32_t start, uint32_t length, uint32_t freq)
+{
+	add_delay();
+	auto it = dac_streams.find(sid);
+	if(it == dac_streams.end())
+		return;
+	Dac_Stream& dac = it->second;
+	dac.active = true;
+	dac.position = start;
+	dac.remaining = length;
+	dac.step = freq * 144;
+	// The first byte is written at the next chip sample
+	dac.counter = fm_clock;
+}
+
+//! Stop a DAC stream.
+void Wave_Renderer::dac_stop(uint8_t sid)
+{
+	add_delay();
+	auto it = dac_streams.find(sid);
+	if(it != dac_streams.end())
+		it->second.active = false;
+}
+
+//! Set a VGM header field.
+/*!
+ *  Only the YM2612 (0x2c) and SN76489 (0x0c) clocks are used.
+ */
+void Wave_Renderer::poke32(uint32_t offset, uint32_t data)
+{
+	add_delay();
+	data &= 0x3fffffff;
+	if(offset == 0x2c && data)
+		fm_clock = data;
+	else if(offset == 0x0c && data)
+		sn76489.set_clock(data, rate);
+}
+
+void Wave_Renderer::poke16(uint32_t offset, uint16_t data)
+{
+}
+
+void Wave_Renderer::poke8(uint32_t offset, uint8_t data)
+{
+}
+
+//! Add a datablock.
+/*!
+ *  Type 0x00 (YM2612 PCM data) datablocks are appended to the DAC
+ *  stream bank. Other types are ignored.
+ */
+void Wave_Renderer::datablock(uint8_t dbtype, uint32_t dbsize, const uint8_t* db, uint32_t maxsize, uint32_t mask, uint32_t flags, uint32_t offset)
+{
+	add_delay();
+	if(dbtype == 0x00)
+		bank.insert(bank.end(), db, db + dbsize);
+}
+
+//! Add a delay.
+/*!
+ *  \param count Delay in 44.1kHz samples.
+ */
+void Wave_Renderer::delay(double count)
+{
+	curr_delay += count * rate / 44100.0;
+}
+
+//! Render the remaining delay and complete the WAV file.
+void Wave_Renderer::stop()
+{
+	if(completed)
+		return;
+	add_delay();
+	flush();
+	completed = 1;
+
+	std::streampos end = stream->tellp();
+	std::vector<uint8_t> size;
+	write_le32(size, 0, header_size - 8 + sample_count * 4);
+	stream->seekp(stream_start + std::streamoff(4));
+	stream->write((char*)size.data(), 4);
+	write_le32(size, 0, sample_count * 4);
+	stream->seekp(stream_start + std::streamoff(40));
+	stream->write((char*)size.data(), 4);
+	stream->seekp(end);
+}
+
+//! Get the number of samples rendered.
+uint32_t Wave_Renderer::get_sample_count() const
+{
+	return sample_count;
+}
+
+//! Render the accumulated delay.
+void Wave_Renderer::add_delay()
+{
+	if(curr_delay >= 1.0)
+	{
+		uint32_t count = curr_delay;
+		curr_delay -= count;
+		render(count);
+	}
+}
+
+//! Render one YM2612 sample and update the DAC streams.
+void Wave_Renderer::update_fm()
+{
+	for(auto&& it : dac_streams)
+	{
+		Dac_Stream& dac = it.second;
+		if(!dac.active)
+			continue;
+		dac.counter += dac.step;
+		while(dac.counter >= fm_clock)
+		{
+			dac.counter -= fm_clock;
+			if(!dac.remaining || dac.position >= bank.size())
+			{
+				dac.active = false;
+				break;
+			}
+			if(dac.chip_id == 0x02)
+				ym2612.write(dac.port, dac.reg, bank[dac.position]);
+			dac.position++;
+			dac.remaining--;
+		}
+	}
+	fm_output[0][0] = fm_output[1][0];
+	fm_output[0][1] = fm_output[1][1];
+	ym2612.update(fm_output[1]);
+}
+
+//! Render samples to the output buffer.
+/*!
+ *  The YM2612 output is linearly interpolated between its two most
+ *  recent samples.
+ */
+void Wave_Renderer::render(uint32_t count)
+{
+	const uint32_t fm_period = rate * 144;
+	while(count--)
+	{
+		fm_counter += fm_clock;
+		while(fm_counter >= fm_period)
+		{
+			fm_counter -= fm_period;
+			update_fm();
+		}
+		int32_t psg = sn76489.update();
+		int64_t frac = fm_counter;
+		for(int ch=0; ch<2; ch++)
+		{
+			int32_t fm = fm_output[0][ch] + ((fm_output[1][ch] - fm_output[0][ch]) * frac) / fm_period;
+			int32_t sample = std::min(32767, std::max(-32768, (fm >> 1) + psg));
+			buffer.push_back(sample);
+			buffer.push_back(sample >> 8);
+		}
+		sample_count++;
+		if(buffer.size() >= stream_buffer_alloc)
+			flush();
+	}
+}
+
+//! Write the output buffer to the stream.
+void Wave_Renderer::flush()
+{
+	stream->write((char*)buffer.data(), buffer.size());
+	buffer.clear();
+}
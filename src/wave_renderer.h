@@ -0,0 +1,87 @@
+//! \file wave_renderer.h
+#ifndef WAVE_RENDERER_H
+#define WAVE_RENDERER_H
+#include "core.h"
+#include "vgm.h"
+#include "emu/ym2612.h"
+#include "emu/sn76489.h"
+#include <ostream>
+
+//! Renders sound chip register writes to a WAV file.
+/*!
+ *  This emulates the YM2612 and SN76489 sound chips and writes
+ *  16-bit stereo PCM data to the output stream, so that songs can be
+ *  rendered without an external VGM player.
+ *
+ *  Delays are given in 44.1kHz samples, as with VGM_Writer. The YM2612
+ *  is emulated at its native sample rate and resampled to the output
+ *  rate. DAC streams write to the YM2612 at the native sample rate.
+ *
+ *  The RIFF header is written when the Wave_Renderer is constructed
+ *  and patched when stop() is called. The output stream must be
+ *  seekable.
+ */
+class Wave_Renderer : public VGM_Interface
+{
+	public:
+		Wave_Renderer(std::ostream& stream, uint32_t rate = 44100);
+		virtual ~Wave_Renderer();
+
+		void write(uint8_t command, uint16_t port, uint16_t reg, uint16_t data) override;
+		void dac_setup(uint8_t sid, uint8_t chip_id, uint32_t port, uint32_t reg, uint8_t db_id) override;
+		void dac_start(uint8_t sid, uint32_t start, uint32_t length, uint32_t freq) override;
+		void dac_stop(uint8_t sid) override;
+		void poke32(uint32_t offset, uint32_t data) override;
+		void poke16(uint32_t offset, uint16_t data) override;
+		void poke8(uint32_t offset, uint8_t data) override;
+		void datablock(uint8_t dbtype,
+			uint32_t dbsize,
+			const uint8_t* db,
+			uint32_t maxsize,
+			uint32_t mask = 0xffffffff,
+			uint32_t flags = 0,
+			uint32_t offset = 0) override;
+		void delay(double count) override;
+		void stop() override;
+
+		uint32_t get_sample_count() const;
+
+	private:
+		static const uint32_t header_size = 44;
+		static const uint32_t stream_buffer_alloc = 0x10000;
+
+		//! DAC stream state
+		struct Dac_Stream
+		{
+			uint8_t chip_id;
+			uint8_t port;
+			uint8_t reg;
+			bool active;
+			uint32_t position;
+			uint32_t remaining;
+			uint32_t step;
+			uint32_t counter;
+		};
+
+		void render(uint32_t count);
+		void update_fm();
+		void add_delay();
+		void flush();
+
+		YM2612 ym2612;
+		SN76489 sn76489;
+		std::ostream* stream;
+		std::streampos stream_start;
+		bool completed;
+		uint32_t rate;
+		uint32_t fm_clock;
+		uint32_t fm_counter;
+		int32_t fm_output[2][2];
+		double curr_delay;
+		uint32_t sample_count;
+		std::vector<uint8_t> bank;
+		std::map<uint8_t, Dac_Stream> dac_streams;
+		std::vector<uint8_t> buffer;
+};
+
+#endif